@@ -0,0 +1,666 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <sys/inotify.h>
+
+/*
+ Tab completion.
+
+ Command names (builtins, ./bin and every absolute PATH directory) live in
+ a byte-wise prefix trie, so completing a command is a walk down the
+ prefix plus the part all candidates share. Each directory is listed once
+ and then kept current through an inotify watch: created, deleted, renamed
+ and chmod'ed files update the trie one name at a time. Nothing is rescanned
+ unless PATH or the working directory (which decides ./bin) changes, and
+ then only the directories that were added. When no watch can be had
+ (inotify's per-user limits), a directory is listed once and listed again
+ only when its mtime changes.
+
+ Paths complete against sorted getdents64 listings held in a dir_cache,
+ reused for as long as the directory's mtime is unchanged.
+*/
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define MAX_LISTED 256
+
+struct trie_node {
+    unsigned char *keys; // edge byte of each child, sorted
+    struct trie_node **children;
+    int num_children;
+    int capacity;
+    int terminal; // number of sources providing exactly this name
+    int below;    // distinct names in this subtree, this node included
+};
+
+// Names one directory currently contributes, for undoing on delete
+struct name_set {
+    char **slots;
+    size_t capacity;
+    size_t count;
+    size_t used; // live names plus deletion markers
+};
+
+struct source {
+    char *path;
+    int wd;    // inotify watch, -1 while the directory is missing
+    int alias; // same directory as another source; inotify shares the watch
+    int polled; // no watch available: rescanned when 'mtime' changes
+    struct timespec mtime;
+    struct name_set names;
+};
+
+static struct trie_node trie_root;
+static struct source *sources;
+static int num_sources = 0, sources_capacity = 0;
+static int inotify_fd = -1;
+static char *synced_path, *synced_bin;
+static struct dir_cache path_cache;
+static char tombstone;
+
+static struct trie_node *trie_child(const struct trie_node *node, unsigned char c, int *slot) {
+    int lo = 0, hi = node->num_children;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (node->keys[mid] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (slot != NULL) {
+        *slot = lo;
+    }
+    return lo < node->num_children && node->keys[lo] == c ? node->children[lo] : NULL;
+}
+
+static void trie_insert(const char *name) {
+    struct trie_node *node = &trie_root;
+    int slot;
+
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        struct trie_node *child = trie_child(node, *p, &slot);
+        if (child == NULL) {
+            if (node->num_children == node->capacity) {
+                node->capacity = node->capacity ? node->capacity * 2 : 2;
+                node->keys = realloc(node->keys, node->capacity);
+                node->children = realloc(node->children, node->capacity * sizeof(struct trie_node *));
+                if (node->keys == NULL || node->children == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            memmove(node->keys + slot + 1, node->keys + slot, node->num_children - slot);
+            memmove(node->children + slot + 1, node->children + slot,
+                    (node->num_children - slot) * sizeof(struct trie_node *));
+            child = calloc(1, sizeof(struct trie_node));
+            node->keys[slot] = *p;
+            node->children[slot] = child;
+            node->num_children++;
+        }
+        node = child;
+    }
+    if (node->terminal++ > 0) {
+        return; // already listed by another source
+    }
+    node = &trie_root;
+    node->below++;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        node = trie_child(node, *p, NULL);
+        node->below++;
+    }
+}
+
+static void trie_free(struct trie_node *node) {
+    for (int i = 0; i < node->num_children; i++) {
+        trie_free(node->children[i]);
+    }
+    free(node->keys);
+    free(node->children);
+    free(node);
+}
+
+static void trie_remove(const char *name) {
+    struct trie_node *node = &trie_root;
+    const unsigned char *p;
+
+    for (p = (const unsigned char *)name; *p != '\0' && node != NULL; p++) {
+        node = trie_child(node, *p, NULL);
+    }
+    if (node == NULL || node->terminal == 0 || --node->terminal > 0) {
+        return;
+    }
+    // Last source gone: drop the count along the path and prune what empties
+    node = &trie_root;
+    node->below--;
+    for (p = (const unsigned char *)name; *p != '\0'; p++) {
+        int slot;
+        struct trie_node *child = trie_child(node, *p, &slot);
+        if (--child->below == 0) {
+            trie_free(child);
+            node->num_children--;
+            memmove(node->keys + slot, node->keys + slot + 1, node->num_children - slot);
+            memmove(node->children + slot, node->children + slot + 1,
+                    (node->num_children - slot) * sizeof(struct trie_node *));
+            return;
+        }
+        node = child;
+    }
+}
+
+static size_t name_hash(const char *name) {
+    size_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)name; *p != '\0'; p++) {
+        h = h * 33 + *p;
+    }
+    return h;
+}
+
+// Slot holding 'name', or the free slot where it would go
+static char **set_find(struct name_set *set, const char *name) {
+    char **free_slot = NULL;
+    size_t mask = set->capacity - 1;
+    for (size_t i = name_hash(name) & mask;; i = (i + 1) & mask) {
+        if (set->slots[i] == NULL) {
+            return free_slot != NULL ? free_slot : &set->slots[i];
+        }
+        if (set->slots[i] == &tombstone) {
+            if (free_slot == NULL) {
+                free_slot = &set->slots[i];
+            }
+        } else if (strcmp(set->slots[i], name) == 0) {
+            return &set->slots[i];
+        }
+    }
+}
+
+// Rehash, dropping deletion markers, and double the size if it is over a quarter full
+static void set_grow(struct name_set *set) {
+    struct name_set bigger = {0};
+    bigger.capacity = set->capacity == 0 ? 64 : set->count * 4 > set->capacity ? set->capacity * 2 : set->capacity;
+    bigger.slots = calloc(bigger.capacity, sizeof(char *));
+    if (bigger.slots == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->slots[i] != NULL && set->slots[i] != &tombstone) {
+            *set_find(&bigger, set->slots[i]) = set->slots[i];
+            bigger.count++;
+            bigger.used++;
+        }
+    }
+    free(set->slots);
+    *set = bigger;
+}
+
+static void source_add_name(struct source *src, const char *name) {
+    if ((src->names.used + 1) * 2 > src->names.capacity) {
+        set_grow(&src->names);
+    }
+    char **slot = set_find(&src->names, name);
+    if (*slot != NULL && *slot != &tombstone) {
+        return;
+    }
+    if (*slot == NULL) {
+        src->names.used++;
+    }
+    *slot = strdup(name);
+    src->names.count++;
+    trie_insert(name);
+}
+
+static void source_remove_name(struct source *src, const char *name) {
+    if (src->names.capacity == 0) {
+        return;
+    }
+    char **slot = set_find(&src->names, name);
+    if (*slot == NULL || *slot == &tombstone) {
+        return;
+    }
+    trie_remove(name);
+    free(*slot);
+    *slot = &tombstone;
+    src->names.count--;
+}
+
+static void source_clear(struct source *src) {
+    for (size_t i = 0; i < src->names.capacity; i++) {
+        if (src->names.slots[i] != NULL && src->names.slots[i] != &tombstone) {
+            trie_remove(src->names.slots[i]);
+            free(src->names.slots[i]);
+        }
+    }
+    free(src->names.slots);
+    memset(&src->names, 0, sizeof(src->names));
+}
+
+static int is_executable(int dir_fd, const char *name) {
+    struct stat st;
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111) != 0;
+}
+
+static void source_scan(struct source *src) {
+    struct dir_listing listing;
+    int fd = open(src->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    dir_listing_read(fd, &listing);
+    for (int i = 0; i < listing.count; i++) {
+        if (listing.entries[i].type != DT_DIR && is_executable(fd, listing.entries[i].name)) {
+            source_add_name(src, listing.entries[i].name);
+        }
+    }
+    dir_listing_free(&listing);
+    close(fd);
+}
+
+// Relist a source without a watch if its directory changed since the last listing
+static void source_poll(struct source *src) {
+    struct stat st;
+    if (stat(src->path, &st) != 0) {
+        memset(&st, 0, sizeof(st)); // gone: drop its names, list it again when it returns
+    }
+    if (st.st_mtim.tv_sec == src->mtime.tv_sec && st.st_mtim.tv_nsec == src->mtime.tv_nsec) {
+        return;
+    }
+    src->mtime = st.st_mtim;
+    source_clear(src);
+    source_scan(src);
+}
+
+// Watch a source's directory and list it, unless another source already does
+static void source_watch(struct source *src) {
+    src->wd = inotify_fd >= 0 ? inotify_add_watch(inotify_fd, src->path, WATCH_MASK) : -1;
+    if (src->wd < 0) {
+        // A missing directory is watched once it exists; any other failure means polling
+        if (inotify_fd < 0 || (errno != ENOENT && errno != ENOTDIR)) {
+            src->polled = 1;
+            source_poll(src);
+        }
+        return;
+    }
+    src->alias = 0;
+    for (int i = 0; i < num_sources; i++) {
+        if (&sources[i] != src && sources[i].wd == src->wd && !sources[i].alias) {
+            src->alias = 1;
+            return;
+        }
+    }
+    source_scan(src);
+}
+
+static struct source *primary_source(int wd) {
+    for (int i = 0; i < num_sources; i++) {
+        if (sources[i].wd == wd && !sources[i].alias) {
+            return &sources[i];
+        }
+    }
+    return NULL;
+}
+
+static void remove_source(int index) {
+    struct source *src = &sources[index];
+    if (!src->alias && src->wd >= 0) {
+        // Hand the names and the watch over to a source for the same directory
+        struct source *heir = NULL;
+        for (int i = 0; i < num_sources; i++) {
+            if (i != index && sources[i].wd == src->wd) {
+                heir = &sources[i];
+                break;
+            }
+        }
+        if (heir != NULL) {
+            heir->alias = 0;
+            heir->names = src->names;
+            memset(&src->names, 0, sizeof(src->names));
+        } else {
+            inotify_rm_watch(inotify_fd, src->wd);
+        }
+    }
+    source_clear(src);
+    free(src->path);
+    memmove(&sources[index], &sources[index + 1], (num_sources - index - 1) * sizeof(struct source));
+    num_sources--;
+}
+
+static void add_source(const char *path) {
+    for (int i = 0; i < num_sources; i++) {
+        if (strcmp(sources[i].path, path) == 0) {
+            return;
+        }
+    }
+    if (num_sources == sources_capacity) {
+        sources_capacity = sources_capacity ? sources_capacity * 2 : 16;
+        sources = realloc(sources, sources_capacity * sizeof(struct source));
+        if (sources == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct source *src = &sources[num_sources++];
+    memset(src, 0, sizeof(*src));
+    src->path = strdup(path);
+    source_watch(src);
+}
+
+// Whether 'path' is ./bin or one of the absolute directories in PATH
+static int wanted_source(const char *path, const char *bin, const char *search_path) {
+    size_t len = strlen(path);
+    if (strcmp(path, bin) == 0) {
+        return 1;
+    }
+    for (const char *p = search_path; *p != '\0';) {
+        const char *end = strchrnul(p, ':');
+        if ((size_t)(end - p) == len && strncmp(p, path, len) == 0) {
+            return 1;
+        }
+        p = *end == ':' ? end + 1 : end;
+    }
+    return 0;
+}
+
+// Bring the set of sources in line with the current PATH and working directory
+static void sync_sources(void) {
+    const char *search_path = getenv("PATH") != NULL ? getenv("PATH") : "";
+    char cwd[PATH_MAX];
+    struct strbuf bin = {0};
+
+    if (inotify_fd < 0) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        for (int i = 0; i < num_builtin_functions(); i++) {
+            trie_insert(builtin_commands[i]);
+        }
+    }
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        strbuf_append_str(&bin, cwd);
+        strbuf_append_str(&bin, "/bin");
+    } else {
+        strbuf_append_str(&bin, "");
+    }
+
+    if (synced_path == NULL || strcmp(synced_path, search_path) != 0 || strcmp(synced_bin, bin.buf) != 0) {
+        for (int i = num_sources - 1; i >= 0; i--) {
+            if (!wanted_source(sources[i].path, bin.buf, search_path)) {
+                remove_source(i);
+            }
+        }
+        if (bin.len > 0) {
+            add_source(bin.buf);
+        }
+        for (const char *p = search_path; *p != '\0';) {
+            const char *end = strchrnul(p, ':');
+            if (*p == '/') {
+                char *dir = strndup(p, end - p);
+                add_source(dir);
+                free(dir);
+            }
+            p = *end == ':' ? end + 1 : end;
+        }
+        free(synced_path);
+        free(synced_bin);
+        synced_path = strdup(search_path);
+        synced_bin = strbuf_detach(&bin);
+    }
+    strbuf_free(&bin);
+
+    // Directories that did not exist yet, e.g. a ./bin still to be built
+    for (int i = 0; i < num_sources; i++) {
+        if (sources[i].polled) {
+            source_poll(&sources[i]);
+        } else if (sources[i].wd < 0) {
+            source_watch(&sources[i]);
+        }
+    }
+}
+
+static void name_changed(struct source *src, const char *name, uint32_t mask) {
+    if (mask & (IN_DELETE | IN_MOVED_FROM)) {
+        source_remove_name(src, name);
+        return;
+    }
+    int fd = open(src->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0 && is_executable(fd, name)) {
+        source_add_name(src, name);
+    } else {
+        source_remove_name(src, name); // e.g. chmod -x
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Apply the queued inotify events to the trie
+static void apply_events(void) {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // Events were lost: relist every directory
+                for (int i = 0; i < num_sources; i++) {
+                    if (sources[i].polled) {
+                        continue;
+                    }
+                    source_clear(&sources[i]);
+                    if (!sources[i].alias && sources[i].wd >= 0) {
+                        source_scan(&sources[i]);
+                    }
+                }
+                continue;
+            }
+            struct source *src = primary_source(ev->wd);
+            if (src == NULL) {
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                // Directory deleted or moved away; watch it again when it returns
+                source_clear(src);
+                for (int i = 0; i < num_sources; i++) {
+                    if (sources[i].wd == ev->wd) {
+                        sources[i].wd = -1;
+                    }
+                }
+            } else if (ev->len > 0 && !(ev->mask & IN_ISDIR)) {
+                name_changed(src, ev->name, ev->mask);
+            }
+        }
+    }
+}
+
+// Append the names under 'node' to 'out', one per line
+static void collect_names(const struct trie_node *node, struct strbuf *prefix, struct strbuf *out, int *left) {
+    if (*left <= 0) {
+        return;
+    }
+    if (node->terminal > 0) {
+        strbuf_append(out, prefix->buf, prefix->len);
+        strbuf_append_char(out, '\n');
+        (*left)--;
+    }
+    for (int i = 0; i < node->num_children; i++) {
+        strbuf_append_char(prefix, (char)node->keys[i]);
+        collect_names(node->children[i], prefix, out, left);
+        prefix->buf[--prefix->len] = '\0';
+    }
+}
+
+static int complete_command(const char *word, struct strbuf *insert, struct strbuf *matches) {
+    const struct trie_node *node = &trie_root;
+
+    sync_sources();
+    apply_events();
+
+    for (const unsigned char *p = (const unsigned char *)word; *p != '\0' && node != NULL; p++) {
+        node = trie_child(node, *p, NULL);
+    }
+    if (node == NULL || node->below == 0) {
+        return 0;
+    }
+    // Extend through the part every candidate shares
+    while (node->terminal == 0 && node->num_children == 1) {
+        strbuf_append_char(insert, (char)node->keys[0]);
+        node = node->children[0];
+    }
+    if (node->below == 1) {
+        return 1;
+    }
+    if (insert->len == 0) {
+        struct strbuf prefix = {0};
+        int left = MAX_LISTED;
+        strbuf_append_str(&prefix, word);
+        collect_names(node, &prefix, matches, &left);
+        strbuf_free(&prefix);
+    }
+    return node->below;
+}
+
+static int complete_path(const char *word, struct strbuf *insert, struct strbuf *matches, int *is_dir) {
+    const char *slash = strrchr(word, '/');
+    const char *base = slash != NULL ? slash + 1 : word;
+    struct strbuf dir = {0};
+
+    if (word[0] == '~' && word[1] == '/' && getenv("HOME") != NULL) {
+        strbuf_append_str(&dir, getenv("HOME"));
+        strbuf_append(&dir, word + 1, slash - word - 1);
+    } else if (slash != NULL) {
+        strbuf_append(&dir, word, slash == word ? 1 : (size_t)(slash - word));
+    } else {
+        strbuf_append_str(&dir, "");
+    }
+
+    const struct dir_listing *listing = dir_cache_get(&path_cache, dir.buf, 1);
+    size_t base_len = strlen(base);
+    int count = 0, first = -1;
+    size_t common = 0;
+
+    if (listing != NULL) {
+        // Names are sorted, so the matches are one run starting at the first >= base
+        int lo = 0, hi = listing->count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (strcmp(listing->entries[mid].name, base) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (int i = lo; i < listing->count && strncmp(listing->entries[i].name, base, base_len) == 0; i++) {
+            const char *name = listing->entries[i].name;
+            if (name[0] == '.' && base[0] != '.') {
+                continue;
+            }
+            if (first < 0) {
+                first = i;
+                common = strlen(name);
+            } else {
+                const char *a = listing->entries[first].name;
+                size_t k = base_len;
+                while (k < common && a[k] == name[k]) {
+                    k++;
+                }
+                common = k;
+            }
+            if (count++ < MAX_LISTED) {
+                strbuf_append_str(matches, name);
+                if (dir_entry_is_dir(dir.buf[0] != '\0' ? dir.buf : ".", &listing->entries[i])) {
+                    strbuf_append_char(matches, '/');
+                }
+                strbuf_append_char(matches, '\n');
+            }
+        }
+    }
+    if (count > 0) {
+        strbuf_append(insert, listing->entries[first].name + base_len, common - base_len);
+        *is_dir = count == 1 && dir_entry_is_dir(dir.buf[0] != '\0' ? dir.buf : ".", &listing->entries[first]);
+    }
+    strbuf_free(&dir);
+    return count;
+}
+
+// Append 'text' to 'out' escaped the way the lexer reads it back
+static void append_escaped(struct strbuf *out, const char *text, size_t len, char quote) {
+    for (size_t i = 0; i < len; i++) {
+        if (quote == 0 && strchr(" \t\\'\"$;&|<>*?[]#", text[i]) != NULL) {
+            strbuf_append_char(out, '\\');
+        } else if (quote == '"' && strchr("\\\"$", text[i]) != NULL) {
+            strbuf_append_char(out, '\\');
+        }
+        strbuf_append_char(out, text[i]);
+    }
+}
+
+/*
+ Complete the word that ends at 'pos' in 'line'. Appends the text to
+ insert at the cursor to 'insert' and returns the number of candidates.
+ When the candidates share nothing more than what was typed, they are
+ listed in 'matches', one per line.
+*/
+int complete_word(const char *line, size_t pos, struct strbuf *insert, struct strbuf *matches) {
+    struct strbuf word = {0}, text = {0};
+    int command_position = 1, after_redirect = 0, in_word = 0, is_dir = 0, count;
+    char quote = 0;
+
+    // Find the current word, undoing quoting as the lexer does
+    for (size_t i = 0; i < pos; i++) {
+        char c = line[i];
+        if (quote != 0) {
+            if (c == quote) {
+                quote = 0;
+            } else {
+                strbuf_append_char(&word, c == '\\' && quote == '"' && i + 1 < pos ? line[++i] : c);
+            }
+        } else if (c == '\\' && i + 1 < pos) {
+            strbuf_append_char(&word, line[++i]);
+            in_word = 1;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+            in_word = 1;
+        } else if (c == ' ' || c == '\t' || c == '<' || c == '>' || c == ';' || c == '&' || c == '|') {
+            if (in_word) {
+                if (after_redirect) {
+                    after_redirect = 0;
+                } else {
+                    command_position = 0;
+                }
+            }
+            if (c == '<' || c == '>') {
+                after_redirect = 1;
+            } else if (c == ';' || c == '&' || c == '|') {
+                command_position = 1;
+                after_redirect = 0;
+            }
+            in_word = 0;
+            strbuf_reset(&word);
+        } else {
+            strbuf_append_char(&word, c);
+            in_word = 1;
+        }
+    }
+    strbuf_append_str(&word, "");
+
+    if (command_position && !after_redirect && strchr(word.buf, '/') == NULL) {
+        count = complete_command(word.buf, &text, matches);
+    } else {
+        count = complete_path(word.buf, &text, matches, &is_dir);
+    }
+
+    append_escaped(insert, text.buf != NULL ? text.buf : "", text.len, quote);
+    if (count == 1 && is_dir) {
+        strbuf_append_char(insert, '/');
+    } else if (count == 1) {
+        if (quote != 0) {
+            strbuf_append_char(insert, quote);
+        }
+        strbuf_append_char(insert, ' ');
+    }
+    if (insert->len > 0 || count == 1) {
+        strbuf_reset(matches);
+    }
+    strbuf_free(&word);
+    strbuf_free(&text);
+    return count;
+}
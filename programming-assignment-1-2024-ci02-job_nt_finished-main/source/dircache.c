@@ -0,0 +1,197 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+/*
+ Directory listings read with getdents64 and kept in memory.
+
+ A listing is the sorted names of one directory with their d_type, read
+ in large batches straight from the kernel. A dir_cache holds listings by
+ path; when 'validate' is set, a cached listing is reused only while the
+ directory's inode and mtime are unchanged, which costs one stat instead
+ of re-reading the directory.
+*/
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static int compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct dir_entry *)a)->name, ((const struct dir_entry *)b)->name);
+}
+
+// Read the directory open on 'fd' into 'listing'. Skips "." and "..".
+int dir_listing_read(int fd, struct dir_listing *listing) {
+    char buf[32768];
+    long n;
+
+    memset(listing, 0, sizeof(*listing));
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+            if (listing->count == listing->capacity) {
+                listing->capacity = listing->capacity ? listing->capacity * 2 : 32;
+                listing->entries = realloc(listing->entries, listing->capacity * sizeof(struct dir_entry));
+                if (listing->entries == NULL) {
+                    perror("realloc");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            // Names are packed into one buffer; store offsets until it stops moving
+            listing->entries[listing->count].name = (char *)listing->names.len;
+            listing->entries[listing->count].type = d->d_type;
+            listing->count++;
+            strbuf_append(&listing->names, d->d_name, strlen(d->d_name) + 1);
+        }
+    }
+    for (int i = 0; i < listing->count; i++) {
+        listing->entries[i].name = listing->names.buf + (size_t)listing->entries[i].name;
+    }
+    if (listing->count > 1) {
+        qsort(listing->entries, listing->count, sizeof(struct dir_entry), compare_entries);
+    }
+    return n < 0 ? -1 : 0;
+}
+
+void dir_listing_free(struct dir_listing *listing) {
+    free(listing->entries);
+    strbuf_free(&listing->names);
+    memset(listing, 0, sizeof(*listing));
+}
+
+// Whether an entry is a directory, following symlinks when d_type is not enough
+int dir_entry_is_dir(const char *dir, const struct dir_entry *entry) {
+    struct stat st;
+    struct strbuf path = {0};
+    int is_dir;
+
+    if (entry->type == DT_DIR) {
+        return 1;
+    }
+    if (entry->type != DT_LNK && entry->type != DT_UNKNOWN) {
+        return 0;
+    }
+    strbuf_append_str(&path, dir);
+    strbuf_append_char(&path, '/');
+    strbuf_append_str(&path, entry->name);
+    is_dir = stat(path.buf, &st) == 0 && S_ISDIR(st.st_mode);
+    strbuf_free(&path);
+    return is_dir;
+}
+
+static size_t path_hash(const char *path) {
+    size_t h = 5381;
+    for (const unsigned char *p = (const unsigned char *)path; *p != '\0'; p++) {
+        h = h * 33 + *p;
+    }
+    return h;
+}
+
+// Slot of 'path' in the hash index: holds its position in cache->dirs, or -1
+static int *index_slot(const struct dir_cache *cache, const char *path) {
+    size_t mask = cache->num_slots - 1;
+    for (size_t i = path_hash(path) & mask;; i = (i + 1) & mask) {
+        int at = cache->slots[i];
+        if (at < 0 || strcmp(cache->dirs[at]->path, path) == 0) {
+            return &cache->slots[i];
+        }
+    }
+}
+
+static void index_rebuild(struct dir_cache *cache) {
+    cache->num_slots = cache->num_slots ? cache->num_slots * 2 : 16;
+    free(cache->slots);
+    cache->slots = malloc(cache->num_slots * sizeof(int));
+    if (cache->slots == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(cache->slots, -1, cache->num_slots * sizeof(int));
+    for (int i = 0; i < cache->count; i++) {
+        *index_slot(cache, cache->dirs[i]->path) = i;
+    }
+}
+
+/*
+ The listing of 'path' ("" means "."), read on first use. Returns NULL if
+ the directory cannot be opened.
+*/
+const struct dir_listing *dir_cache_get(struct dir_cache *cache, const char *path, int validate) {
+    const char *open_path = path[0] != '\0' ? path : ".";
+    struct stat st;
+
+    if ((cache->count + 1) * 2 > cache->num_slots) {
+        index_rebuild(cache);
+    }
+    int *slot = index_slot(cache, path);
+    int i = *slot >= 0 ? *slot : cache->count;
+    if (i < cache->count && !validate) {
+        return &cache->dirs[i]->listing;
+    }
+
+    int fd = open(open_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    if (i < cache->count) {
+        struct cached_dir *dir = cache->dirs[i];
+        if (dir->dev == st.st_dev && dir->ino == st.st_ino && dir->mtime.tv_sec == st.st_mtim.tv_sec &&
+            dir->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            close(fd);
+            return &dir->listing;
+        }
+        dir_listing_free(&dir->listing);
+    } else {
+        if (cache->count == cache->capacity) {
+            cache->capacity = cache->capacity ? cache->capacity * 2 : 8;
+            cache->dirs = realloc(cache->dirs, cache->capacity * sizeof(struct cached_dir *));
+            if (cache->dirs == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        // Allocated one by one so listings stay put while the cache grows
+        cache->dirs[i] = calloc(1, sizeof(struct cached_dir));
+        cache->dirs[i]->path = strdup(path);
+        cache->count++;
+        *slot = i;
+    }
+
+    struct cached_dir *dir = cache->dirs[i];
+    dir->dev = st.st_dev;
+    dir->ino = st.st_ino;
+    dir->mtime = st.st_mtim;
+    dir_listing_read(fd, &dir->listing);
+    close(fd);
+    return &dir->listing;
+}
+
+void dir_cache_clear(struct dir_cache *cache) {
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->dirs[i]->path);
+        dir_listing_free(&cache->dirs[i]->listing);
+        free(cache->dirs[i]);
+    }
+    cache->count = 0;
+    if (cache->slots != NULL) {
+        memset(cache->slots, -1, cache->num_slots * sizeof(int));
+    }
+}
+
+void dir_cache_free(struct dir_cache *cache) {
+    dir_cache_clear(cache);
+    free(cache->dirs);
+    free(cache->slots);
+    memset(cache, 0, sizeof(*cache));
+}
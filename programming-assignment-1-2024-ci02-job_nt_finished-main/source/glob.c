@@ -0,0 +1,368 @@
+#include "shell.h"
+
+/*
+ Glob expansion: '*', '?', '[...]' (with '!' or '^' to negate) and a '**'
+ path component, which matches any number of directories.
+
+ The pattern is split at '/' and each component compiled once into a list
+ of match operations. The walk then lists each directory it visits through
+ a dir_cache (so a directory named by several words of one command is read
+ only once), jumps straight to the run of sorted names that share the
+ component's literal prefix, and tests only those. Literal components are
+ looked up in the parent's listing rather than stat'ed, except "." and
+ "..", which listings leave out and which are simply followed. As in sh,
+ '*' and '?' do not match a leading '.', and the results are sorted.
+
+ Backslash escapes a character, which is how quoted parts of a word reach
+ here (see expand_token()).
+*/
+
+#define GLOB_CHAR 0  // one literal byte
+#define GLOB_ANY 1   // ?
+#define GLOB_STAR 2  // *
+#define GLOB_CLASS 3 // [...]
+
+struct glob_op {
+    int type;
+    unsigned char c;
+    uint8_t set[32]; // GLOB_CLASS: bitmap of accepted bytes
+};
+
+struct glob_component {
+    struct glob_op *ops;
+    int num_ops;
+    int recursive;     // the component is '**'
+    int literal;       // no wildcards; 'text' is the unescaped name
+    char *text;
+    size_t prefix_len; // literal bytes every match starts with
+};
+
+struct glob_state {
+    struct glob_component *components;
+    int num_components;
+    int dirs_only; // pattern ended in '/'
+    struct dir_cache *cache;
+    struct glob_matches *matches;
+};
+
+static void add_match(struct glob_matches *matches, const char *path, size_t len) {
+    if (matches->count == matches->capacity) {
+        matches->capacity = matches->capacity ? matches->capacity * 2 : 16;
+        matches->paths = realloc(matches->paths, matches->capacity * sizeof(char *));
+        if (matches->paths == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    matches->paths[matches->count++] = strndup(path, len);
+}
+
+// Parse a bracket expression starting after '['; returns the byte after ']'
+// or NULL if it is not closed, in which case '[' is an ordinary character
+static const char *compile_class(const char *p, const char *end, struct glob_op *op) {
+    int negate = 0, first = 1;
+
+    memset(op->set, 0, sizeof(op->set));
+    op->type = GLOB_CLASS;
+    if (p < end && (*p == '!' || *p == '^')) {
+        negate = 1;
+        p++;
+    }
+    while (p < end && (*p != ']' || first)) {
+        unsigned char lo = (unsigned char)*p++;
+        if (lo == '\\' && p < end) {
+            lo = (unsigned char)*p++;
+        }
+        unsigned char hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            p++;
+            hi = (unsigned char)*p++;
+            if (hi == '\\' && p < end) {
+                hi = (unsigned char)*p++;
+            }
+        }
+        for (int c = lo; c <= hi; c++) {
+            op->set[c >> 3] |= 1 << (c & 7);
+        }
+        first = 0;
+    }
+    if (p >= end) {
+        return NULL;
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            op->set[i] = ~op->set[i];
+        }
+    }
+    return p + 1;
+}
+
+static void compile_component(const char *p, const char *end, struct glob_component *comp) {
+    struct strbuf text = {0};
+    int capacity = 0, literal = 1;
+
+    memset(comp, 0, sizeof(*comp));
+    comp->recursive = end - p == 2 && p[0] == '*' && p[1] == '*';
+    while (p < end) {
+        if (comp->num_ops == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            comp->ops = realloc(comp->ops, capacity * sizeof(struct glob_op));
+            if (comp->ops == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        struct glob_op *op = &comp->ops[comp->num_ops];
+        const char *after;
+        if (*p == '\\' && p + 1 < end) {
+            op->type = GLOB_CHAR;
+            op->c = (unsigned char)p[1];
+            p += 2;
+        } else if (*p == '*') {
+            op->type = GLOB_STAR;
+            p++;
+            if (comp->num_ops > 0 && comp->ops[comp->num_ops - 1].type == GLOB_STAR) {
+                continue; // '**' inside a name is just '*'
+            }
+        } else if (*p == '?') {
+            op->type = GLOB_ANY;
+            p++;
+        } else if (*p == '[' && (after = compile_class(p + 1, end, op)) != NULL) {
+            p = after;
+        } else {
+            op->type = GLOB_CHAR;
+            op->c = (unsigned char)*p++;
+        }
+        if (op->type == GLOB_CHAR) {
+            strbuf_append_char(&text, (char)op->c);
+            if (literal) {
+                comp->prefix_len++;
+            }
+        } else {
+            literal = 0;
+        }
+        comp->num_ops++;
+    }
+    comp->literal = literal;
+    if (literal || comp->prefix_len > 0) {
+        // The unescaped name, or the literal prefix for the sorted-run lookup
+        comp->text = literal ? strbuf_detach(&text) : strndup(text.buf, comp->prefix_len);
+    }
+    strbuf_free(&text);
+}
+
+static int op_matches(const struct glob_op *op, unsigned char c) {
+    switch (op->type) {
+    case GLOB_CHAR:
+        return op->c == c;
+    case GLOB_ANY:
+        return 1;
+    case GLOB_CLASS:
+        return (op->set[c >> 3] >> (c & 7)) & 1;
+    }
+    return 0;
+}
+
+// Match a name against compiled ops, backtracking only to the latest '*'
+static int component_matches(const struct glob_component *comp, const char *name) {
+    const char *s = name, *star_s = NULL;
+    int op = 0, star_op = -1;
+
+    if (name[0] == '.' && (comp->num_ops == 0 || comp->ops[0].type != GLOB_CHAR)) {
+        return 0; // hidden names must be matched by a literal '.'
+    }
+    while (*s != '\0') {
+        if (op < comp->num_ops && comp->ops[op].type == GLOB_STAR) {
+            star_op = op++;
+            star_s = s;
+        } else if (op < comp->num_ops && op_matches(&comp->ops[op], (unsigned char)*s)) {
+            op++;
+            s++;
+        } else if (star_op >= 0) {
+            op = star_op + 1;
+            s = ++star_s;
+        } else {
+            return 0;
+        }
+    }
+    while (op < comp->num_ops && comp->ops[op].type == GLOB_STAR) {
+        op++;
+    }
+    return op == comp->num_ops;
+}
+
+// Index of the first entry >= 'prefix' in a sorted listing
+static int lower_bound(const struct dir_listing *listing, const char *prefix) {
+    int lo = 0, hi = listing->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (strcmp(listing->entries[mid].name, prefix) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void walk(struct glob_state *gs, struct strbuf *path, int index);
+
+// The directory a walk step lists; 'path' may move as the walk extends it
+static const char *dir_name(const struct strbuf *path) {
+    return path->len > 0 ? path->buf : ".";
+}
+
+// Descend into 'name' under 'path' and continue the walk at component 'index'
+static void walk_child(struct glob_state *gs, struct strbuf *path, const char *name, int index) {
+    size_t saved = path->len;
+    if (path->len > 0 && path->buf[path->len - 1] != '/') {
+        strbuf_append_char(path, '/');
+    }
+    strbuf_append_str(path, name);
+    walk(gs, path, index);
+    path->len = saved;
+    path->buf[saved] = '\0';
+}
+
+static void walk(struct glob_state *gs, struct strbuf *path, int index) {
+    if (index == gs->num_components) {
+        if (gs->dirs_only) {
+            strbuf_append_char(path, '/');
+            add_match(gs->matches, path->buf, path->len);
+            path->buf[--path->len] = '\0';
+        } else {
+            add_match(gs->matches, path->buf, path->len);
+        }
+        return;
+    }
+
+    const struct glob_component *comp = &gs->components[index];
+    int last = index + 1 == gs->num_components;
+    int need_dir = !last || gs->dirs_only;
+
+    // Every directory has "." and ".."; the next step's listing fails if this one does not exist
+    if (comp->literal && (strcmp(comp->text, ".") == 0 || strcmp(comp->text, "..") == 0)) {
+        walk_child(gs, path, comp->text, index + 1);
+        return;
+    }
+
+    const struct dir_listing *listing = dir_cache_get(gs->cache, path->len > 0 ? path->buf : "", 0);
+    if (listing == NULL) {
+        return;
+    }
+
+    if (comp->literal) {
+        int i = lower_bound(listing, comp->text);
+        if (i < listing->count && strcmp(listing->entries[i].name, comp->text) == 0 &&
+            (!need_dir || dir_entry_is_dir(dir_name(path), &listing->entries[i]))) {
+            walk_child(gs, path, comp->text, index + 1);
+        }
+        return;
+    }
+
+    if (comp->recursive) {
+        // Zero directories, then each subdirectory with '**' still active.
+        // Only real directories are entered, so symlink loops are not followed.
+        if (!last) {
+            walk(gs, path, index + 1);
+        }
+        for (int i = 0; i < listing->count; i++) {
+            const struct dir_entry *entry = &listing->entries[i];
+            if (entry->name[0] == '.') {
+                continue;
+            }
+            int real_dir = entry->type == DT_DIR;
+            if (entry->type == DT_UNKNOWN) {
+                struct stat st;
+                struct strbuf full = {0};
+                strbuf_append_str(&full, dir_name(path));
+                strbuf_append_char(&full, '/');
+                strbuf_append_str(&full, entry->name);
+                real_dir = lstat(full.buf, &st) == 0 && S_ISDIR(st.st_mode);
+                strbuf_free(&full);
+            }
+            if (last && (!gs->dirs_only || real_dir)) {
+                // A trailing '**' matches everything below
+                walk_child(gs, path, entry->name, index + 1);
+            }
+            if (real_dir) {
+                walk_child(gs, path, entry->name, index);
+            }
+        }
+        return;
+    }
+
+    int i = comp->prefix_len > 0 ? lower_bound(listing, comp->text) : 0;
+    for (; i < listing->count; i++) {
+        const struct dir_entry *entry = &listing->entries[i];
+        if (comp->prefix_len > 0 && strncmp(entry->name, comp->text, comp->prefix_len) != 0) {
+            break; // past the run of names with the literal prefix
+        }
+        if (component_matches(comp, entry->name) && (!need_dir || dir_entry_is_dir(dir_name(path), entry))) {
+            walk_child(gs, path, entry->name, index + 1);
+        }
+    }
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ Expand 'pattern' (with '\' escapes) into the sorted list of existing
+ paths it matches. Directories are listed through 'cache'. Returns the
+ number of matches.
+*/
+int glob_expand(const char *pattern, struct dir_cache *cache, struct glob_matches *matches) {
+    struct glob_state gs = {0};
+    struct strbuf path = {0};
+    int capacity = 0;
+    const char *p = pattern;
+
+    gs.cache = cache;
+    gs.matches = matches;
+    matches->count = 0;
+
+    if (*p == '/') {
+        strbuf_append_char(&path, '/');
+        while (*p == '/') {
+            p++;
+        }
+    }
+    while (*p != '\0') {
+        const char *end = p;
+        while (*end != '\0' && *end != '/') {
+            end += end[0] == '\\' && end[1] != '\0' ? 2 : 1;
+        }
+        if (gs.num_components == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            gs.components = realloc(gs.components, capacity * sizeof(struct glob_component));
+            if (gs.components == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        compile_component(p, end, &gs.components[gs.num_components++]);
+        p = end;
+        while (*p == '/') {
+            p++;
+            gs.dirs_only = *p == '\0';
+        }
+    }
+
+    strbuf_append_str(&path, "");
+    if (gs.num_components > 0) {
+        walk(&gs, &path, 0);
+    }
+    if (matches->count > 1) {
+        qsort(matches->paths, matches->count, sizeof(char *), compare_paths);
+    }
+
+    for (int i = 0; i < gs.num_components; i++) {
+        free(gs.components[i].ops);
+        free(gs.components[i].text);
+    }
+    free(gs.components);
+    strbuf_free(&path);
+    return matches->count;
+}
@@ -0,0 +1,130 @@
+#include "shell.h"
+#include <stdint.h>
+
+/*
+ Command history: a ring of the last HISTORY_SIZE lines plus a trigram
+ index for reverse search.
+
+ Every line gets a sequence number; line 'id' lives in entries[id %
+ HISTORY_SIZE] for as long as it is among the newest HISTORY_SIZE. The
+ index maps each 3-byte substring (hashed into a fixed set of buckets) to
+ the ascending list of ids containing it. A search looks up the trigrams
+ of the query, walks the shortest list from the newest id down and checks
+ the few candidates with strstr, instead of scanning every line.
+*/
+
+#define HISTORY_SIZE 10000
+#define TRIGRAM_BUCKETS 8192
+
+struct posting_list {
+    long *ids;
+    int start; // ids before this have been evicted from the ring
+    int count;
+    int capacity;
+};
+
+static char *entries[HISTORY_SIZE];
+static long next_id = 0;
+static struct posting_list trigram_index[TRIGRAM_BUCKETS];
+
+static unsigned trigram_bucket(const char *s) {
+    uint32_t key = (uint32_t)(unsigned char)s[0] << 16 | (uint32_t)(unsigned char)s[1] << 8 | (unsigned char)s[2];
+    return (key * 2654435761u) >> 19 & (TRIGRAM_BUCKETS - 1);
+}
+
+static long oldest_id(void) {
+    return next_id > HISTORY_SIZE ? next_id - HISTORY_SIZE : 0;
+}
+
+static void posting_add(struct posting_list *list, long id) {
+    if (list->count > list->start && list->ids[list->count - 1] == id) {
+        return; // trigram seen earlier in the same line
+    }
+    long oldest = oldest_id();
+    while (list->start < list->count && list->ids[list->start] < oldest) {
+        list->start++;
+    }
+    if (list->count == list->capacity) {
+        if (list->start > 0) {
+            // Reclaim the evicted prefix before growing
+            memmove(list->ids, list->ids + list->start, (list->count - list->start) * sizeof(long));
+            list->count -= list->start;
+            list->start = 0;
+        }
+        if (list->count == list->capacity) {
+            list->capacity = list->capacity ? list->capacity * 2 : 8;
+            list->ids = realloc(list->ids, list->capacity * sizeof(long));
+            if (list->ids == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    list->ids[list->count++] = id;
+}
+
+void add_to_history(const char *cmd) {
+    long id = next_id++;
+    char **slot = &entries[id % HISTORY_SIZE];
+
+    free(*slot);
+    *slot = strdup(cmd);
+    for (size_t i = 0; cmd[i] != '\0' && cmd[i + 1] != '\0' && cmd[i + 2] != '\0'; i++) {
+        posting_add(&trigram_index[trigram_bucket(cmd + i)], id);
+    }
+}
+
+int history_length(void) {
+    return (int)(next_id - oldest_id());
+}
+
+// Entry 'n' counting from the oldest (0) to history_length() - 1
+const char *history_entry(int n) {
+    return entries[(oldest_id() + n) % HISTORY_SIZE];
+}
+
+/*
+ Find the newest entry before 'before' (an entry number as for
+ history_entry) that contains 'query'. Returns its number, or -1.
+*/
+int history_search(const char *query, int before) {
+    long oldest = oldest_id();
+    long limit = oldest + (before < history_length() ? before : history_length());
+    size_t len = strlen(query);
+
+    if (len < 3) {
+        // Too short for the index; short queries match almost anything anyway
+        for (long id = limit - 1; id >= oldest; id--) {
+            if (strstr(entries[id % HISTORY_SIZE], query) != NULL) {
+                return (int)(id - oldest);
+            }
+        }
+        return -1;
+    }
+
+    // Candidates are the ids of the query's rarest trigram
+    struct posting_list *best = NULL;
+    for (size_t i = 0; i + 2 < len; i++) {
+        struct posting_list *list = &trigram_index[trigram_bucket(query + i)];
+        if (best == NULL || list->count - list->start < best->count - best->start) {
+            best = list;
+        }
+    }
+
+    // Skip ids at or after 'limit' by binary search, then walk back
+    int lo = best->start, hi = best->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (best->ids[mid] < limit) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (int i = lo - 1; i >= best->start && best->ids[i] >= oldest; i--) {
+        if (strstr(entries[best->ids[i] % HISTORY_SIZE], query) != NULL) {
+            return (int)(best->ids[i] - oldest);
+        }
+    }
+    return -1;
+}
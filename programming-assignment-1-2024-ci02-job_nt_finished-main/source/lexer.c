@@ -0,0 +1,550 @@
+#include "shell.h"
+#include <ctype.h>
+
+/*
+ Single-pass lexer for a command line.
+
+ Words are unquoted in place: the write pointer never overtakes the read
+ pointer, so every word ends up as a slice of the original line buffer and
+ no allocation is needed unless a word contains $-expansions. Such words are
+ additionally described by segments (literal runs and variable names, again
+ slices of the line) which expand_token() resolves at run time.
+*/
+
+static void *grow_array(void *array, int *capacity, int needed, size_t elem_size) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    int new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    array = realloc(array, new_capacity * elem_size);
+    if (array == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+static struct token *push_token(struct token_list *list, int type) {
+    list->tokens = grow_array(list->tokens, &list->capacity, list->count + 1, sizeof(struct token));
+    struct token *tok = &list->tokens[list->count++];
+    memset(tok, 0, sizeof(*tok));
+    tok->type = type;
+    return tok;
+}
+
+static struct segment *push_segment(struct token_list *list, int type, int quoted, int offset) {
+    list->segments = grow_array(list->segments, &list->segments_capacity, list->num_segments + 1, sizeof(struct segment));
+    struct segment *seg = &list->segments[list->num_segments++];
+    seg->type = type;
+    seg->quoted = quoted;
+    seg->offset = offset;
+    seg->length = 0;
+    return seg;
+}
+
+static int is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static int is_glob_char(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int is_operator_char(char c) {
+    return c == '<' || c == '>' || c == ';' || c == '&' || c == '|';
+}
+
+// Lex an operator at 'rd' and return the read pointer just past it, or NULL
+// with *error set. 'fd' is the descriptor a redirection applies to, -1 for
+// the default of the operator.
+static char *lex_operator(struct token_list *list, char *rd, int fd, const char **error) {
+    struct token *tok;
+
+    if (*rd == ';') {
+        push_token(list, TOK_SEMI);
+        return rd + 1;
+    }
+    if (*rd == '&' || *rd == '|') {
+        if (rd[1] != *rd) {
+            *error = *rd == '&' ? "background jobs ('&') are not supported" : "pipes ('|') are not supported";
+            return NULL;
+        }
+        push_token(list, *rd == '&' ? TOK_AND : TOK_OR);
+        return rd + 2;
+    }
+    if (*rd == '<') {
+        tok = push_token(list, TOK_REDIR_IN);
+        tok->fd = fd < 0 ? 0 : fd;
+        return rd + 1;
+    }
+
+    // '>', '>>' or '>&N'
+    fd = fd < 0 ? 1 : fd;
+    if (rd[1] == '>') {
+        tok = push_token(list, TOK_REDIR_APPEND);
+        tok->fd = fd;
+        return rd + 2;
+    }
+    if (rd[1] == '&' && (rd[2] == '1' || rd[2] == '2')) {
+        tok = push_token(list, TOK_REDIR_DUP);
+        tok->fd = fd;
+        tok->dup_fd = rd[2] - '0';
+        return rd + 3;
+    }
+    tok = push_token(list, TOK_REDIR_OUT);
+    tok->fd = fd;
+    return rd + 1;
+}
+
+// State shared by the helpers that build one word
+struct word_state {
+    struct token_list *list;
+    struct token *tok;
+    char *start;          // first byte of the word in the line buffer
+    char *wr;             // write pointer, always <= read pointer
+    struct segment *lit;  // literal segment currently being extended
+};
+
+static void emit_char(struct word_state *ws, char c, int quoted) {
+    if (ws->lit == NULL || ws->lit->quoted != quoted) {
+        ws->lit = push_segment(ws->list, SEG_LITERAL, quoted, (int)(ws->wr - ws->start));
+        ws->tok->num_segments++;
+    }
+    *ws->wr++ = c;
+    ws->lit->length++;
+    if (quoted) {
+        ws->tok->flags |= TOK_QUOTED;
+    } else if (is_glob_char(c)) {
+        ws->tok->flags |= TOK_GLOB;
+    }
+}
+
+// Try to lex a $-expansion at 'rd'. Returns the new read pointer, or NULL if
+// the '$' is literal. Variable names are copied down to the write pointer so
+// that the segment stays a slice of the line.
+static char *lex_dollar(struct word_state *ws, char *rd, int quoted, const char **error) {
+    char *name;
+    int length = 0;
+    int type = SEG_VAR;
+
+    if (rd[1] == '?') {
+        type = SEG_STATUS;
+        name = rd + 1;
+        length = 1;
+        rd += 2;
+    } else if (rd[1] == '{') {
+        name = rd + 2;
+        if (!is_name_start(*name)) {
+            *error = "bad substitution";
+            return NULL;
+        }
+        while (is_name_char(name[length])) {
+            length++;
+        }
+        if (name[length] != '}') {
+            *error = name[length] == '\0' ? "missing '}'" : "bad substitution";
+            return NULL;
+        }
+        rd = name + length + 1;
+    } else if (is_name_start(rd[1])) {
+        name = rd + 1;
+        while (is_name_char(name[length])) {
+            length++;
+        }
+        rd = name + length;
+    } else {
+        return NULL;
+    }
+
+    struct segment *seg = push_segment(ws->list, type, quoted, (int)(ws->wr - ws->start));
+    seg->length = length;
+    ws->tok->num_segments++;
+    memmove(ws->wr, name, length);
+    ws->wr += length;
+    ws->lit = NULL;
+    ws->tok->flags |= TOK_EXPAND;
+    return rd;
+}
+
+/*
+ Split 'line' into tokens, modifying it in place. Returns 0 on success, or
+ -1 with *error describing the problem (e.g. an unterminated quote).
+*/
+int lex_line(char *line, struct token_list *list, const char **error) {
+    char *rd = line;
+
+    list->count = 0;
+    list->num_segments = 0;
+    *error = NULL;
+
+    for (;;) {
+        while (is_blank(*rd)) {
+            rd++;
+        }
+        if (*rd == '\0') {
+            return 0;
+        }
+        if (*rd == '#') {
+            // Comment up to the end of the line
+            while (*rd != '\0' && *rd != '\n') {
+                rd++;
+            }
+            continue;
+        }
+        if (is_operator_char(*rd)) {
+            if ((rd = lex_operator(list, rd, -1, error)) == NULL) {
+                return -1;
+            }
+            continue;
+        }
+
+        struct word_state ws;
+        ws.list = list;
+        ws.tok = push_token(list, TOK_WORD);
+        ws.tok->first_segment = list->num_segments;
+        ws.start = rd;
+        ws.wr = rd;
+        ws.lit = NULL;
+
+        while (*rd != '\0' && !is_blank(*rd) && !is_operator_char(*rd)) {
+            char c = *rd;
+            if (c == '\\') {
+                if (rd[1] == '\n') {
+                    rd += 2; // line continuation
+                } else if (rd[1] != '\0') {
+                    emit_char(&ws, rd[1], 1);
+                    rd += 2;
+                } else {
+                    rd++;
+                }
+            } else if (c == '\'') {
+                rd++;
+                ws.tok->flags |= TOK_QUOTED;
+                while (*rd != '\'') {
+                    if (*rd == '\0') {
+                        *error = "unterminated single quote";
+                        return -1;
+                    }
+                    emit_char(&ws, *rd++, 1);
+                }
+                rd++;
+            } else if (c == '"') {
+                rd++;
+                ws.tok->flags |= TOK_QUOTED;
+                while (*rd != '"') {
+                    if (*rd == '\0') {
+                        *error = "unterminated double quote";
+                        return -1;
+                    }
+                    if (*rd == '\\' && rd[1] != '\0' && strchr("$\"\\`", rd[1]) != NULL) {
+                        emit_char(&ws, rd[1], 1);
+                        rd += 2;
+                    } else if (*rd == '\\' && rd[1] == '\n') {
+                        rd += 2;
+                    } else if (*rd == '$') {
+                        char *next = lex_dollar(&ws, rd, 1, error);
+                        if (*error != NULL) {
+                            return -1;
+                        }
+                        if (next != NULL) {
+                            rd = next;
+                        } else {
+                            emit_char(&ws, *rd++, 1);
+                        }
+                    } else {
+                        emit_char(&ws, *rd++, 1);
+                    }
+                }
+                rd++;
+            } else if (c == '$') {
+                char *next = lex_dollar(&ws, rd, 0, error);
+                if (*error != NULL) {
+                    return -1;
+                }
+                if (next != NULL) {
+                    rd = next;
+                } else {
+                    emit_char(&ws, *rd++, 0);
+                }
+            } else if (ws.wr == rd && ws.lit != NULL && !ws.lit->quoted) {
+                // Fast path: nothing has been removed from this word yet, so
+                // plain characters are already where they belong
+                ws.wr++;
+                rd++;
+                ws.lit->length++;
+                if (is_glob_char(c)) {
+                    ws.tok->flags |= TOK_GLOB;
+                }
+            } else {
+                emit_char(&ws, *rd++, 0);
+            }
+        }
+
+        struct token *tok = ws.tok;
+        char *end = ws.wr;
+        tok->text = ws.start;
+        tok->length = (int)(end - ws.start);
+
+        // Segments only matter when expansion needs them; otherwise the
+        // in-place text is the final argument
+        if (!(tok->flags & TOK_EXPAND) && !((tok->flags & TOK_GLOB) && (tok->flags & TOK_QUOTED))) {
+            list->num_segments = tok->first_segment;
+            tok->num_segments = 0;
+        }
+
+        // The operator that ended the word has to be read before the word's
+        // terminating NUL may overwrite it
+        if (is_operator_char(*rd)) {
+            if (*rd == '>' && rd == ws.start + 1 && *ws.start == '2') {
+                list->count--; // "2>" redirects stderr, the 2 is not a word
+                rd = lex_operator(list, rd, 2, error);
+            } else {
+                rd = lex_operator(list, rd, -1, error);
+            }
+            if (rd == NULL) {
+                return -1;
+            }
+        } else if (*rd != '\0') {
+            rd++;
+        }
+        *end = '\0';
+    }
+}
+
+/*
+ Append the expansion of a word token to 'out'. With glob_escape set, quoted
+ glob metacharacters (and backslashes) are escaped with '\' so the result can
+ be used as a glob pattern.
+*/
+void expand_token(const struct token_list *list, const struct token *tok, struct strbuf *out, int glob_escape) {
+    char name[256];
+
+    if (tok->num_segments == 0) {
+        strbuf_append(out, tok->text, tok->length);
+        return;
+    }
+
+    for (int i = 0; i < tok->num_segments; i++) {
+        const struct segment *seg = &list->segments[tok->first_segment + i];
+        const char *data = tok->text + seg->offset;
+
+        if (seg->type == SEG_LITERAL) {
+            if (glob_escape && seg->quoted) {
+                for (int j = 0; j < seg->length; j++) {
+                    if (is_glob_char(data[j]) || data[j] == '\\') {
+                        strbuf_append_char(out, '\\');
+                    }
+                    strbuf_append_char(out, data[j]);
+                }
+            } else {
+                strbuf_append(out, data, seg->length);
+            }
+        } else if (seg->type == SEG_STATUS) {
+            char status[16];
+            snprintf(status, sizeof(status), "%d", last_status);
+            strbuf_append_str(out, status);
+        } else {
+            int length = seg->length < (int)sizeof(name) - 1 ? seg->length : (int)sizeof(name) - 1;
+            memcpy(name, data, length);
+            name[length] = '\0';
+            const char *value = getenv(name);
+            for (; value != NULL && *value != '\0'; value++) {
+                if (glob_escape && seg->quoted && (is_glob_char(*value) || *value == '\\')) {
+                    strbuf_append_char(out, '\\');
+                }
+                strbuf_append_char(out, *value);
+            }
+        }
+    }
+}
+
+/*
+ Split a token list into simple commands joined by ';', '&&' and '||'.
+ Returns -1 with *error set if an operator has no command on one side or a
+ redirection has no target.
+*/
+int parse_command_list(const struct token_list *tokens, struct command_list *list, const char **error) {
+    int connector = TOK_SEMI;
+    int first = 0;
+
+    list->count = 0;
+    for (int i = 0; i <= tokens->count; i++) {
+        int type = i < tokens->count ? tokens->tokens[i].type : TOK_SEMI;
+        if (type == TOK_REDIR_IN || type == TOK_REDIR_OUT || type == TOK_REDIR_APPEND) {
+            if (i + 1 >= tokens->count || tokens->tokens[i + 1].type != TOK_WORD) {
+                *error = "missing redirection target";
+                return -1;
+            }
+        }
+        if (type != TOK_SEMI && type != TOK_AND && type != TOK_OR) {
+            continue;
+        }
+
+        if (i == first) {
+            // Empty command: fine after a trailing ';', an error elsewhere
+            if (i == tokens->count) {
+                if (connector == TOK_SEMI) {
+                    break;
+                }
+                *error = "missing command after operator";
+            } else {
+                *error = type == TOK_SEMI ? "unexpected ';'" : type == TOK_AND ? "unexpected '&&'" : "unexpected '||'";
+            }
+            return -1;
+        }
+
+        list->entries = grow_array(list->entries, &list->capacity, list->count + 1, sizeof(struct list_entry));
+        struct list_entry *entry = &list->entries[list->count++];
+        entry->connector = connector;
+        entry->first = first;
+        entry->count = i - first;
+
+        connector = type;
+        first = i + 1;
+    }
+    return 0;
+}
+
+static void arg_vector_own(struct arg_vector *av, char *str) {
+    av->owned = grow_array(av->owned, &av->owned_capacity, av->num_owned + 1, sizeof(char *));
+    av->owned[av->num_owned++] = str;
+}
+
+static void arg_vector_push(struct arg_vector *av, char *arg) {
+    av->argv = grow_array(av->argv, &av->capacity, av->argc + 2, sizeof(char *));
+    av->argv[av->argc++] = arg;
+    av->argv[av->argc] = NULL;
+}
+
+// Text of a word after expansion; allocated strings are owned by 'av'
+static char *expand_word(const struct token_list *list, const struct token *tok, struct arg_vector *av) {
+    if (!(tok->flags & TOK_EXPAND)) {
+        return tok->text;
+    }
+    struct strbuf sb = {0};
+    expand_token(list, tok, &sb, 0);
+    char *text = strbuf_detach(&sb);
+    arg_vector_own(av, text);
+    return text;
+}
+
+/*
+ Expand a word containing unquoted glob characters into the matching paths,
+ pushed onto 'av'. Returns the number of matches; with none, the caller
+ keeps the word as it is, like sh.
+*/
+static int expand_glob(const struct token_list *list, const struct token *tok, struct command *cmd,
+                       struct glob_matches *matches) {
+    struct strbuf pattern = {0};
+
+    expand_token(list, tok, &pattern, 1);
+    glob_expand(pattern.buf, &cmd->dirs, matches);
+    strbuf_free(&pattern);
+    for (int i = 0; i < matches->count; i++) {
+        arg_vector_own(&cmd->args, matches->paths[i]);
+    }
+    return matches->count;
+}
+
+/*
+ Expand 'count' tokens starting at 'first' into a NULL-terminated argv plus
+ the list of redirections. Returns -1 with *error set on a malformed
+ redirection.
+*/
+int build_command(const struct token_list *list, int first, int count, struct command *cmd, const char **error) {
+    struct arg_vector *av = &cmd->args;
+    struct glob_matches matches = {0};
+
+    command_reset(cmd);
+    av->argv = grow_array(av->argv, &av->capacity, 1, sizeof(char *));
+    av->argv[0] = NULL;
+
+    for (int i = first; i < first + count; i++) {
+        const struct token *tok = &list->tokens[i];
+        if (tok->type == TOK_WORD) {
+            if ((tok->flags & TOK_GLOB) && expand_glob(list, tok, cmd, &matches) > 0) {
+                for (int j = 0; j < matches.count; j++) {
+                    arg_vector_push(av, matches.paths[j]);
+                }
+            } else {
+                arg_vector_push(av, expand_word(list, tok, av));
+            }
+            continue;
+        }
+
+        cmd->redirs = grow_array(cmd->redirs, &cmd->redirs_capacity, cmd->num_redirs + 1, sizeof(struct redirection));
+        struct redirection *redir = &cmd->redirs[cmd->num_redirs++];
+        redir->type = tok->type;
+        redir->fd = tok->fd;
+        redir->dup_fd = tok->dup_fd;
+        redir->path = NULL;
+        if (tok->type != TOK_REDIR_DUP) {
+            if (i + 1 >= first + count || list->tokens[i + 1].type != TOK_WORD) {
+                *error = "missing redirection target";
+                free(matches.paths);
+                return -1;
+            }
+            const struct token *target = &list->tokens[++i];
+            int found = target->flags & TOK_GLOB ? expand_glob(list, target, cmd, &matches) : 0;
+            if (found > 1) {
+                *error = "ambiguous redirect";
+                free(matches.paths);
+                return -1;
+            }
+            redir->path = found == 1 ? matches.paths[0] : expand_word(list, target, av);
+        }
+    }
+    free(matches.paths);
+    return 0;
+}
+
+// Free the expanded strings but keep the arrays for the next command
+void command_reset(struct command *cmd) {
+    arg_vector_reset(&cmd->args);
+    cmd->num_redirs = 0;
+    dir_cache_clear(&cmd->dirs);
+}
+
+void command_free(struct command *cmd) {
+    arg_vector_free(&cmd->args);
+    dir_cache_free(&cmd->dirs);
+    free(cmd->redirs);
+    memset(cmd, 0, sizeof(*cmd));
+}
+
+// Free the expanded strings but keep the arrays for the next command
+void arg_vector_reset(struct arg_vector *av) {
+    for (int i = 0; i < av->num_owned; i++) {
+        free(av->owned[i]);
+    }
+    av->num_owned = 0;
+    av->argc = 0;
+    if (av->argv) {
+        av->argv[0] = NULL;
+    }
+}
+
+void arg_vector_free(struct arg_vector *av) {
+    arg_vector_reset(av);
+    free(av->argv);
+    free(av->owned);
+    memset(av, 0, sizeof(*av));
+}
+
+void token_list_free(struct token_list *list) {
+    free(list->tokens);
+    free(list->segments);
+    memset(list, 0, sizeof(*list));
+}
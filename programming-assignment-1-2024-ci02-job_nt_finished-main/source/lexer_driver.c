@@ -0,0 +1,250 @@
+#include "shell.h"
+#include <ctype.h>
+#include <time.h>
+
+/*
+ Standalone driver for the lexer, built by 'make lexer-bench' and
+ 'make lexer-fuzz' from lexer.c and the modules it uses (not the shell).
+
+   lexer_bench bench [LINES]          lex, parse and expand a fixed corpus
+   lexer_fuzz fuzz [LINES] [SEED]     random and mutated lines, checked
+
+ bench runs the lines of the corpus below through lex_line(),
+ parse_command_list() and build_command(), as the shell does for every
+ line, and reports lines/s (2,000,000 lines by default).
+
+ fuzz feeds random lines, and corpus lines with bytes replaced, inserted,
+ deleted or repeated, through the same steps (200,000 by default) and
+ checks that every token and segment lies inside the line and that argv
+ is NULL-terminated. It is meant to be built with AddressSanitizer, as
+ the make target does, so memory errors stop it too. The line being
+ checked is printed before aborting; the same SEED gives the same lines.
+ Fuzz lines contain no '/' and run in an empty directory, so globs only
+ ever list that directory.
+*/
+
+int last_status = 0;
+
+static const char *corpus[] = {
+    "ls -la",
+    "cd ../files && ls",
+    "echo hello world > out.txt",
+    "echo \"quoted $HOME and ${USER}\" 'single $HOME' done",
+    "grep -n pattern file1.txt file2.txt 2>&1 | sort",
+    "setenv PATH=/usr/local/bin:/usr/bin:/bin",
+    "cat < input.txt >> output.txt; echo status $?",
+    "find . -name \\*.c || echo none",
+    "backup && echo \"backup done: $?\"",
+    "printf '%s\\n' a\\ b \"c d\" e 2>/dev/null",
+    "dspawn; dcheck; sys",
+    "ld -a --color never /tmp",
+};
+#define CORPUS_SIZE (sizeof(corpus) / sizeof(corpus[0]))
+
+static const char alphabet[] = "ab =$?{}'\"\\;&|<>012*[]-.\t";
+
+struct lexer_state {
+    struct token_list tokens;
+    struct command_list list;
+    struct command cmd;
+};
+
+// Lex, parse and expand one line (modified in place); returns the number of words built
+static int run_line(struct lexer_state *state, char *line) {
+    const char *error;
+    int words = 0;
+
+    if (lex_line(line, &state->tokens, &error) != 0 || parse_command_list(&state->tokens, &state->list, &error) != 0) {
+        return 0;
+    }
+    for (int i = 0; i < state->list.count; i++) {
+        const struct list_entry *entry = &state->list.entries[i];
+        if (build_command(&state->tokens, entry->first, entry->count, &state->cmd, &error) == 0) {
+            words += state->cmd.args.argc;
+        }
+        command_reset(&state->cmd);
+    }
+    return words;
+}
+
+static void state_free(struct lexer_state *state) {
+    command_free(&state->cmd);
+    token_list_free(&state->tokens);
+    free(state->list.entries);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(long lines) {
+    struct lexer_state state = {0};
+    char buf[256];
+    size_t bytes = 0;
+    long words = 0;
+
+    double start = now();
+    for (long i = 0; i < lines; i++) {
+        const char *line = corpus[i % CORPUS_SIZE];
+        size_t length = strlen(line);
+        memcpy(buf, line, length + 1); // the lexer unquotes in place
+        words += run_line(&state, buf);
+        bytes += length;
+    }
+    double elapsed = now() - start;
+    state_free(&state);
+
+    printf("%ld lines (%zu bytes, %ld words) in %.3f s: %.0f lines/s, %.1f MB/s\n", lines, bytes, words, elapsed,
+           lines / elapsed, bytes / elapsed / 1e6);
+    return 0;
+}
+
+// xorshift64*, so a seed always gives the same lines
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static char random_char(uint64_t *rng) {
+    return next_random(rng) % 8 == 0 ? (char)(1 + next_random(rng) % 255) : alphabet[next_random(rng) % (sizeof(alphabet) - 1)];
+}
+
+// Fill 'buf' (of 'size' bytes) with a random line or a mutated corpus line
+static void make_line(uint64_t *rng, char *buf, size_t size) {
+    size_t length;
+
+    if (next_random(rng) % 4 == 0) {
+        length = next_random(rng) % (size / 2);
+        for (size_t i = 0; i < length; i++) {
+            buf[i] = random_char(rng);
+        }
+    } else {
+        length = snprintf(buf, size / 2, "%s", corpus[next_random(rng) % CORPUS_SIZE]);
+        length = length < size / 2 ? length : size / 2 - 1;
+        for (int edits = 1 + next_random(rng) % 4; edits > 0; edits--) {
+            size_t at = length > 0 ? next_random(rng) % length : 0;
+            switch (next_random(rng) % 4) {
+            case 0: // replace
+                if (length > 0) {
+                    buf[at] = random_char(rng);
+                }
+                break;
+            case 1: // insert
+                if (length + 1 < size) {
+                    memmove(buf + at + 1, buf + at, length - at);
+                    buf[at] = random_char(rng);
+                    length++;
+                }
+                break;
+            case 2: // delete
+                if (length > 0) {
+                    memmove(buf + at, buf + at + 1, length - at - 1);
+                    length--;
+                }
+                break;
+            default: { // repeat a slice
+                size_t n = length > at ? 1 + next_random(rng) % (length - at) : 0;
+                n = length + n < size ? n : size - 1 - length;
+                memmove(buf + at + n, buf + at, length - at);
+                length += n;
+                break;
+            }
+            }
+        }
+    }
+    buf[length] = '\0';
+    for (size_t i = 0; i < length; i++) {
+        if (buf[i] == '/' || buf[i] == '\0') {
+            buf[i] = '_'; // keep globs in the current directory, and the line one string
+        }
+    }
+}
+
+static void fail(const char *original, const char *what) {
+    fprintf(stderr, "lexer_fuzz: %s for line: \"", what);
+    for (const unsigned char *p = (const unsigned char *)original; *p != '\0'; p++) {
+        fprintf(stderr, isprint(*p) && *p != '"' && *p != '\\' ? "%c" : "\\x%02x", *p);
+    }
+    fprintf(stderr, "\"\n");
+    abort();
+}
+
+// Lex, parse and expand one line, checking what each step produced
+static void check_line(struct lexer_state *state, char *line, const char *original) {
+    size_t length = strlen(line);
+    const char *error;
+
+    if (lex_line(line, &state->tokens, &error) != 0) {
+        return;
+    }
+    for (int i = 0; i < state->tokens.count; i++) {
+        const struct token *tok = &state->tokens.tokens[i];
+        if (tok->type == TOK_WORD &&
+            (tok->text < line || tok->length < 0 || tok->text + tok->length > line + length)) {
+            fail(original, "token outside the line");
+        }
+        for (int s = tok->first_segment; s < tok->first_segment + tok->num_segments; s++) {
+            const struct segment *seg = &state->tokens.segments[s];
+            if (s >= state->tokens.num_segments || seg->offset < 0 || seg->offset + seg->length > tok->length) {
+                fail(original, "segment outside its token");
+            }
+        }
+    }
+    if (parse_command_list(&state->tokens, &state->list, &error) != 0) {
+        return;
+    }
+    for (int i = 0; i < state->list.count; i++) {
+        const struct list_entry *entry = &state->list.entries[i];
+        if (entry->first < 0 || entry->count < 0 || entry->first + entry->count > state->tokens.count) {
+            fail(original, "command outside the token list");
+        }
+        if (build_command(&state->tokens, entry->first, entry->count, &state->cmd, &error) == 0) {
+            const struct arg_vector *av = &state->cmd.args;
+            for (int a = 0; a < av->argc; a++) {
+                if (av->argv[a] == NULL) {
+                    fail(original, "NULL inside argv");
+                }
+            }
+            if (av->argv[av->argc] != NULL) {
+                fail(original, "argv not NULL-terminated");
+            }
+        }
+        command_reset(&state->cmd);
+    }
+}
+
+static int fuzz(long lines, uint64_t seed) {
+    struct lexer_state state = {0};
+    char dir[] = "/tmp/lexer_fuzz.XXXXXX", line[256], original[256];
+    uint64_t rng = seed ? seed : 1;
+
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        perror("lexer_fuzz");
+        return 1;
+    }
+    setenv("FUZZ", "value with spaces", 1);
+    for (long i = 0; i < lines; i++) {
+        make_line(&rng, line, sizeof(line));
+        memcpy(original, line, sizeof(line));
+        check_line(&state, line, original);
+    }
+    state_free(&state);
+    rmdir(dir);
+    printf("%ld lines checked (seed %llu)\n", lines, (unsigned long long)seed);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc >= 3 ? atol(argv[2]) : 2000000);
+    }
+    if (argc >= 2 && strcmp(argv[1], "fuzz") == 0) {
+        return fuzz(argc >= 3 ? atol(argv[2]) : 200000, argc >= 4 ? strtoull(argv[3], NULL, 10) : (uint64_t)time(NULL));
+    }
+    fprintf(stderr, "Usage: %s bench [LINES]\n       %s fuzz [LINES] [SEED]\n", argv[0], argv[0]);
+    return 2;
+}
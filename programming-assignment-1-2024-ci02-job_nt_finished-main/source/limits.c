@@ -0,0 +1,581 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <sys/resource.h>
+
+/*
+ Resource limits and accounting for the jobs the shell launches.
+
+   ulimit [-a]                          list the limits jobs get
+   ulimit [-H|-S] -c|-d|-f|-l|-n|-s|-t|-u|-v [VALUE|unlimited]
+   ulimit --clear                       jobs inherit the shell's limits again
+   ulimit --cgroup [on|off] [cpu=PERCENT] [memory=SIZE] [io=WEIGHT]
+
+ The limits are not applied to the shell itself, so a small -n or -v
+ cannot break it. spawn_command() applies them with setrlimit in the child
+ after fork, or with prlimit on a zygote helper before handing it the
+ command. Sizes are in KiB and -t is CPU seconds; without -H or -S both
+ the soft and the hard limit are set, as in sh.
+
+ In cgroup mode (also 'cseshell --cgroup') the shell creates
+ cseshell.<pid> under its own cgroup v2 directory, moves itself into the
+ leaf cseshell.<pid>/shell (a cgroup with processes of its own cannot
+ hand controllers to its children) and puts every job in a fresh leaf
+ job.N beside it, with cpu.max (PERCENT of one CPU),
+ memory.max and io.weight set from the options. The child joins its leaf
+ before exec, so everything it forks is confined too. When the job is
+ reaped its CPU time, throttling and memory peak are printed on stderr and
+ the leaf is removed. A controller can only be used if the parent cgroup
+ delegates it (lists it in cgroup.subtree_control, or can be made to);
+ the shell says which settings cannot be enforced, and jobs are still
+ accounted with the statistics every cgroup has.
+*/
+
+struct job_limit {
+    char option;
+    int resource;
+    int unit; // bytes per VALUE
+    const char *description;
+};
+
+static const struct job_limit job_limits[] = {
+    {'c', RLIMIT_CORE, 1024, "core file size (KiB)"},
+    {'d', RLIMIT_DATA, 1024, "data segment size (KiB)"},
+    {'f', RLIMIT_FSIZE, 1024, "file size (KiB)"},
+    {'l', RLIMIT_MEMLOCK, 1024, "locked memory (KiB)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (KiB)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (KiB)"},
+};
+
+#define NUM_JOB_LIMITS (sizeof(job_limits) / sizeof(job_limits[0]))
+#define MAX_CGROUP_JOBS 256
+
+static struct rlimit job_rlimits[NUM_JOB_LIMITS];
+static int job_rlimit_set[NUM_JOB_LIMITS];
+
+// Cgroup mode: the shell's directory, its settings and the leaves of running jobs
+static struct {
+    int enabled;
+    pid_t owner; // the shell that created 'dir'; forked children leave it alone
+    char base[PATH_MAX];     // the cgroup the shell started in, and returns to
+    char dir[PATH_MAX];
+    int has_cpu, has_memory, has_io;
+    int added_in_base[3];    // controllers this shell enabled in base's subtree_control
+    long cpu_percent;        // 0 for no cpu.max
+    long long memory_max;    // bytes, 0 for no memory.max
+    int io_weight;           // 0 for no io.weight
+    unsigned long next_job;
+    int pending;             // leaf prepared for the job being launched, or -1
+    struct {
+        pid_t pid;           // 0 while free, -1 while being launched
+        unsigned long id;
+    } jobs[MAX_CGROUP_JOBS];
+} cgroup = {.pending = -1};
+
+// Print a limit value as ulimit shows it
+static void print_limit_value(rlim_t value, int unit) {
+    if (value == RLIM_INFINITY) {
+        printf("unlimited\n");
+    } else {
+        printf("%llu\n", (unsigned long long)(value / unit));
+    }
+}
+
+// The limit a job would get: the one set with ulimit, or the shell's own
+static void job_rlimit(size_t i, struct rlimit *limit) {
+    if (job_rlimit_set[i]) {
+        *limit = job_rlimits[i];
+    } else if (getrlimit(job_limits[i].resource, limit) != 0) {
+        limit->rlim_cur = limit->rlim_max = RLIM_INFINITY;
+    }
+}
+
+static int write_file(const char *dir, const char *name, const char *value) {
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n == (ssize_t)strlen(value) ? 0 : -1;
+}
+
+// Whether a space-separated list such as cgroup.subtree_control has 'word'
+static int lists_word(const char *dir, const char *name, const char *word) {
+    char path[PATH_MAX + 64], line[256];
+    int found = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "re");
+    if (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        for (char *save, *w = strtok_r(line, " \n", &save); w != NULL && !found; w = strtok_r(NULL, " \n", &save)) {
+            found = strcmp(w, word) == 0;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    return found;
+}
+
+// Value of "key N" in a flat-keyed cgroup file such as cpu.stat, or -1
+static long long read_key(const char *dir, const char *name, const char *key) {
+    char path[PATH_MAX + 64], line[256];
+    long long value = -1;
+    size_t key_length = strlen(key);
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "re");
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (key_length == 0 || (strncmp(line, key, key_length) == 0 && line[key_length] == ' ')) {
+            value = atoll(line + key_length);
+            break;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    return value;
+}
+
+static const char *controllers[] = {"cpu", "memory", "io"};
+
+static void job_dir(int slot, char *out, size_t size) {
+    snprintf(out, size, "%s/job.%lu", cgroup.dir, cgroup.jobs[slot].id);
+}
+
+/*
+ Remove the leaves of finished jobs and the shell's directory, at exit.
+ Controllers are turned off again from the bottom up, since base takes
+ the shell back only once it hands none out that it did not before.
+*/
+static void cgroup_remove(void) {
+    char dir[PATH_MAX + 32], value[16];
+    int has[] = {cgroup.has_cpu, cgroup.has_memory, cgroup.has_io};
+
+    if (!cgroup.enabled || getpid() != cgroup.owner) {
+        return;
+    }
+    for (int i = 0; i < MAX_CGROUP_JOBS; i++) {
+        if (cgroup.jobs[i].pid != 0) {
+            job_dir(i, dir, sizeof(dir));
+            rmdir(dir);
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        snprintf(value, sizeof(value), "-%s", controllers[i]);
+        if (has[i]) {
+            write_file(cgroup.dir, "cgroup.subtree_control", value);
+        }
+        if (cgroup.added_in_base[i]) {
+            write_file(cgroup.base, "cgroup.subtree_control", value);
+        }
+    }
+    snprintf(value, sizeof(value), "%d", (int)getpid());
+    write_file(cgroup.base, "cgroup.procs", value);
+    snprintf(dir, sizeof(dir), "%s/shell", cgroup.dir);
+    rmdir(dir);
+    rmdir(cgroup.dir);
+    memset(cgroup.jobs, 0, sizeof(cgroup.jobs));
+    cgroup.enabled = 0;
+}
+
+// Find the cgroup v2 mount point and the shell's cgroup within it
+static int cgroup_base(char *out, size_t size) {
+    char line[PATH_MAX + 256], mount_point[PATH_MAX] = "";
+    FILE *file = fopen("/proc/self/mountinfo", "re");
+
+    // "36 25 0:31 / /sys/fs/cgroup rw,nosuid - cgroup2 cgroup2 rw"
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        char *fields = strstr(line, " - cgroup2 ");
+        if (fields != NULL && sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) == 1) {
+            break;
+        }
+        mount_point[0] = '\0';
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (mount_point[0] == '\0') {
+        errno = ENOENT;
+        return -1;
+    }
+
+    // The unified hierarchy is the "0::" line
+    file = fopen("/proc/self/cgroup", "re");
+    while (file != NULL && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(out, size, "%s%s", mount_point, strcmp(line + 3, "/") == 0 ? "" : line + 3);
+            fclose(file);
+            return 0;
+        }
+    }
+    if (file != NULL) {
+        fclose(file);
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+/*
+ Turn on cgroup mode: create the shell's directory, move the shell into
+ its leaf and delegate the cpu, memory and io controllers to the directory
+ where the parent allows. Returns 0 on success.
+*/
+int job_cgroup_enable(void) {
+    char shell_dir[PATH_MAX + 32], value[16];
+
+    if (cgroup.enabled) {
+        return 0;
+    }
+    if (cgroup_base(cgroup.base, sizeof(cgroup.base)) != 0) {
+        fprintf(stderr, "ulimit: no cgroup v2 hierarchy is mounted\n");
+        return 1;
+    }
+    if (snprintf(cgroup.dir, sizeof(cgroup.dir), "%s/cseshell.%d", cgroup.base, (int)getpid()) >=
+        (int)sizeof(cgroup.dir)) {
+        fprintf(stderr, "ulimit: cgroup path too long: %s\n", cgroup.base);
+        return 1;
+    }
+    snprintf(shell_dir, sizeof(shell_dir), "%s/shell", cgroup.dir);
+    snprintf(value, sizeof(value), "%d", (int)getpid());
+    if ((mkdir(cgroup.dir, 0755) != 0 && errno != EEXIST) || (mkdir(shell_dir, 0755) != 0 && errno != EEXIST) ||
+        write_file(shell_dir, "cgroup.procs", value) != 0) {
+        fprintf(stderr, "ulimit: cannot create a cgroup under %s: %s\n", cgroup.base, strerror(errno));
+        rmdir(shell_dir);
+        rmdir(cgroup.dir);
+        return 1;
+    }
+
+    // Each controller must be enabled in the parent's subtree_control before ours
+    int *enabled[] = {&cgroup.has_cpu, &cgroup.has_memory, &cgroup.has_io};
+    for (int i = 0; i < 3; i++) {
+        snprintf(value, sizeof(value), "+%s", controllers[i]);
+        cgroup.added_in_base[i] = !lists_word(cgroup.base, "cgroup.subtree_control", controllers[i]) &&
+                                  write_file(cgroup.base, "cgroup.subtree_control", value) == 0;
+        *enabled[i] = write_file(cgroup.dir, "cgroup.subtree_control", value) == 0;
+    }
+    cgroup.owner = getpid();
+    cgroup.enabled = 1;
+    static int registered = 0;
+    if (!registered) {
+        atexit(cgroup_remove);
+        registered = 1;
+    }
+    return 0;
+}
+
+// Warn about settings whose controller was not delegated to the shell
+static void warn_unenforced(void) {
+    if (cgroup.cpu_percent > 0 && !cgroup.has_cpu) {
+        fprintf(stderr, "ulimit: the cpu controller is not available in %s; cpu= will not be enforced\n", cgroup.dir);
+    }
+    if (cgroup.memory_max > 0 && !cgroup.has_memory) {
+        fprintf(stderr, "ulimit: the memory controller is not available in %s; memory= will not be enforced\n", cgroup.dir);
+    }
+    if (cgroup.io_weight > 0 && !cgroup.has_io) {
+        fprintf(stderr, "ulimit: the io controller is not available in %s; io= will not be enforced\n", cgroup.dir);
+    }
+}
+
+/*
+ Called by spawn_command() before launching: in cgroup mode, create the
+ leaf for the next job and write its settings. A failure only costs the
+ job its cgroup.
+*/
+void job_prepare(void) {
+    char dir[PATH_MAX + 32], value[64];
+    int slot = 0;
+
+    cgroup.pending = -1;
+    if (!cgroup.enabled) {
+        return;
+    }
+    while (slot < MAX_CGROUP_JOBS && cgroup.jobs[slot].pid != 0) {
+        slot++;
+    }
+    if (slot == MAX_CGROUP_JOBS) {
+        return;
+    }
+    cgroup.jobs[slot].id = ++cgroup.next_job;
+    job_dir(slot, dir, sizeof(dir));
+    if (mkdir(dir, 0755) != 0) {
+        fprintf(stderr, "cseshell: cannot create cgroup %s: %s\n", dir, strerror(errno));
+        return;
+    }
+    if (cgroup.cpu_percent > 0 && cgroup.has_cpu) {
+        snprintf(value, sizeof(value), "%ld 100000", cgroup.cpu_percent * 1000);
+        write_file(dir, "cpu.max", value);
+    }
+    if (cgroup.memory_max > 0 && cgroup.has_memory) {
+        snprintf(value, sizeof(value), "%lld", cgroup.memory_max);
+        write_file(dir, "memory.max", value);
+        write_file(dir, "memory.swap.max", "0"); // otherwise the job just swaps
+    }
+    if (cgroup.io_weight > 0 && cgroup.has_io) {
+        snprintf(value, sizeof(value), "default %d", cgroup.io_weight);
+        write_file(dir, "io.weight", value);
+    }
+    cgroup.jobs[slot].pid = -1;
+    cgroup.pending = slot;
+}
+
+/*
+ Apply the job limits to 'pid': 0 is the calling child, after fork and
+ before exec; otherwise a zygote helper still waiting for its command.
+ The process also joins the leaf made by job_prepare().
+*/
+void job_apply(pid_t pid) {
+    char dir[PATH_MAX + 32], value[32];
+
+    for (size_t i = 0; i < NUM_JOB_LIMITS; i++) {
+        if (!job_rlimit_set[i]) {
+            continue;
+        }
+        int failed = pid == 0 ? setrlimit(job_limits[i].resource, &job_rlimits[i])
+                              : prlimit(pid, job_limits[i].resource, &job_rlimits[i], NULL);
+        if (failed != 0) {
+            fprintf(stderr, "cseshell: cannot set the %s limit: %s\n", job_limits[i].description, strerror(errno));
+        }
+    }
+    if (cgroup.pending >= 0) {
+        job_dir(cgroup.pending, dir, sizeof(dir));
+        snprintf(value, sizeof(value), "%d", (int)pid);
+        if (write_file(dir, "cgroup.procs", value) != 0) {
+            fprintf(stderr, "cseshell: cannot join cgroup %s: %s\n", dir, strerror(errno));
+        }
+    }
+}
+
+// Called after launching: bind the prepared leaf to the job's pid (or drop it if the launch failed)
+void job_started(pid_t pid) {
+    char dir[PATH_MAX + 32];
+    int slot = cgroup.pending;
+
+    cgroup.pending = -1;
+    if (slot < 0) {
+        return;
+    }
+    if (pid > 0) {
+        cgroup.jobs[slot].pid = pid;
+        return;
+    }
+    job_dir(slot, dir, sizeof(dir));
+    rmdir(dir);
+    cgroup.jobs[slot].pid = 0;
+}
+
+/*
+ Called once the job 'pid' has been reaped: print its cgroup statistics
+ and remove its leaf. Does nothing for jobs launched outside cgroup mode.
+*/
+void job_finished(pid_t pid, const char *name) {
+    char dir[PATH_MAX + 32];
+    int slot = 0;
+
+    if (!cgroup.enabled || pid <= 0) {
+        return;
+    }
+    while (slot < MAX_CGROUP_JOBS && cgroup.jobs[slot].pid != pid) {
+        slot++;
+    }
+    if (slot == MAX_CGROUP_JOBS) {
+        return;
+    }
+    job_dir(slot, dir, sizeof(dir));
+
+    long long usage = read_key(dir, "cpu.stat", "usage_usec");
+    long long user = read_key(dir, "cpu.stat", "user_usec");
+    long long system = read_key(dir, "cpu.stat", "system_usec");
+    long long throttled = read_key(dir, "cpu.stat", "nr_throttled");
+    long long throttled_usec = read_key(dir, "cpu.stat", "throttled_usec");
+    long long peak = read_key(dir, "memory.peak", "");
+    long long oom_kills = read_key(dir, "memory.events", "oom_kill");
+
+    fprintf(stderr, "[cgroup job.%lu] %s:", cgroup.jobs[slot].id, name);
+    if (usage >= 0) {
+        fprintf(stderr, " cpu %.3fs (user %.3fs, sys %.3fs)", usage / 1e6, user / 1e6, system / 1e6);
+    }
+    if (throttled >= 0) {
+        fprintf(stderr, ", throttled %lld time%s for %.3fs", throttled, throttled == 1 ? "" : "s", throttled_usec / 1e6);
+    }
+    if (peak >= 0) {
+        fprintf(stderr, ", memory peak %.1f MiB", peak / 1048576.0);
+    }
+    if (oom_kills > 0) {
+        fprintf(stderr, ", %lld OOM kill%s", oom_kills, oom_kills == 1 ? "" : "s");
+    }
+    fprintf(stderr, "\n");
+
+    // A leaf still holding processes (a daemon the job started) stays until the shell exits
+    if (rmdir(dir) == 0) {
+        cgroup.jobs[slot].pid = 0;
+    }
+}
+
+// "512M", "2G", "65536" (bytes); returns -1 if malformed
+static long long parse_size(const char *text) {
+    char *end;
+    long long value = strtoll(text, &end, 10);
+    const char *units = "KMGT";
+    const char *unit = *end != '\0' ? strchr(units, *end) : NULL;
+
+    if (end == text || value <= 0 || (*end != '\0' && (unit == NULL || end[1] != '\0'))) {
+        return -1;
+    }
+    for (const char *u = units; unit != NULL && u <= unit; u++) {
+        value *= 1024;
+    }
+    return value;
+}
+
+static void print_cgroup_settings(void) {
+    if (!cgroup.enabled) {
+        printf("cgroup mode: off\n");
+        return;
+    }
+    printf("cgroup mode: on (%s)\n", cgroup.dir);
+    printf("controllers:%s%s%s%s\n", cgroup.has_cpu ? " cpu" : "", cgroup.has_memory ? " memory" : "",
+           cgroup.has_io ? " io" : "", cgroup.has_cpu || cgroup.has_memory || cgroup.has_io ? "" : " none");
+    if (cgroup.cpu_percent > 0) {
+        printf("cpu=%ld%%\n", cgroup.cpu_percent);
+    }
+    if (cgroup.memory_max > 0) {
+        printf("memory=%lld\n", cgroup.memory_max);
+    }
+    if (cgroup.io_weight > 0) {
+        printf("io=%d\n", cgroup.io_weight);
+    }
+}
+
+static int ulimit_cgroup(char **args) {
+    if (args[0] == NULL) {
+        print_cgroup_settings();
+        return 0;
+    }
+    for (int i = 0; args[i] != NULL; i++) {
+        if (strcmp(args[i], "off") == 0) {
+            cgroup_remove();
+        } else if (strcmp(args[i], "on") == 0) {
+            // enabled below
+        } else if (strncmp(args[i], "cpu=", 4) == 0 && atol(args[i] + 4) > 0) {
+            cgroup.cpu_percent = atol(args[i] + 4);
+        } else if (strncmp(args[i], "memory=", 7) == 0 && parse_size(args[i] + 7) > 0) {
+            cgroup.memory_max = parse_size(args[i] + 7);
+        } else if (strncmp(args[i], "io=", 3) == 0 && atoi(args[i] + 3) >= 1 && atoi(args[i] + 3) <= 10000) {
+            cgroup.io_weight = atoi(args[i] + 3);
+        } else {
+            fprintf(stderr, "ulimit: bad cgroup setting '%s' (on, off, cpu=PERCENT, memory=SIZE, io=1-10000)\n", args[i]);
+            return 1;
+        }
+    }
+    if (strcmp(args[0], "off") == 0) {
+        return 0;
+    }
+    if (job_cgroup_enable() != 0) {
+        return 1;
+    }
+    warn_unenforced();
+    return 0;
+}
+
+static void print_all_limits(void) {
+    struct rlimit limit;
+    for (size_t i = 0; i < NUM_JOB_LIMITS; i++) {
+        job_rlimit(i, &limit);
+        printf("%-26s (-%c) ", job_limits[i].description, job_limits[i].option);
+        print_limit_value(limit.rlim_cur, job_limits[i].unit);
+    }
+}
+
+// Handler for 'ulimit' command
+int shell_ulimit(char **args) {
+    int hard = 0, soft = 0, i = 1;
+    size_t which = NUM_JOB_LIMITS;
+
+    if (args[1] != NULL && strcmp(args[1], "--cgroup") == 0) {
+        return ulimit_cgroup(&args[2]);
+    }
+    if (args[1] != NULL && strcmp(args[1], "--clear") == 0) {
+        memset(job_rlimit_set, 0, sizeof(job_rlimit_set));
+        return 0;
+    }
+    if (args[1] == NULL || (strcmp(args[1], "-a") == 0 && args[2] == NULL)) {
+        print_all_limits();
+        return 0;
+    }
+
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0' && args[i][2] == '\0'; i++) {
+        char option = args[i][1];
+        if (option == 'H') {
+            hard = 1;
+            continue;
+        }
+        if (option == 'S') {
+            soft = 1;
+            continue;
+        }
+        for (which = 0; which < NUM_JOB_LIMITS && job_limits[which].option != option; which++) {
+        }
+        if (which == NUM_JOB_LIMITS) {
+            fprintf(stderr, "ulimit: -%c: unknown limit\n", option);
+            return 1;
+        }
+    }
+    if (which == NUM_JOB_LIMITS || (args[i] != NULL && args[i + 1] != NULL)) {
+        fprintf(stderr, "Usage: ulimit [-a] | [-H|-S] -c|-d|-f|-l|-n|-s|-t|-u|-v [VALUE|unlimited] | --clear | "
+                        "--cgroup [on|off] [cpu=PERCENT] [memory=SIZE] [io=WEIGHT]\n");
+        return 1;
+    }
+
+    struct rlimit limit;
+    job_rlimit(which, &limit);
+    if (args[i] == NULL) {
+        print_limit_value(hard && !soft ? limit.rlim_max : limit.rlim_cur, job_limits[which].unit);
+        return 0;
+    }
+
+    rlim_t value;
+    char *end;
+    if (strcmp(args[i], "unlimited") == 0) {
+        value = RLIM_INFINITY;
+    } else {
+        unsigned long long number = strtoull(args[i], &end, 10);
+        if (end == args[i] || *end != '\0' || args[i][0] == '-' || number > RLIM_INFINITY / job_limits[which].unit) {
+            fprintf(stderr, "ulimit: %s: not a number\n", args[i]);
+            return 1;
+        }
+        value = number * job_limits[which].unit;
+    }
+    if (!hard && !soft) {
+        hard = soft = 1;
+    }
+    if (hard) {
+        limit.rlim_max = value;
+    }
+    if (soft) {
+        limit.rlim_cur = value;
+    }
+
+    // RLIM_INFINITY is the largest value, so these also hold for unlimited
+    struct rlimit shell_limit;
+    getrlimit(job_limits[which].resource, &shell_limit);
+    if (limit.rlim_cur > limit.rlim_max) {
+        fprintf(stderr, "ulimit: the soft limit cannot exceed the hard limit\n");
+        return 1;
+    }
+    if (geteuid() != 0 && limit.rlim_max > shell_limit.rlim_max) {
+        fprintf(stderr, "ulimit: cannot raise the hard limit above the shell's\n");
+        return 1;
+    }
+    job_rlimits[which] = limit;
+    job_rlimit_set[which] = 1;
+    return 0;
+}
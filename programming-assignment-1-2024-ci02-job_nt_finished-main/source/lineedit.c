@@ -0,0 +1,448 @@
+#include "shell.h"
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+/*
+ Line editor used when stdin and stdout are a terminal.
+
+ The terminal is put in raw mode only while a line is being read, so
+ commands always run with the normal settings. Supported keys:
+
+   Left/Right, Ctrl-B/F    move by character     Home/End, Ctrl-A/E   line start/end
+   Up/Down, Ctrl-P/N       previous/next history Backspace, Del, Ctrl-D  delete
+   Ctrl-K/U/W              kill to end/start/previous word
+   Ctrl-R                  incremental reverse search (Ctrl-R again for older
+                           matches, Enter runs the match, Ctrl-G cancels)
+   Tab                     complete a command or path (twice lists candidates)
+   Ctrl-L                  clear screen          Ctrl-C  discard the line
+   Ctrl-D on an empty line EOF
+
+ The whole line is redrawn into one buffer and written with a single
+ write(), so each keystroke costs one syscall of output.
+*/
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define KEY_ESC 27
+#define KEY_BACKSPACE 127
+
+// Keys decoded from escape sequences, outside the byte range
+#define KEY_LEFT 1000
+#define KEY_RIGHT 1001
+#define KEY_UP 1002
+#define KEY_DOWN 1003
+#define KEY_HOME 1004
+#define KEY_END 1005
+#define KEY_DELETE 1006
+
+struct editor {
+    struct strbuf buf;
+    size_t pos;           // cursor, as a byte offset into buf
+    const char *prompt;
+    int history_index;    // entry shown, or history_length() for the new line
+    struct strbuf saved;  // the new line, kept while browsing history
+};
+
+static struct termios cooked;
+static int raw_active = 0;
+
+static void disable_raw(void) {
+    if (raw_active) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &cooked);
+        raw_active = 0;
+    }
+}
+
+static int enable_raw(void) {
+    static int registered = 0;
+    struct termios raw;
+
+    if (tcgetattr(STDIN_FILENO, &cooked) != 0) {
+        return -1;
+    }
+    if (!registered) {
+        atexit(disable_raw);
+        registered = 1;
+    }
+    raw = cooked;
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0) {
+        return -1;
+    }
+    raw_active = 1;
+    return 0;
+}
+
+static void write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+// Screen columns taken by the first 'len' bytes of a UTF-8 string
+static size_t text_columns(const char *s, size_t len) {
+    size_t cols = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (((unsigned char)s[i] & 0xc0) != 0x80) {
+            cols++;
+        }
+    }
+    return cols;
+}
+
+static size_t prompt_columns(const char *prompt) {
+    size_t cols = 0;
+    for (const char *p = prompt; *p != '\0'; p++) {
+        if (*p == KEY_ESC) {
+            // Skip a colour sequence such as "\x1b[34m"
+            while (p[1] != '\0' && !(p[1] >= '@' && p[1] <= '~' && p[1] != '[')) {
+                p++;
+            }
+            if (p[1] != '\0') {
+                p++;
+            }
+            continue;
+        }
+        cols += text_columns(p, 1);
+    }
+    return cols;
+}
+
+static void refresh_line(struct editor *ed) {
+    struct strbuf out = {0};
+    char move[32];
+
+    strbuf_append_str(&out, "\r");
+    strbuf_append_str(&out, ed->prompt);
+    strbuf_append(&out, ed->buf.buf ? ed->buf.buf : "", ed->buf.len);
+    strbuf_append_str(&out, "\x1b[K\r");
+    size_t col = prompt_columns(ed->prompt) + text_columns(ed->buf.buf, ed->pos);
+    if (col > 0) {
+        snprintf(move, sizeof(move), "\x1b[%zuC", col);
+        strbuf_append_str(&out, move);
+    }
+    write_all(out.buf, out.len);
+    strbuf_free(&out);
+}
+
+static int read_byte(void) {
+    unsigned char c;
+    for (;;) {
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == 1) {
+            return c;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return -1;
+    }
+}
+
+// Read one key, decoding the escape sequences sent by cursor keys
+static int read_key(void) {
+    int c = read_byte();
+    if (c != KEY_ESC) {
+        return c;
+    }
+
+    // A lone Escape is not followed by anything within a few milliseconds
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, 50) <= 0) {
+        return KEY_ESC;
+    }
+    int kind = read_byte();
+    if (kind != '[' && kind != 'O') {
+        return KEY_ESC;
+    }
+    int param = 0, final;
+    while ((final = read_byte()) >= '0' && final <= '9') {
+        param = param * 10 + (final - '0');
+    }
+    // Skip modifiers such as the ";5" in "\x1b[1;5C"
+    while (final == ';' || (final >= '0' && final <= '9')) {
+        final = read_byte();
+    }
+    switch (final) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    case '~':
+        if (param == 1 || param == 7) return KEY_HOME;
+        if (param == 4 || param == 8) return KEY_END;
+        if (param == 3) return KEY_DELETE;
+        break;
+    }
+    return KEY_ESC;
+}
+
+static void set_line(struct editor *ed, const char *text) {
+    strbuf_reset(&ed->buf);
+    strbuf_append_str(&ed->buf, text);
+    ed->pos = ed->buf.len;
+}
+
+static void insert_text(struct editor *ed, const char *text, size_t len) {
+    strbuf_grow(&ed->buf, len);
+    memmove(ed->buf.buf + ed->pos + len, ed->buf.buf + ed->pos, ed->buf.len - ed->pos + 1);
+    memcpy(ed->buf.buf + ed->pos, text, len);
+    ed->pos += len;
+    ed->buf.len += len;
+}
+
+// Print newline-separated completion candidates in columns below the line
+static void show_matches(const char *matches) {
+    struct winsize ws;
+    struct strbuf out = {0};
+    size_t width = 0, count = 0;
+    size_t screen = ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+
+    for (const char *p = matches; *p != '\0'; p = strchr(p, '\n') + 1, count++) {
+        size_t cols = text_columns(p, strchr(p, '\n') - p);
+        width = cols > width ? cols : width;
+    }
+    size_t per_row = screen / (width + 2) > 0 ? screen / (width + 2) : 1;
+    size_t i = 0;
+    strbuf_append_str(&out, "\r\n");
+    for (const char *p = matches; *p != '\0'; i++) {
+        const char *end = strchr(p, '\n');
+        strbuf_append(&out, p, end - p);
+        if ((i + 1) % per_row == 0 || i + 1 == count) {
+            strbuf_append_str(&out, "\r\n");
+        } else {
+            for (size_t pad = text_columns(p, end - p); pad < width + 2; pad++) {
+                strbuf_append_char(&out, ' ');
+            }
+        }
+        p = end + 1;
+    }
+    write_all(out.buf, out.len);
+    strbuf_free(&out);
+}
+
+static void delete_range(struct editor *ed, size_t from, size_t to) {
+    memmove(ed->buf.buf + from, ed->buf.buf + to, ed->buf.len - to + 1);
+    ed->buf.len -= to - from;
+    ed->pos = from;
+}
+
+// Byte offsets of the neighbouring UTF-8 characters
+static size_t prev_char(const struct editor *ed, size_t pos) {
+    while (pos > 0 && ((unsigned char)ed->buf.buf[--pos] & 0xc0) == 0x80) {
+    }
+    return pos;
+}
+
+static size_t next_char(const struct editor *ed, size_t pos) {
+    while (pos < ed->buf.len && ((unsigned char)ed->buf.buf[++pos] & 0xc0) == 0x80) {
+    }
+    return pos;
+}
+
+static void history_step(struct editor *ed, int delta) {
+    int target = ed->history_index + delta;
+    if (target < 0 || target > history_length()) {
+        return;
+    }
+    if (ed->history_index == history_length()) {
+        strbuf_reset(&ed->saved);
+        strbuf_append(&ed->saved, ed->buf.buf ? ed->buf.buf : "", ed->buf.len);
+    }
+    ed->history_index = target;
+    set_line(ed, target == history_length() ? (ed->saved.buf ? ed->saved.buf : "") : history_entry(target));
+}
+
+static void refresh_search(const char *query, int match, int failed) {
+    struct strbuf out = {0};
+
+    strbuf_append_str(&out, failed ? "\r(failed reverse-i-search)`" : "\r(reverse-i-search)`");
+    strbuf_append_str(&out, query);
+    strbuf_append_str(&out, "': ");
+    if (match >= 0) {
+        strbuf_append_str(&out, history_entry(match));
+    }
+    strbuf_append_str(&out, "\x1b[K");
+    write_all(out.buf, out.len);
+    strbuf_free(&out);
+}
+
+/*
+ Ctrl-R mode. Each keystroke is one indexed lookup: typing extends the
+ query and searches from the current match, Ctrl-R moves to the next older
+ match. Returns the key that ended the search (to be handled as usual),
+ after loading the match into the line, or 0 if the search was cancelled.
+*/
+static int reverse_search(struct editor *ed) {
+    struct strbuf query = {0};
+    int match = -1, failed = 0, key;
+
+    strbuf_append_str(&query, "");
+    refresh_search(query.buf, match, failed);
+    for (;;) {
+        key = read_key();
+        if (key == KEY_CTRL('r')) {
+            int from = match >= 0 ? match : history_length();
+            int found = query.len > 0 ? history_search(query.buf, from) : -1;
+            failed = found < 0;
+            match = found >= 0 ? found : match;
+        } else if (key == KEY_BACKSPACE || key == KEY_CTRL('h')) {
+            if (query.len > 0) {
+                query.buf[--query.len] = '\0';
+            }
+            match = query.len > 0 ? history_search(query.buf, history_length()) : -1;
+            failed = query.len > 0 && match < 0;
+        } else if (key >= 32 && key < 256 && key != KEY_BACKSPACE) {
+            strbuf_append_char(&query, (char)key);
+            int found = history_search(query.buf, match >= 0 ? match + 1 : history_length());
+            failed = found < 0;
+            match = found >= 0 ? found : match;
+        } else if (key == KEY_CTRL('g') || key == KEY_CTRL('c') || key < 0) {
+            key = key < 0 ? key : 0;
+            break;
+        } else {
+            if (match >= 0) {
+                set_line(ed, history_entry(match));
+                ed->history_index = match;
+            }
+            break;
+        }
+        refresh_search(query.buf, match, failed);
+    }
+    strbuf_free(&query);
+    refresh_line(ed);
+    return key;
+}
+
+/*
+ Read one line with editing. Returns 1 with the line in cl->line, 0 when
+ the line was discarded (Ctrl-C) and -1 on EOF, like read_command().
+*/
+int line_edit(struct command_line *cl, const char *prompt) {
+    struct editor ed = {0};
+    int result = 1, last_key = 0;
+
+    ed.prompt = prompt;
+    ed.history_index = history_length();
+    fflush(stdout);
+    if (enable_raw() != 0) {
+        return -2;
+    }
+    strbuf_append_str(&ed.buf, "");
+
+    for (;;) {
+        int key = read_key();
+        int previous = last_key;
+        last_key = key;
+        if (key == KEY_CTRL('r')) {
+            key = reverse_search(&ed);
+            if (key == 0) {
+                continue;
+            }
+        }
+
+        if (key < 0) {
+            result = ed.buf.len > 0 ? 1 : -1;
+            break;
+        } else if (key == '\r' || key == '\n') {
+            break;
+        } else if (key == KEY_CTRL('c')) {
+            write_all("^C", 2);
+            strbuf_reset(&ed.buf);
+            result = 0;
+            break;
+        } else if (key == KEY_CTRL('d')) {
+            if (ed.buf.len == 0) {
+                result = -1;
+                break;
+            }
+            if (ed.pos < ed.buf.len) {
+                delete_range(&ed, ed.pos, next_char(&ed, ed.pos));
+            }
+        } else if (key == KEY_BACKSPACE || key == KEY_CTRL('h')) {
+            if (ed.pos > 0) {
+                delete_range(&ed, prev_char(&ed, ed.pos), ed.pos);
+            }
+        } else if (key == KEY_DELETE) {
+            if (ed.pos < ed.buf.len) {
+                delete_range(&ed, ed.pos, next_char(&ed, ed.pos));
+            }
+        } else if (key == KEY_LEFT || key == KEY_CTRL('b')) {
+            ed.pos = prev_char(&ed, ed.pos);
+        } else if (key == KEY_RIGHT || key == KEY_CTRL('f')) {
+            ed.pos = next_char(&ed, ed.pos);
+        } else if (key == KEY_HOME || key == KEY_CTRL('a')) {
+            ed.pos = 0;
+        } else if (key == KEY_END || key == KEY_CTRL('e')) {
+            ed.pos = ed.buf.len;
+        } else if (key == KEY_UP || key == KEY_CTRL('p')) {
+            history_step(&ed, -1);
+        } else if (key == KEY_DOWN || key == KEY_CTRL('n')) {
+            history_step(&ed, 1);
+        } else if (key == KEY_CTRL('k')) {
+            delete_range(&ed, ed.pos, ed.buf.len);
+        } else if (key == KEY_CTRL('u')) {
+            delete_range(&ed, 0, ed.pos);
+        } else if (key == KEY_CTRL('w')) {
+            size_t start = ed.pos;
+            while (start > 0 && ed.buf.buf[start - 1] == ' ') {
+                start--;
+            }
+            while (start > 0 && ed.buf.buf[start - 1] != ' ') {
+                start--;
+            }
+            delete_range(&ed, start, ed.pos);
+        } else if (key == '\t') {
+            struct strbuf insert = {0}, matches = {0};
+            complete_word(ed.buf.buf, ed.pos, &insert, &matches);
+            if (insert.len > 0) {
+                insert_text(&ed, insert.buf, insert.len);
+            } else if (matches.len > 0 && previous == '\t') {
+                show_matches(matches.buf);
+            } else {
+                write_all("\a", 1);
+            }
+            strbuf_free(&insert);
+            strbuf_free(&matches);
+        } else if (key == KEY_CTRL('l')) {
+            write_all("\x1b[H\x1b[2J", 7);
+        } else if (key >= 32 && key < 256 && key != KEY_BACKSPACE) {
+            char c = (char)key;
+            insert_text(&ed, &c, 1);
+        } else {
+            continue; // unbound key
+        }
+        refresh_line(&ed);
+    }
+
+    disable_raw();
+    write_all("\r\n", 2);
+
+    if (cl->line_capacity < ed.buf.len + 1) {
+        char *line = realloc(cl->line, ed.buf.len + 1);
+        if (line == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        cl->line = line;
+        cl->line_capacity = ed.buf.len + 1;
+    }
+    memcpy(cl->line, ed.buf.buf, ed.buf.len + 1);
+    strbuf_free(&ed.buf);
+    strbuf_free(&ed.saved);
+    return result;
+}
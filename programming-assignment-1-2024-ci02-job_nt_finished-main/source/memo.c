@@ -0,0 +1,471 @@
+#include "shell.h"
+#include "system_programs/walk.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+/*
+ 'cached' builtin: memoize the stdout and exit status of a read-only command.
+
+   cached [-d DIR]... [-f FILE]... [-n] [-t SECONDS] command [args...]
+   cached --stats
+   cached --clear
+
+ The key is the argv, the working directory and the declared inputs. Each
+ entry also stores a fingerprint of those inputs: for every -d DIR (the
+ default is ".") the device, inode, mtime and ctime of each directory in
+ the tree, so adding, removing or renaming anything changes it; for every
+ -f FILE its identity, size, mtime and ctime. -n declares no inputs, and
+ -t sets a maximum age (for output that goes stale on its own, like sys).
+
+ On a hit the output is copied to stdout with sendfile (or pread and
+ write where stdout does not take it); an entry that cannot be copied in
+ full is an error rather than a hit. On a miss the command runs with its
+ stdout teed to the terminal and to a new entry, which is kept only if the
+ fingerprint is the same after the run. Entries live in $XDG_CACHE_HOME/cseshell/cached (or ~/.cache/cseshell/cached);
+ an entry's mtime records its last use, and the least recently used are
+ removed once the total passes CSESHELL_CACHED_MAX bytes (default 64 MiB).
+ Stderr and stdin are not part of the cache.
+*/
+
+#define MEMO_MAGIC "CSEMO\0\0\1"
+#define MEMO_DEFAULT_MAX (64L * 1024 * 1024)
+
+struct memo_header {
+    char magic[8];
+    int32_t status;
+    uint32_t key_length;
+    uint64_t fingerprint;
+    int64_t created;
+    uint64_t output_size;
+};
+
+// Counters for 'cached --stats', for this shell session
+static struct {
+    long hits, misses, stored, evicted;
+    long long bytes_replayed, bytes_stored;
+} memo_stats;
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET 1469598103934665603ULL
+
+// Hash of what identifies a version of a file or directory
+static uint64_t stat_hash(const struct stat *st) {
+    int64_t fields[] = {(int64_t)st->st_dev, (int64_t)st->st_ino, (int64_t)st->st_size, st->st_mtim.tv_sec,
+                        st->st_mtim.tv_nsec, st->st_ctim.tv_sec, st->st_ctim.tv_nsec};
+    return fnv1a(FNV_OFFSET, fields, sizeof(fields));
+}
+
+static void ignore_walk_error(const char *path, int err, void *arg) {
+    (void)path;
+    (void)err;
+    (void)arg;
+}
+
+// Walk visitor: mix in each directory; the sum makes the result independent of listing order
+static int fingerprint_dir(const struct walk_entry *entry, void *arg) {
+    uint64_t *sum = arg;
+    struct stat st;
+
+    if (entry->type == DT_DIR && fstatat(entry->dir_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        *sum += stat_hash(&st);
+    }
+    return WALK_CONTINUE;
+}
+
+static uint64_t fingerprint(char **dirs, int num_dirs, char **files, int num_files) {
+    uint64_t result = FNV_OFFSET;
+    struct walk_options options = {0};
+    struct stat st;
+
+    options.on_error = ignore_walk_error;
+    for (int i = 0; i < num_dirs; i++) {
+        uint64_t sum = 0;
+        if (stat(dirs[i], &st) == 0) {
+            sum = stat_hash(&st);
+            walk(dirs[i], &options, fingerprint_dir, &sum);
+        }
+        result = fnv1a(result, &sum, sizeof(sum));
+    }
+    for (int i = 0; i < num_files; i++) {
+        uint64_t hash = stat(files[i], &st) == 0 ? stat_hash(&st) : 0; // a missing file counts too
+        result = fnv1a(result, &hash, sizeof(hash));
+    }
+    return result;
+}
+
+// <cache dir>/cached, created if asked
+static int memo_dir(char *out, size_t size, int create) {
+    const char *base = getenv("XDG_CACHE_HOME");
+
+    if (base != NULL && base[0] != '\0') {
+        if (create) {
+            mkdir(base, 0700);
+        }
+        snprintf(out, size, "%s/cseshell", base);
+    } else if ((base = getenv("HOME")) != NULL) {
+        snprintf(out, size, "%s/.cache", base);
+        if (create) {
+            mkdir(out, 0700);
+        }
+        snprintf(out, size, "%s/.cache/cseshell", base);
+    } else {
+        return -1;
+    }
+    if (create) {
+        mkdir(out, 0700);
+    }
+    size_t len = strlen(out);
+    snprintf(out + len, size - len, "/cached");
+    if (create && mkdir(out, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+struct memo_entry {
+    char name[32];
+    time_t last_used;
+    off_t size;
+};
+
+static int by_last_use(const void *a, const void *b) {
+    const struct memo_entry *x = a, *y = b;
+    return (x->last_used > y->last_used) - (x->last_used < y->last_used);
+}
+
+// List the entries of the cache directory; returns their count and total size
+static int list_entries(const char *dir, struct memo_entry **entries, long long *total) {
+    DIR *d = opendir(dir);
+    struct dirent *de;
+    struct stat st;
+    int count = 0, capacity = 0;
+
+    *entries = NULL;
+    *total = 0;
+    while (d != NULL && (de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len < 5 || len >= sizeof((*entries)->name) || strcmp(de->d_name + len - 4, ".out") != 0 ||
+            fstatat(dirfd(d), de->d_name, &st, 0) != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            *entries = realloc(*entries, capacity * sizeof(struct memo_entry));
+            if (*entries == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        strcpy((*entries)[count].name, de->d_name);
+        (*entries)[count].last_used = st.st_mtime;
+        (*entries)[count].size = st.st_size;
+        *total += st.st_size;
+        count++;
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    return count;
+}
+
+// Remove least recently used entries until the cache fits its cap
+static void evict(const char *dir) {
+    const char *max_env = getenv("CSESHELL_CACHED_MAX");
+    long long max = max_env != NULL ? atoll(max_env) : MEMO_DEFAULT_MAX;
+    struct memo_entry *entries;
+    long long total;
+    char path[PATH_MAX + 32];
+
+    int count = list_entries(dir, &entries, &total);
+    if (total > max) {
+        qsort(entries, count, sizeof(struct memo_entry), by_last_use);
+        for (int i = 0; i < count && total > max; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+                memo_stats.evicted++;
+            }
+        }
+    }
+    free(entries);
+}
+
+// Replay a matching entry; returns its status, or -1 on a miss
+static int replay(const char *path, const struct strbuf *key, uint64_t print, long max_age) {
+    struct memo_header header;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    int result = -1;
+
+    if (fd < 0) {
+        return -1;
+    }
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, MEMO_MAGIC, 8) != 0 ||
+        header.key_length != key->len || header.fingerprint != print ||
+        (max_age > 0 && time(NULL) - header.created > max_age)) {
+        close(fd);
+        return -1;
+    }
+    char *stored_key = malloc(key->len + 1);
+    int same_key = read(fd, stored_key, key->len) == (ssize_t)key->len && memcmp(stored_key, key->buf, key->len) == 0;
+    free(stored_key);
+
+    if (same_key) {
+        off_t offset = sizeof(header) + key->len;
+        size_t left = header.output_size;
+        const char *error = NULL;
+        fflush(stdout);
+        while (left > 0) {
+            ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, left);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                // Stdout does not support sendfile (an O_APPEND file, say), copy by hand
+                char buf[65536];
+                n = pread(fd, buf, left < sizeof(buf) ? left : sizeof(buf), offset);
+                if (n > 0 && write_all(STDOUT_FILENO, buf, n) != 0) {
+                    n = -1;
+                }
+                offset += n > 0 ? n : 0;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                error = strerror(errno);
+                break;
+            }
+            if (n == 0) {
+                error = "entry is truncated, removed it";
+                unlink(path);
+                break;
+            }
+            left -= n;
+        }
+        memo_stats.bytes_replayed += header.output_size - left;
+        if (error != NULL) {
+            // Part of the output may already be out, so running the command again would repeat it
+            fprintf(stderr, "cached: cannot replay %s: %s\n", path, error);
+            result = 1;
+        } else {
+            futimens(fd, NULL); // mark as recently used
+            memo_stats.hits++;
+            result = header.status;
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// Run the command, teeing its stdout into a new entry; returns its status
+static int run_and_store(char **argv, const char *dir, const char *path, const struct strbuf *key, uint64_t print,
+                         char **dirs, int num_dirs, char **files, int num_files) {
+    struct memo_header header = {0};
+    char tmp_path[PATH_MAX + 32], buf[65536];
+    int out_pipe[2], status;
+
+    if (pipe2(out_pipe, O_CLOEXEC) != 0) {
+        perror("cached: pipe");
+        return 1;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int fd = dir != NULL ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+
+    memcpy(header.magic, MEMO_MAGIC, sizeof(header.magic));
+    header.key_length = (uint32_t)key->len;
+    header.fingerprint = print;
+    header.created = time(NULL);
+    if (fd >= 0 && (write_all(fd, &header, sizeof(header)) != 0 || write_all(fd, key->buf, key->len) != 0)) {
+        close(fd);
+        unlink(tmp_path);
+        fd = -1;
+    }
+
+    int std_fds[3] = {-1, out_pipe[1], -1};
+    pid_t pid = spawn_command(argv, NULL, std_fds);
+    close(out_pipe[1]);
+    if (pid < 0) {
+        perror("cached");
+        close(out_pipe[0]);
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        return 127;
+    }
+
+    fflush(stdout);
+    ssize_t n;
+    while ((n = read(out_pipe[0], buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        write_all(STDOUT_FILENO, buf, n);
+        if (fd >= 0 && write_all(fd, buf, n) != 0) {
+            close(fd);
+            unlink(tmp_path);
+            fd = -1;
+        }
+        header.output_size += n;
+    }
+    close(out_pipe[0]);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    header.status = status_from_wait(status);
+    zygote_record_exit(pid);
+    job_finished(pid, argv[0]);
+
+    // Keep it only if the inputs did not change while the command ran
+    if (fd >= 0) {
+        int keep = fingerprint(dirs, num_dirs, files, num_files) == print &&
+                   pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+        if (close(fd) == 0 && keep && rename(tmp_path, path) == 0) {
+            memo_stats.stored++;
+            memo_stats.bytes_stored += header.output_size;
+            evict(dir);
+        } else {
+            unlink(tmp_path);
+        }
+    }
+    return header.status;
+}
+
+static int memo_print_stats(void) {
+    char dir[PATH_MAX];
+    struct memo_entry *entries = NULL;
+    long long total = 0;
+    int count = 0;
+    const char *max_env = getenv("CSESHELL_CACHED_MAX");
+
+    if (memo_dir(dir, sizeof(dir), 0) == 0) {
+        count = list_entries(dir, &entries, &total);
+        free(entries);
+    }
+    long lookups = memo_stats.hits + memo_stats.misses;
+    printf("hits: %ld\n", memo_stats.hits);
+    printf("misses: %ld\n", memo_stats.misses);
+    printf("hit rate: %.1f%%\n", lookups ? 100.0 * memo_stats.hits / lookups : 0.0);
+    printf("bytes replayed: %lld\n", memo_stats.bytes_replayed);
+    printf("entries stored: %ld (%lld bytes)\n", memo_stats.stored, memo_stats.bytes_stored);
+    printf("entries evicted: %ld\n", memo_stats.evicted);
+    printf("cache: %d entries, %lld of %lld bytes\n", count, total,
+           max_env != NULL ? atoll(max_env) : (long long)MEMO_DEFAULT_MAX);
+    return 0;
+}
+
+static int memo_clear(void) {
+    char dir[PATH_MAX], path[PATH_MAX + 32];
+    struct memo_entry *entries;
+    long long total;
+
+    if (memo_dir(dir, sizeof(dir), 0) != 0) {
+        return 0;
+    }
+    int count = list_entries(dir, &entries, &total);
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+        unlink(path);
+    }
+    free(entries);
+    return 0;
+}
+
+static void memo_usage(void) {
+    fprintf(stderr, "Usage: cached [-d DIR]... [-f FILE]... [-n] [-t SECONDS] command [args...]\n"
+                    "       cached --stats | --clear\n");
+}
+
+// Handler for 'cached' command
+int shell_cached(char **args) {
+    char *dirs[64], *files[64];
+    int num_dirs = 0, num_files = 0, no_inputs = 0, i = 1;
+    long max_age = 0;
+
+    if (args[1] != NULL && strcmp(args[1], "--stats") == 0) {
+        return memo_print_stats();
+    }
+    if (args[1] != NULL && strcmp(args[1], "--clear") == 0) {
+        return memo_clear();
+    }
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-d") == 0 && args[i + 1] != NULL && num_dirs < 64) {
+            dirs[num_dirs++] = args[++i];
+        } else if (strcmp(args[i], "-f") == 0 && args[i + 1] != NULL && num_files < 64) {
+            files[num_files++] = args[++i];
+        } else if (strcmp(args[i], "-t") == 0 && args[i + 1] != NULL) {
+            max_age = atol(args[++i]);
+        } else if (strcmp(args[i], "-n") == 0) {
+            no_inputs = 1;
+        } else if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            memo_usage();
+            return 1;
+        }
+    }
+    if (args[i] == NULL) {
+        memo_usage();
+        return 1;
+    }
+    if (num_dirs == 0 && num_files == 0 && !no_inputs) {
+        dirs[num_dirs++] = ".";
+    }
+
+    // Key: argv, cwd and the declared inputs, NUL-separated
+    struct strbuf key = {0};
+    char cwd[PATH_MAX];
+    for (int j = i; args[j] != NULL; j++) {
+        strbuf_append(&key, args[j], strlen(args[j]) + 1);
+    }
+    strbuf_append_str(&key, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "?");
+    for (int j = 0; j < num_dirs; j++) {
+        strbuf_append(&key, "\0-d", 3);
+        strbuf_append(&key, dirs[j], strlen(dirs[j]) + 1);
+    }
+    for (int j = 0; j < num_files; j++) {
+        strbuf_append(&key, "\0-f", 3);
+        strbuf_append(&key, files[j], strlen(files[j]) + 1);
+    }
+
+    char dir[PATH_MAX], path[PATH_MAX + 32] = "";
+    int have_dir = memo_dir(dir, sizeof(dir), 1) == 0;
+    if (have_dir) {
+        snprintf(path, sizeof(path), "%s/%016llx.out", dir, (unsigned long long)fnv1a(FNV_OFFSET, key.buf, key.len));
+    }
+    uint64_t print = fingerprint(dirs, num_dirs, files, num_files);
+
+    int status = have_dir ? replay(path, &key, print, max_age) : -1;
+    if (status < 0) {
+        memo_stats.misses++;
+        status = run_and_store(&args[i], have_dir ? dir : NULL, path, &key, print, dirs, num_dirs, files, num_files);
+    }
+    strbuf_free(&key);
+    return status;
+}
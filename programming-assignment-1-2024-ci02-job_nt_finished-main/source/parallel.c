@@ -0,0 +1,392 @@
+#include "shell.h"
+#include "system_programs/topology.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+
+/*
+ 'parallel' builtin: run one command per argument over N job slots.
+
+   parallel [-j N] [--pin] [--halt-on-error] command [args...] ::: arg1 arg2 ...
+   parallel [-j N] [--pin] [--halt-on-error] command [args...] < list
+
+ Each job is the command with the argument appended, or substituted for
+ every '{}'. Jobs are started through the shell's launcher with their
+ stdout and stderr captured in memory files, which are written out in input
+ order as soon as all earlier jobs have been printed, so output is never
+ interleaved. No job starts more than 2N jobs ahead of the first one not
+ yet printed (fewer under a low RLIMIT_NOFILE), so a slow job holds back
+ the ones after it instead of letting their files pile up.
+
+ N defaults to the number of CPUs in the shell's affinity mask. With
+ --pin, each job is bound to the NUMA node running the fewest jobs; the
+ mask is applied just after the job is spawned.
+*/
+
+#define JOB_PENDING 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+
+struct parallel_job {
+    char *arg;
+    int state;
+    pid_t pid;
+    int pidfd;
+    int out_fd;
+    int err_fd;
+    int status;
+    int node; // NUMA node index the job is pinned to, or -1
+};
+
+static void parallel_usage(void) {
+    fprintf(stderr, "Usage: parallel [-j N] [--pin] [--halt-on-error] command [args...] [::: arg...]\n");
+}
+
+// Read newline-separated arguments from fd 0, bypassing stdio so nothing is
+// left behind in the shell's stdin buffer
+static char **read_args_from_stdin(int *count) {
+    struct strbuf input = {0};
+    char chunk[65536];
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("parallel: read");
+            break;
+        }
+        strbuf_append(&input, chunk, n);
+    }
+
+    char **args = NULL;
+    int capacity = 0;
+    *count = 0;
+    char *line = input.buf;
+    for (char *p = input.buf; input.buf != NULL && p <= input.buf + input.len; p++) {
+        if (p == input.buf + input.len || *p == '\n') {
+            if (p > line) {
+                if (*count == capacity) {
+                    capacity = capacity ? capacity * 2 : 64;
+                    args = realloc(args, capacity * sizeof(char *));
+                    if (args == NULL) {
+                        perror("realloc");
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                args[(*count)++] = strndup(line, p - line);
+            }
+            line = p + 1;
+        }
+    }
+    strbuf_free(&input);
+    return args;
+}
+
+// Build the argv of one job from the template
+static char **job_argv(char **template, int template_count, const char *arg) {
+    char **argv = malloc((template_count + 2) * sizeof(char *));
+    int n = 0, substituted = 0;
+
+    for (int i = 0; i < template_count; i++) {
+        char *hole = strstr(template[i], "{}");
+        if (hole == NULL) {
+            argv[n++] = strdup(template[i]);
+            continue;
+        }
+        struct strbuf sb = {0};
+        const char *p = template[i];
+        while ((hole = strstr(p, "{}")) != NULL) {
+            strbuf_append(&sb, p, hole - p);
+            strbuf_append_str(&sb, arg);
+            p = hole + 2;
+        }
+        strbuf_append_str(&sb, p);
+        argv[n++] = strbuf_detach(&sb);
+        substituted = 1;
+    }
+    if (!substituted) {
+        argv[n++] = strdup(arg);
+    }
+    argv[n] = NULL;
+    return argv;
+}
+
+static void free_argv(char **argv) {
+    for (int i = 0; argv[i] != NULL; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+}
+
+static int start_job(struct parallel_job *job, char **template, int template_count, int null_fd) {
+    int std_fds[3] = {null_fd, -1, -1};
+
+    job->out_fd = memfd_create("parallel-stdout", MFD_CLOEXEC);
+    job->err_fd = memfd_create("parallel-stderr", MFD_CLOEXEC);
+    std_fds[1] = job->out_fd;
+    std_fds[2] = job->err_fd;
+
+    char **argv = job_argv(template, template_count, job->arg);
+    job->pid = (job->out_fd >= 0 && job->err_fd >= 0) ? spawn_command(argv, NULL, std_fds) : -1;
+    free_argv(argv);
+
+    if (job->pid < 0) {
+        fprintf(stderr, "parallel: failed to start job for '%s': %s\n", job->arg, strerror(errno));
+        job->state = JOB_DONE;
+        job->status = 127;
+        return -1;
+    }
+    job->pidfd = (int)syscall(SYS_pidfd_open, job->pid, 0);
+    job->state = JOB_RUNNING;
+    return 0;
+}
+
+// Block until one running job exits; returns its index
+static int wait_any_job(struct parallel_job *jobs, int first, int last) {
+    struct pollfd fds[last - first];
+    int index[last - first];
+    int n = 0, status;
+
+    for (int i = first; i < last; i++) {
+        if (jobs[i].state == JOB_RUNNING) {
+            if (jobs[i].pidfd < 0) {
+                // No pidfd support: fall back to waiting for this job
+                waitpid(jobs[i].pid, &status, 0);
+                jobs[i].status = status_from_wait(status);
+                zygote_record_exit(jobs[i].pid);
+                job_finished(jobs[i].pid, jobs[i].arg);
+                return i;
+            }
+            fds[n].fd = jobs[i].pidfd;
+            fds[n].events = POLLIN;
+            index[n++] = i;
+        }
+    }
+
+    // Replace zygote helpers consumed by the jobs just started
+    zygote_refill();
+
+    for (;;) {
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("parallel: poll");
+            return -1;
+        }
+        for (int k = 0; k < n; k++) {
+            if (fds[k].revents) {
+                int i = index[k];
+                waitpid(jobs[i].pid, &status, 0);
+                jobs[i].status = status_from_wait(status);
+                zygote_record_exit(jobs[i].pid);
+                job_finished(jobs[i].pid, jobs[i].arg);
+                close(jobs[i].pidfd);
+                jobs[i].pidfd = -1;
+                return i;
+            }
+        }
+    }
+}
+
+// Copy a captured output file to fd 'out'
+static void copy_output(int from, int to) {
+    off_t offset = 0;
+    off_t size = lseek(from, 0, SEEK_END);
+
+    while (offset < size) {
+        ssize_t n = sendfile(to, from, &offset, size - offset);
+        if (n > 0) {
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            // Destination does not support sendfile, copy by hand
+            char buf[65536];
+            ssize_t got;
+            while ((got = pread(from, buf, sizeof(buf), offset)) > 0) {
+                if (write(to, buf, got) != got) {
+                    break;
+                }
+                offset += got;
+            }
+        }
+        break;
+    }
+}
+
+static void print_job(struct parallel_job *job) {
+    if (job->out_fd >= 0) {
+        copy_output(job->out_fd, STDOUT_FILENO);
+        close(job->out_fd);
+    }
+    if (job->err_fd >= 0) {
+        copy_output(job->err_fd, STDERR_FILENO);
+        close(job->err_fd);
+    }
+    job->out_fd = job->err_fd = -1;
+}
+
+// Handler for 'parallel' command
+int shell_parallel(char **args) {
+    int slots = 0, halt_on_error = 0, pin = 0;
+    int i = 1;
+
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--halt-on-error") == 0) {
+            halt_on_error = 1;
+        } else if (strcmp(args[i], "--pin") == 0) {
+            pin = 1;
+        } else if (strcmp(args[i], "-j") == 0 || strcmp(args[i], "--jobs") == 0) {
+            if (args[i + 1] == NULL) {
+                parallel_usage();
+                return 1;
+            }
+            slots = atoi(args[++i]);
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            slots = atoi(args[i] + 2);
+        } else if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            parallel_usage();
+            return 1;
+        }
+    }
+    if (slots <= 0) {
+        slots = topology_threads();
+    }
+
+    char **template = &args[i];
+    int template_count = 0;
+    while (template[template_count] != NULL && strcmp(template[template_count], ":::") != 0) {
+        template_count++;
+    }
+    if (template_count == 0) {
+        parallel_usage();
+        return 1;
+    }
+
+    char **inputs;
+    int num_jobs = 0, from_stdin = template[template_count] == NULL;
+    if (from_stdin) {
+        inputs = read_args_from_stdin(&num_jobs);
+    } else {
+        inputs = &template[template_count + 1];
+        while (inputs[num_jobs] != NULL) {
+            num_jobs++;
+        }
+    }
+
+    struct parallel_job *jobs = calloc(num_jobs ? num_jobs : 1, sizeof(struct parallel_job));
+    for (int j = 0; j < num_jobs; j++) {
+        jobs[j].arg = inputs[j];
+        jobs[j].pidfd = jobs[j].out_fd = jobs[j].err_fd = -1;
+        jobs[j].node = -1;
+    }
+
+    struct topology topo = {0};
+    int *node_load = NULL; // running jobs per node
+    if (pin) {
+        topology_load(&topo);
+        node_load = calloc(topo.num_nodes ? topo.num_nodes : 1, sizeof(int));
+    }
+
+    // Started jobs hold their memory files and pidfd until printed, so a slow
+    // early job must not let later ones pile up: bound how far 'next' runs ahead
+    int window = slots * 2;
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY) {
+        rlim_t spare = nofile.rlim_cur > 19 ? (nofile.rlim_cur - 16) / 3 : 1; // 3 fds per job
+        if ((rlim_t)window > spare) {
+            window = (int)spare;
+        }
+    }
+
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int next = 0, printed = 0, running = 0, failures = 0, halted = 0, halt_status = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    while (printed < num_jobs) {
+        while (!halted && running < slots && next < num_jobs && next - printed < window) {
+            if (start_job(&jobs[next], template, template_count, null_fd) == 0) {
+                running++;
+                if (pin && topo.num_nodes > 0) {
+                    int node = 0;
+                    for (int n = 1; n < topo.num_nodes; n++) {
+                        if (node_load[n] < node_load[node]) {
+                            node = n;
+                        }
+                    }
+                    topology_pin_node(jobs[next].pid, &topo, node);
+                    jobs[next].node = node;
+                    node_load[node]++;
+                }
+            } else {
+                failures++;
+                if (halt_on_error) {
+                    halted = 1;
+                    halt_status = jobs[next].status;
+                }
+            }
+            next++;
+        }
+
+        if (running > 0) {
+            int done = wait_any_job(jobs, printed, next);
+            if (done < 0) {
+                break;
+            }
+            jobs[done].state = JOB_DONE;
+            running--;
+            if (jobs[done].node >= 0) {
+                node_load[jobs[done].node]--;
+            }
+            if (jobs[done].status != 0) {
+                failures++;
+                if (halt_on_error && !halted) {
+                    halted = 1;
+                    halt_status = jobs[done].status;
+                    fprintf(stderr, "parallel: '%s' failed with status %d, not starting further jobs\n",
+                            jobs[done].arg, jobs[done].status);
+                }
+            }
+        }
+
+        // Emit finished jobs in input order
+        while (printed < next && jobs[printed].state == JOB_DONE) {
+            print_job(&jobs[printed++]);
+        }
+        if (running == 0 && (halted || next == num_jobs) && printed == next) {
+            break;
+        }
+    }
+
+    if (null_fd >= 0) {
+        close(null_fd);
+    }
+    if (from_stdin) {
+        for (int j = 0; j < num_jobs; j++) {
+            free(inputs[j]);
+        }
+        free(inputs);
+    }
+    free(jobs);
+    free(node_load);
+    topology_free(&topo);
+
+    // As GNU parallel: the failed job's status when halting, else the number
+    // of failed jobs (capped at 101)
+    if (halted) {
+        return halt_status;
+    }
+    return failures > 101 ? 101 : failures;
+}
@@ -0,0 +1,174 @@
+#include "shell.h"
+#include <stdint.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Counters opened for every 'perf' run, software ones first so that they are
+// still reported on kernels or VMs that do not expose a PMU
+struct perf_counter_def {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+static const struct perf_counter_def perf_counters[] = {
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+};
+
+#define NUM_PERF_COUNTERS (sizeof(perf_counters) / sizeof(perf_counters[0]))
+
+// Layout returned by read() for the read_format used below
+struct perf_reading {
+    uint64_t value;
+    uint64_t time_enabled;
+    uint64_t time_running;
+};
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags) {
+    return (int)syscall(SYS_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+// Open one counter on the (still stopped) child. Counting starts when the
+// child calls exec, so the shell's own fork bookkeeping is not measured.
+// Retries in user-space-only mode when perf_event_paranoid forbids kernel
+// sampling; *user_only is set in that case.
+static int open_counter(const struct perf_counter_def *def, pid_t pid, int *user_only) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = def->type;
+    attr.config = def->config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    *user_only = 0;
+    int fd = perf_event_open(&attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        *user_only = 1;
+        fd = perf_event_open(&attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    return fd;
+}
+
+static void print_counter(const struct perf_counter_def *def, int fd, int user_only, int open_errno) {
+    struct perf_reading reading;
+    const char *suffix = user_only ? ":u" : "";
+
+    if (fd < 0) {
+        if (open_errno == ENOENT || open_errno == EOPNOTSUPP || open_errno == ENODEV) {
+            fprintf(stderr, "  %20s      %s%s\n", "<not supported>", def->name, suffix);
+        } else {
+            fprintf(stderr, "  %20s      %s%s (%s)\n", "<not counted>", def->name, suffix, strerror(open_errno));
+        }
+        return;
+    }
+
+    if (read(fd, &reading, sizeof(reading)) != sizeof(reading) || reading.time_enabled == 0) {
+        fprintf(stderr, "  %20s      %s%s\n", "<not counted>", def->name, suffix);
+        return;
+    }
+
+    // Scale up when the PMU had to multiplex this counter with others
+    double value = (double)reading.value;
+    double running = 100.0;
+    if (reading.time_running < reading.time_enabled) {
+        value = reading.time_running ? value * reading.time_enabled / reading.time_running : 0;
+        running = reading.time_enabled ? 100.0 * reading.time_running / reading.time_enabled : 0;
+    }
+
+    if (def->type == PERF_TYPE_SOFTWARE && def->config == PERF_COUNT_SW_TASK_CLOCK) {
+        fprintf(stderr, "  %20.2f msec %s%s", value / 1e6, def->name, suffix);
+    } else {
+        fprintf(stderr, "  %20.0f      %s%s", value, def->name, suffix);
+    }
+    if (running < 100.0) {
+        fprintf(stderr, "  (%.1f%%)", running);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Handler for 'perf' command: run a system program under perf_event counters
+int shell_perf(char **args) {
+    int fds[NUM_PERF_COUNTERS];
+    int user_only[NUM_PERF_COUNTERS];
+    int open_errno[NUM_PERF_COUNTERS];
+    int go_pipe[2];
+    struct timespec start, end;
+    int status;
+
+    if (args[1] == NULL) {
+        fprintf(stderr, "perf: expected command\n");
+        return 1;
+    }
+
+    // The child blocks on go_pipe until every counter is attached to it
+    if (pipe(go_pipe) != 0) {
+        perror("pipe");
+        return 1;
+    }
+
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(go_pipe[0]);
+        close(go_pipe[1]);
+        return 1;
+    } else if (pid == 0) {
+        char go;
+        close(go_pipe[1]);
+        if (read(go_pipe[0], &go, 1) != 1) {
+            _exit(1);
+        }
+        close(go_pipe[0]);
+        exec_system_program(&args[1]);
+        _exit(1);
+    }
+
+    close(go_pipe[0]);
+    for (size_t i = 0; i < NUM_PERF_COUNTERS; i++) {
+        fds[i] = open_counter(&perf_counters[i], pid, &user_only[i]);
+        open_errno[i] = fds[i] < 0 ? errno : 0;
+    }
+    if (write(go_pipe[1], "g", 1) != 1) {
+        perror("perf: failed to start child");
+    }
+    close(go_pipe[1]);
+
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fprintf(stderr, "\n Performance counter stats for '%s':\n\n", args[1]);
+    for (size_t i = 0; i < NUM_PERF_COUNTERS; i++) {
+        print_counter(&perf_counters[i], fds[i], user_only[i], open_errno[i]);
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    fprintf(stderr, "\n  %20.6f seconds time elapsed\n",
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "  (exited with status %d)\n", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        fprintf(stderr, "  (killed by signal %d)\n", WTERMSIG(status));
+    }
+    fprintf(stderr, "\n");
+
+    // Report the command's own status, as 'perf stat' does
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+}
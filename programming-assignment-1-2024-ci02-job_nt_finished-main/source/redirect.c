@@ -0,0 +1,79 @@
+#include "shell.h"
+#include <fcntl.h>
+
+/*
+ Install the redirections of 'cmd' onto the standard descriptors, in order.
+ Target files are opened O_CLOEXEC, so only the dup2()'d copy (which never
+ has FD_CLOEXEC) survives into an exec'd program. Returns -1 after printing
+ an error if a file cannot be opened.
+*/
+int apply_redirections(const struct command *cmd) {
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        const struct redirection *redir = &cmd->redirs[i];
+
+        if (redir->type == TOK_REDIR_DUP) {
+            if (dup2(redir->dup_fd, redir->fd) < 0) {
+                fprintf(stderr, "cseshell: %d: %s\n", redir->dup_fd, strerror(errno));
+                return -1;
+            }
+            continue;
+        }
+
+        int flags = O_CLOEXEC;
+        if (redir->type == TOK_REDIR_IN) {
+            flags |= O_RDONLY;
+        } else if (redir->type == TOK_REDIR_APPEND) {
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+        } else {
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+        }
+
+        int fd = open(redir->path, flags, 0666);
+        if (fd < 0) {
+            fprintf(stderr, "cseshell: %s: %s\n", redir->path, strerror(errno));
+            return -1;
+        }
+        if (fd == redir->fd) {
+            fcntl(fd, F_SETFD, 0); // the standard fd was closed; keep it across exec
+        } else {
+            if (dup2(fd, redir->fd) < 0) {
+                fprintf(stderr, "cseshell: %s: %s\n", redir->path, strerror(errno));
+                close(fd);
+                return -1;
+            }
+            close(fd);
+        }
+    }
+    return 0;
+}
+
+// Keep close-on-exec copies of every standard fd 'cmd' redirects, so that a
+// builtin can run with redirections without forking
+void save_std_fds(const struct command *cmd, struct saved_fds *saved) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int fd = 0; fd < 3; fd++) {
+        saved->fd[fd] = -2; // untouched
+    }
+    for (int i = 0; i < cmd->num_redirs; i++) {
+        int fd = cmd->redirs[i].fd;
+        if (saved->fd[fd] == -2) {
+            saved->fd[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10); // -1 if fd was closed
+        }
+    }
+}
+
+void restore_std_fds(struct saved_fds *saved) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int fd = 0; fd < 3; fd++) {
+        if (saved->fd[fd] >= 0) {
+            dup2(saved->fd[fd], fd);
+            close(saved->fd[fd]);
+        } else if (saved->fd[fd] == -1) {
+            close(fd);
+        }
+        saved->fd[fd] = -2;
+    }
+    clearerr(stdin);
+}
@@ -0,0 +1,556 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ Script mode: 'cseshell script.csh'.
+
+ A script is compiled once into bytecode: one instruction per simple
+ command (run unconditionally, if the last status is 0, or if it is
+ non-zero) referring to a range of pre-lexed tokens, whose text and
+ expansion segments live in a single string table. The compiled form is
+ cached under $XDG_CACHE_HOME/cseshell (or ~/.cache/cseshell), keyed by the
+ script's path, and reused while the script's mtime, size and inode match,
+ so later runs skip reading, lexing and parsing the source altogether.
+*/
+
+#define SCRIPT_CACHE_MAGIC "CSEBC\0\0\1"
+#define SCRIPT_CACHE_VERSION 1
+
+// Opcodes; each runs the command in tokens [first, first + count)
+#define OP_RUN 0         // always (';' or start of line)
+#define OP_RUN_IF_OK 1   // only if $? is 0 ('&&')
+#define OP_RUN_IF_FAIL 2 // only if $? is non-zero ('||')
+
+static const char *op_names[] = {"RUN", "RUN_IF_OK", "RUN_IF_FAIL"};
+
+struct script_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t path_length;
+    uint64_t script_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t inode;
+    uint64_t device;
+    uint32_t num_ops;
+    uint32_t num_tokens;
+    uint32_t num_segments;
+    uint32_t text_size;
+};
+
+struct script_op {
+    uint8_t op;
+    uint8_t reserved[3];
+    uint32_t line;
+    uint32_t first;
+    uint32_t count;
+};
+
+// A token as stored in the cache: its text is an offset into the string table
+struct script_token {
+    int32_t type;
+    int32_t flags;
+    uint32_t text_offset;
+    int32_t length;
+    int32_t first_segment;
+    int32_t num_segments;
+    int32_t fd;
+    int32_t dup_fd;
+};
+
+// A compiled script, either built from source or mapped from the cache
+struct script_program {
+    struct script_op *ops;
+    int num_ops;
+    int ops_capacity;
+    struct script_token *tokens;
+    int num_tokens;
+    int tokens_capacity;
+    struct segment *segments;
+    int num_segments;
+    int segments_capacity;
+    struct strbuf text;
+    void *map; // cache file mapping the arrays above point into, if any
+    size_t map_size;
+};
+
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void *grow(void *array, int *capacity, int needed, size_t elem_size) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    array = realloc(array, new_capacity * elem_size);
+    if (array == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+// Append one lexed and parsed line to the program
+static void append_line(struct script_program *prog, const struct token_list *tokens, const struct command_list *list, int line) {
+    int token_base = prog->num_tokens;
+    int segment_base = prog->num_segments;
+
+    prog->tokens = grow(prog->tokens, &prog->tokens_capacity, prog->num_tokens + tokens->count, sizeof(struct script_token));
+    for (int i = 0; i < tokens->count; i++) {
+        const struct token *tok = &tokens->tokens[i];
+        struct script_token *out = &prog->tokens[prog->num_tokens++];
+        out->type = tok->type;
+        out->flags = tok->flags;
+        out->text_offset = (uint32_t)prog->text.len;
+        out->length = tok->length;
+        out->first_segment = tok->num_segments ? tok->first_segment + segment_base : 0;
+        out->num_segments = tok->num_segments;
+        out->fd = tok->fd;
+        out->dup_fd = tok->dup_fd;
+        if (tok->type == TOK_WORD) {
+            strbuf_append(&prog->text, tok->text, tok->length);
+        }
+        strbuf_append_char(&prog->text, '\0');
+    }
+
+    prog->segments = grow(prog->segments, &prog->segments_capacity, prog->num_segments + tokens->num_segments, sizeof(struct segment));
+    memcpy(prog->segments + prog->num_segments, tokens->segments, tokens->num_segments * sizeof(struct segment));
+    prog->num_segments += tokens->num_segments;
+
+    prog->ops = grow(prog->ops, &prog->ops_capacity, prog->num_ops + list->count, sizeof(struct script_op));
+    for (int i = 0; i < list->count; i++) {
+        const struct list_entry *entry = &list->entries[i];
+        struct script_op *op = &prog->ops[prog->num_ops++];
+        memset(op, 0, sizeof(*op));
+        op->op = entry->connector == TOK_AND ? OP_RUN_IF_OK : entry->connector == TOK_OR ? OP_RUN_IF_FAIL : OP_RUN;
+        op->line = line;
+        op->first = entry->first + token_base;
+        op->count = entry->count;
+    }
+}
+
+// Compile the script source. Returns -1 after reporting a syntax error.
+static int compile_script(const char *path, const char *source, size_t size, struct script_program *prog) {
+    struct token_list tokens = {0};
+    struct command_list list = {0};
+    struct strbuf line = {0};
+    const char *error;
+    const char *p = source, *end = source + size;
+    int line_number = 1;
+    int result = 0;
+
+    while (p < end) {
+        int first_line = line_number;
+
+        // Gather one logical line, joining backslash-newline continuations
+        strbuf_reset(&line);
+        for (;;) {
+            const char *nl = memchr(p, '\n', end - p);
+            const char *stop = nl ? nl : end;
+            strbuf_append(&line, p, stop - p);
+            p = nl ? nl + 1 : end;
+            line_number++;
+            if (nl == NULL || line.len == 0 || line.buf[line.len - 1] != '\\') {
+                break;
+            }
+            line.len--;
+        }
+        if (line.len == 0) {
+            continue;
+        }
+        if (memchr(line.buf, '\0', line.len) != NULL) {
+            fprintf(stderr, "%s:%d: binary data in script\n", path, first_line);
+            result = -1;
+            break;
+        }
+
+        if (lex_line(line.buf, &tokens, &error) != 0 || parse_command_list(&tokens, &list, &error) != 0) {
+            fprintf(stderr, "%s:%d: syntax error: %s\n", path, first_line, error);
+            result = -1;
+            break;
+        }
+        append_line(prog, &tokens, &list, first_line);
+    }
+
+    token_list_free(&tokens);
+    free(list.entries);
+    strbuf_free(&line);
+    return result;
+}
+
+// Cache file for 'real_path': <cache dir>/<FNV-1a hash of the path>.cshc
+static int cache_file_path(const char *real_path, char *out, size_t size, int create_dir) {
+    char dir[PATH_MAX];
+    const char *base = getenv("XDG_CACHE_HOME");
+    uint64_t hash = 1469598103934665603ULL;
+
+    if (base != NULL && base[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/cseshell", base);
+    } else if ((base = getenv("HOME")) != NULL) {
+        snprintf(dir, sizeof(dir), "%s/.cache/cseshell", base);
+    } else {
+        return -1;
+    }
+
+    if (create_dir) {
+        char parent[PATH_MAX];
+        snprintf(parent, sizeof(parent), "%s", dir);
+        char *slash = strrchr(parent, '/');
+        if (slash != NULL) {
+            *slash = '\0';
+            mkdir(parent, 0700);
+        }
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            return -1;
+        }
+    }
+
+    for (const char *c = real_path; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    if (snprintf(out, size, "%s/%016llx.cshc", dir, (unsigned long long)hash) >= (int)size) {
+        return -1;
+    }
+    return 0;
+}
+
+static void fill_header(struct script_cache_header *header, const char *real_path, const struct stat *st, const struct script_program *prog) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SCRIPT_CACHE_MAGIC, sizeof(header->magic));
+    header->version = SCRIPT_CACHE_VERSION;
+    header->path_length = (uint32_t)strlen(real_path);
+    header->script_size = (uint64_t)st->st_size;
+    header->mtime_sec = st->st_mtim.tv_sec;
+    header->mtime_nsec = st->st_mtim.tv_nsec;
+    header->inode = st->st_ino;
+    header->device = st->st_dev;
+    if (prog != NULL) {
+        header->num_ops = prog->num_ops;
+        header->num_tokens = prog->num_tokens;
+        header->num_segments = prog->num_segments;
+        header->text_size = (uint32_t)prog->text.len;
+    }
+}
+
+// The path is padded so that the arrays after it stay 8-byte aligned
+static size_t padded_path_length(uint32_t length) {
+    return (length + 7) & ~(size_t)7;
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Store the compiled program; written to a temporary file and renamed so
+// concurrent runs never see a partial cache entry
+static void save_cache(const char *cache_path, const char *real_path, const struct stat *st, const struct script_program *prog) {
+    struct script_cache_header header;
+    char tmp_path[PATH_MAX + 32];
+    char padding[8] = {0};
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache_path, (int)getpid());
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+
+    fill_header(&header, real_path, st, prog);
+    if (write_all(fd, &header, sizeof(header)) != 0 ||
+        write_all(fd, real_path, header.path_length) != 0 ||
+        write_all(fd, padding, padded_path_length(header.path_length) - header.path_length) != 0 ||
+        write_all(fd, prog->ops, prog->num_ops * sizeof(struct script_op)) != 0 ||
+        write_all(fd, prog->tokens, prog->num_tokens * sizeof(struct script_token)) != 0 ||
+        write_all(fd, prog->segments, prog->num_segments * sizeof(struct segment)) != 0 ||
+        write_all(fd, prog->text.buf ? prog->text.buf : "", prog->text.len) != 0 ||
+        close(fd) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+    if (rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+// Map a cache entry if it matches the script; returns 0 on a hit
+static int load_cache(const char *cache_path, const char *real_path, const struct stat *st, struct script_program *prog) {
+    struct script_cache_header expected, *header;
+    struct stat cache_st;
+
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &cache_st) != 0 || (size_t)cache_st.st_size < sizeof(*header)) {
+        close(fd);
+        return -1;
+    }
+
+    // Private writable mapping: builtins may scribble on their arguments
+    size_t map_size = cache_st.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    header = map;
+    fill_header(&expected, real_path, st, NULL);
+    size_t payload = sizeof(*header) + padded_path_length(header->path_length) + (size_t)header->num_ops * sizeof(struct script_op) +
+                     (size_t)header->num_tokens * sizeof(struct script_token) +
+                     (size_t)header->num_segments * sizeof(struct segment) + header->text_size;
+    if (memcmp(header->magic, expected.magic, sizeof(header->magic)) != 0 ||
+        header->version != expected.version || header->script_size != expected.script_size ||
+        header->mtime_sec != expected.mtime_sec || header->mtime_nsec != expected.mtime_nsec ||
+        header->inode != expected.inode || header->device != expected.device ||
+        header->path_length != expected.path_length || payload != map_size ||
+        memcmp((char *)map + sizeof(*header), real_path, header->path_length) != 0) {
+        munmap(map, map_size);
+        return -1;
+    }
+
+    char *p = (char *)map + sizeof(*header) + padded_path_length(header->path_length);
+    prog->ops = (struct script_op *)p;
+    prog->num_ops = header->num_ops;
+    p += header->num_ops * sizeof(struct script_op);
+    prog->tokens = (struct script_token *)p;
+    prog->num_tokens = header->num_tokens;
+    p += header->num_tokens * sizeof(struct script_token);
+    prog->segments = (struct segment *)p;
+    prog->num_segments = header->num_segments;
+    p += header->num_segments * sizeof(struct segment);
+    prog->text.buf = p;
+    prog->text.len = header->text_size;
+    prog->map = map;
+    prog->map_size = map_size;
+
+    // Reject entries whose references point outside their tables
+    for (int i = 0; i < prog->num_ops; i++) {
+        if (prog->ops[i].op > OP_RUN_IF_FAIL || prog->ops[i].first + (uint64_t)prog->ops[i].count > (uint64_t)prog->num_tokens) {
+            goto corrupt;
+        }
+    }
+    for (int i = 0; i < prog->num_tokens; i++) {
+        const struct script_token *tok = &prog->tokens[i];
+        if (tok->length < 0 || tok->text_offset + (uint64_t)tok->length >= prog->text.len ||
+            prog->text.buf[tok->text_offset + tok->length] != '\0' || tok->num_segments < 0 ||
+            tok->first_segment < 0 || tok->first_segment + (int64_t)tok->num_segments > prog->num_segments) {
+            goto corrupt;
+        }
+    }
+    return 0;
+
+corrupt:
+    munmap(map, map_size);
+    memset(prog, 0, sizeof(*prog));
+    return -1;
+}
+
+static void free_program(struct script_program *prog) {
+    if (prog->map != NULL) {
+        munmap(prog->map, prog->map_size);
+    } else {
+        free(prog->ops);
+        free(prog->tokens);
+        free(prog->segments);
+        strbuf_free(&prog->text);
+    }
+    memset(prog, 0, sizeof(*prog));
+}
+
+// Turn the stored tokens into the runtime token list the executor expands
+static void program_tokens(const struct script_program *prog, struct token_list *tokens) {
+    tokens->tokens = malloc((prog->num_tokens ? prog->num_tokens : 1) * sizeof(struct token));
+    if (tokens->tokens == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    tokens->count = tokens->capacity = prog->num_tokens;
+    for (int i = 0; i < prog->num_tokens; i++) {
+        const struct script_token *in = &prog->tokens[i];
+        struct token *out = &tokens->tokens[i];
+        out->type = in->type;
+        out->flags = in->flags;
+        out->text = prog->text.buf + in->text_offset;
+        out->length = in->length;
+        out->first_segment = in->first_segment;
+        out->num_segments = in->num_segments;
+        out->fd = in->fd;
+        out->dup_fd = in->dup_fd;
+    }
+    tokens->segments = prog->segments;
+    tokens->num_segments = tokens->segments_capacity = prog->num_segments;
+}
+
+static void dump_token(const struct script_program *prog, const struct script_token *tok) {
+    const char *text = prog->text.buf + tok->text_offset;
+
+    switch (tok->type) {
+    case TOK_REDIR_IN:
+        printf(" %d<", tok->fd);
+        return;
+    case TOK_REDIR_OUT:
+        printf(" %d>", tok->fd);
+        return;
+    case TOK_REDIR_APPEND:
+        printf(" %d>>", tok->fd);
+        return;
+    case TOK_REDIR_DUP:
+        printf(" %d>&%d", tok->fd, tok->dup_fd);
+        return;
+    }
+
+    printf(" \"");
+    if (tok->num_segments == 0) {
+        printf("%s", text);
+    }
+    for (int i = 0; i < tok->num_segments; i++) {
+        const struct segment *seg = &prog->segments[tok->first_segment + i];
+        if (seg->type == SEG_LITERAL) {
+            printf("%.*s", seg->length, text + seg->offset);
+        } else if (seg->type == SEG_VAR) {
+            printf("${%.*s}", seg->length, text + seg->offset);
+        } else {
+            printf("$?");
+        }
+    }
+    printf("\"");
+    if (tok->flags & TOK_GLOB) {
+        printf("[glob]");
+    }
+}
+
+static void dump_program(const char *path, const struct script_program *prog, int cache_hit) {
+    printf("; %s: %d ops, %d tokens, %d segments, %zu bytes of text (%s)\n", path, prog->num_ops,
+           prog->num_tokens, prog->num_segments, prog->text.len, cache_hit ? "cached" : "compiled");
+    for (int i = 0; i < prog->num_ops; i++) {
+        const struct script_op *op = &prog->ops[i];
+        printf("%04d  L%-4u %-12s", i, op->line, op_names[op->op]);
+        for (uint32_t t = op->first; t < op->first + op->count; t++) {
+            dump_token(prog, &prog->tokens[t]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ Run (or with dump set, only print) the script at 'path'. With timing set,
+ cache hit/miss and load/run times are reported on stderr. Returns the exit
+ status of the script.
+*/
+int run_script(const char *path, int dump, int timing) {
+    struct script_program prog = {0};
+    char real_path[PATH_MAX];
+    char cache_path[PATH_MAX];
+    struct timespec start;
+    struct stat st;
+    int cache_hit = 0, have_cache;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "cseshell: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+    if (fstat(fd, &st) != 0 || realpath(path, real_path) == NULL) {
+        fprintf(stderr, "cseshell: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return 126;
+    }
+
+    have_cache = cache_file_path(real_path, cache_path, sizeof(cache_path), 0) == 0;
+    if (have_cache && load_cache(cache_path, real_path, &st, &prog) == 0) {
+        cache_hit = 1;
+    } else {
+        char *source = malloc(st.st_size + 1);
+        ssize_t got = 0;
+        if (source == NULL) {
+            perror("malloc");
+            close(fd);
+            return 1;
+        }
+        while (got < st.st_size) {
+            ssize_t n = read(fd, source + got, st.st_size - got);
+            if (n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        int compiled = compile_script(path, source, got, &prog);
+        free(source);
+        if (compiled != 0) {
+            free_program(&prog);
+            close(fd);
+            return 2;
+        }
+        if (have_cache && got == st.st_size && cache_file_path(real_path, cache_path, sizeof(cache_path), 1) == 0) {
+            save_cache(cache_path, real_path, &st, &prog);
+        }
+    }
+    close(fd);
+
+    if (timing) {
+        fprintf(stderr, "cseshell: %s: cache %s, %s in %.3f ms (%d ops)\n", path, cache_hit ? "hit" : "miss",
+                cache_hit ? "loaded" : "compiled", elapsed_ms(&start), prog.num_ops);
+    }
+
+    if (dump) {
+        dump_program(path, &prog, cache_hit);
+        free_program(&prog);
+        return 0;
+    }
+
+    // Execute: the opcodes map directly onto command list connectors
+    struct token_list tokens = {0};
+    struct command_list list = {0};
+    struct command cmd = {0};
+
+    program_tokens(&prog, &tokens);
+    list.entries = malloc((prog.num_ops ? prog.num_ops : 1) * sizeof(struct list_entry));
+    if (list.entries == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    list.count = list.capacity = prog.num_ops;
+    for (int i = 0; i < prog.num_ops; i++) {
+        static const int connectors[] = {TOK_SEMI, TOK_AND, TOK_OR};
+        list.entries[i].connector = connectors[prog.ops[i].op];
+        list.entries[i].first = prog.ops[i].first;
+        list.entries[i].count = prog.ops[i].count;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_command_list(&tokens, &list, &cmd);
+    if (timing) {
+        fprintf(stderr, "cseshell: %s: ran in %.3f ms, status %d\n", path, elapsed_ms(&start), last_status);
+    }
+
+    command_free(&cmd);
+    free(list.entries);
+    free(tokens.tokens);
+    free_program(&prog);
+    return last_status;
+}
@@ -0,0 +1,548 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ Server mode: cseshell --serve SOCKET
+
+ The shell loads .cseshellrc once and then serves command lines from any
+ number of clients (see system_programs/cseclient.c) on one epoll loop.
+
+ Each connection is a session with its own working directory and
+ environment, starting from the server's. Every command line runs in a
+ forked copy of the warm shell. The copy moves into the session's
+ directory and environment, installs the client's stdin, stdout and
+ stderr (received with the request as SCM_RIGHTS, so output streams
+ straight to the client's terminal), and runs the line. Afterwards it
+ reports its exit status and its final directory and environment over a
+ pipe, so cd and setenv persist within the session but never leak into
+ other sessions or the server. SIGCHLD arrives through a signalfd on the
+ same loop. The socket is created owner-only, and $? carries
+ over from line to line within a session.
+
+ Frames are a header (type, payload length) followed by the payload:
+
+   client -> server  'H' hello: cwd, then NAME=VALUE overrides, NUL-separated
+                     'R' run: the command line, with 3 fds attached
+   server -> client  'X' done: int32 exit status and int32 flag set when the
+                     line ran 'exit', which ends the session
+*/
+
+#define MAX_FRAME (1 << 20)
+#define WATCH_LISTEN 0
+#define WATCH_SIGNAL 1
+#define WATCH_CLIENT 2
+#define WATCH_REPORT 3
+
+struct frame_header {
+    uint32_t type;
+    uint32_t length;
+};
+
+struct watch {
+    int kind;
+    struct client *client;
+};
+
+struct client {
+    int fd;
+    struct watch conn_watch;
+    struct watch report_watch;
+    struct strbuf in;         // bytes received, not yet parsed into frames
+    int fds[16];              // descriptors received, not yet claimed by a frame
+    int num_fds;
+    char *cwd;
+    char **env;               // NAME=VALUE strings of the session
+    int env_count;
+    int last_status;          // $? of the session's previous line
+    pid_t pid;                // command running for this session, or 0
+    int report_fd;            // read end of its report pipe, or -1
+    struct strbuf report;
+    int reaped;
+    int wait_status;
+    int closing;              // client gone: 1, and 2 once its command was told to stop
+    struct client *next;
+};
+
+static struct client *clients = NULL;
+static int epoll_fd = -1, listen_fd = -1, signal_fd = -1;
+
+static void watch_fd(int fd, struct watch *watch) {
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.ptr = watch;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("cseshell: epoll_ctl");
+    }
+}
+
+// Forked commands share our descriptors, so closing one does not take it
+// out of the epoll set; remove it explicitly first
+static void unwatch_close(int fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+// Stop reading from a client that hung up or misbehaved
+static void mark_closing(struct client *c) {
+    if (!c->closing) {
+        c->closing = 1;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    }
+}
+
+static void send_frame(struct client *c, uint32_t type, const void *data, uint32_t length) {
+    struct frame_header header = {type, length};
+    struct iovec iov[2] = {{&header, sizeof(header)}, {(void *)data, length}};
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    // Replies are a few bytes, far below the socket buffer
+    if (sendmsg(c->fd, &msg, MSG_NOSIGNAL) < 0) {
+        mark_closing(c);
+    }
+}
+
+static void set_env_entry(struct client *c, const char *entry) {
+    size_t name_len = strcspn(entry, "=");
+    for (int i = 0; i < c->env_count; i++) {
+        if (strncmp(c->env[i], entry, name_len) == 0 && c->env[i][name_len] == '=') {
+            free(c->env[i]);
+            c->env[i] = strdup(entry);
+            return;
+        }
+    }
+    c->env = realloc(c->env, (c->env_count + 2) * sizeof(char *));
+    if (c->env == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    c->env[c->env_count++] = strdup(entry);
+    c->env[c->env_count] = NULL;
+}
+
+static void clear_env(struct client *c) {
+    for (int i = 0; i < c->env_count; i++) {
+        free(c->env[i]);
+    }
+    free(c->env);
+    c->env = NULL;
+    c->env_count = 0;
+}
+
+static void accept_client(int listen_fd) {
+    extern char **environ;
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) {
+        return;
+    }
+    struct client *c = calloc(1, sizeof(struct client));
+    char cwd[PATH_MAX];
+    c->fd = fd;
+    c->report_fd = -1;
+    c->cwd = strdup(getcwd(cwd, sizeof(cwd)) != NULL ? cwd : "/");
+    for (char **e = environ; *e != NULL; e++) {
+        set_env_entry(c, *e);
+    }
+    c->conn_watch.kind = WATCH_CLIENT;
+    c->conn_watch.client = c;
+    c->report_watch.kind = WATCH_REPORT;
+    c->report_watch.client = c;
+    c->next = clients;
+    clients = c;
+    watch_fd(fd, &c->conn_watch);
+}
+
+static void free_client(struct client *c) {
+    struct client **link = &clients;
+    while (*link != c) {
+        link = &(*link)->next;
+    }
+    *link = c->next;
+
+    if (c->closing) {
+        close(c->fd); // already out of the epoll set
+    } else {
+        unwatch_close(c->fd);
+    }
+    if (c->report_fd >= 0) {
+        unwatch_close(c->report_fd);
+    }
+    for (int i = 0; i < c->num_fds; i++) {
+        close(c->fds[i]);
+    }
+    strbuf_free(&c->in);
+    strbuf_free(&c->report);
+    free(c->cwd);
+    clear_env(c);
+    free(c);
+}
+
+// Child side: become the session and run one line, then report back
+static void run_in_child(struct client *c, char *line, const int *fds, int report_fd) {
+    struct command_line cl = {0};
+    sigset_t none;
+
+    // Keep only the client's stdio and the report pipe
+    close(epoll_fd);
+    close(listen_fd);
+    close(signal_fd);
+    for (struct client *other = clients; other != NULL; other = other->next) {
+        close(other->fd);
+        if (other->report_fd >= 0) {
+            close(other->report_fd);
+        }
+        for (int i = 0; i < other->num_fds; i++) {
+            close(other->fds[i]);
+        }
+    }
+
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    setpgid(0, 0);
+    last_status = c->last_status; // the session's own $?, not .cseshellrc's or another session's
+
+    for (int fd = 0; fd < 3; fd++) {
+        dup2(fds[fd], fd);
+    }
+    clearenv();
+    for (int i = 0; i < c->env_count; i++) {
+        putenv(strdup(c->env[i]));
+    }
+    if (chdir(c->cwd) != 0) {
+        fprintf(stderr, "cseshell: %s: %s\n", c->cwd, strerror(errno));
+    }
+
+    execute_line(line, &cl);
+    fflush(stdout);
+    fflush(stderr);
+
+    // Report: status, exit flag, cwd, environment
+    extern char **environ;
+    struct strbuf report = {0};
+    char cwd[PATH_MAX];
+    int32_t head[2] = {last_status, exit_requested};
+    strbuf_append(&report, (const char *)head, sizeof(head));
+    strbuf_append_str(&report, getcwd(cwd, sizeof(cwd)) != NULL ? cwd : c->cwd);
+    strbuf_append_char(&report, '\0');
+    for (char **e = environ; *e != NULL; e++) {
+        strbuf_append(&report, *e, strlen(*e) + 1);
+    }
+    for (size_t done = 0; done < report.len;) {
+        ssize_t n = write(report_fd, report.buf + done, report.len - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    _exit(last_status);
+}
+
+static void start_command(struct client *c, char *line) {
+    int pipe_fds[2];
+    int fds[3];
+
+    if (c->num_fds < 3) {
+        int32_t reply[2] = {2, 0};
+        c->last_status = reply[0];
+        fprintf(stderr, "cseshell: request without stdin/stdout/stderr\n");
+        send_frame(c, 'X', reply, sizeof(reply));
+        return;
+    }
+    memcpy(fds, c->fds, sizeof(fds));
+    c->num_fds -= 3;
+    memmove(c->fds, c->fds + 3, c->num_fds * sizeof(int));
+
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+        int32_t reply[2] = {126, 0};
+        c->last_status = reply[0];
+        perror("cseshell: pipe");
+        for (int i = 0; i < 3; i++) {
+            close(fds[i]);
+        }
+        send_frame(c, 'X', reply, sizeof(reply));
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(pipe_fds[0]);
+        run_in_child(c, line, fds, pipe_fds[1]);
+    }
+    close(pipe_fds[1]);
+    for (int i = 0; i < 3; i++) {
+        close(fds[i]);
+    }
+    if (pid < 0) {
+        int32_t reply[2] = {126, 0};
+        c->last_status = reply[0];
+        perror("cseshell: fork");
+        close(pipe_fds[0]);
+        send_frame(c, 'X', reply, sizeof(reply));
+        return;
+    }
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+    c->pid = pid;
+    c->report_fd = pipe_fds[0];
+    c->reaped = 0;
+    strbuf_reset(&c->report);
+    watch_fd(c->report_fd, &c->report_watch);
+}
+
+// The command is over once its report is complete and it has been reaped
+static void finish_command(struct client *c) {
+    if (c->pid == 0 || c->report_fd >= 0 || !c->reaped) {
+        return;
+    }
+    int32_t reply[2] = {status_from_wait(c->wait_status), 0}; // status, quit
+
+    if (c->report.len >= sizeof(reply)) {
+        int32_t head[2];
+        memcpy(head, c->report.buf, sizeof(head));
+        reply[0] = head[0];
+        reply[1] = head[1];
+        // Adopt the directory and environment the line left behind
+        const char *p = c->report.buf + sizeof(head);
+        const char *end = c->report.buf + c->report.len;
+        free(c->cwd);
+        c->cwd = strdup(p);
+        p += strlen(p) + 1;
+        clear_env(c);
+        for (; p < end; p += strlen(p) + 1) {
+            set_env_entry(c, p);
+        }
+    }
+    c->last_status = reply[0];
+    c->pid = 0;
+    if (!c->closing) {
+        send_frame(c, 'X', reply, sizeof(reply));
+        if (reply[1]) {
+            mark_closing(c);
+        }
+    }
+}
+
+// Parse complete frames; a request waits while the session is busy
+static void process_frames(struct client *c) {
+    size_t used = 0;
+
+    while (c->pid == 0 && c->in.len - used >= sizeof(struct frame_header)) {
+        struct frame_header header;
+        memcpy(&header, c->in.buf + used, sizeof(header));
+        if (header.length > MAX_FRAME) {
+            mark_closing(c);
+            break;
+        }
+        if (c->in.len - used < sizeof(header) + header.length) {
+            break;
+        }
+        char *payload = c->in.buf + used + sizeof(header);
+        used += sizeof(header) + header.length;
+
+        if (header.type == 'H') {
+            // cwd, then environment overrides
+            char *end = payload + header.length;
+            if (header.length > 0 && end[-1] == '\0') {
+                free(c->cwd);
+                c->cwd = strdup(payload);
+                for (char *p = payload + strlen(payload) + 1; p < end; p += strlen(p) + 1) {
+                    set_env_entry(c, p);
+                }
+            }
+        } else if (header.type == 'R') {
+            char *line = strndup(payload, header.length);
+            start_command(c, line);
+            free(line);
+        }
+    }
+    memmove(c->in.buf, c->in.buf + used, c->in.len - used);
+    c->in.len -= used;
+}
+
+static void read_client(struct client *c) {
+    char buf[65536];
+    char control[CMSG_SPACE(16 * sizeof(int))];
+
+    for (;;) {
+        struct iovec iov = {buf, sizeof(buf)};
+        struct msghdr msg = {0};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            break;
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); n > 0 && cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+                int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                int *received = (int *)CMSG_DATA(cm);
+                for (int i = 0; i < count; i++) {
+                    if (c->num_fds < 16) {
+                        c->fds[c->num_fds++] = received[i];
+                    } else {
+                        close(received[i]);
+                    }
+                }
+            }
+        }
+        if (n <= 0) {
+            mark_closing(c); // hung up
+            break;
+        }
+        if (c->in.len + n > 2 * MAX_FRAME) {
+            mark_closing(c);
+            break;
+        }
+        strbuf_append(&c->in, buf, n);
+    }
+    process_frames(c);
+}
+
+static void read_report(struct client *c) {
+    char buf[65536];
+    ssize_t n;
+
+    while ((n = read(c->report_fd, buf, sizeof(buf))) > 0) {
+        strbuf_append(&c->report, buf, n);
+    }
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        unwatch_close(c->report_fd);
+        c->report_fd = -1;
+        finish_command(c);
+    }
+}
+
+static void reap_children(void) {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (struct client *c = clients; c != NULL; c = c->next) {
+            if (c->pid == pid) {
+                c->reaped = 1;
+                c->wait_status = status;
+                finish_command(c);
+                break;
+            }
+        }
+    }
+}
+
+// Drop sessions whose client is gone, stopping a command still running
+static void sweep_clients(void) {
+    struct client *next;
+    for (struct client *c = clients; c != NULL; c = next) {
+        next = c->next;
+        if (!c->closing) {
+            process_frames(c); // requests queued while the session was busy
+            continue;
+        }
+        if (c->pid != 0) {
+            if (c->closing == 1) {
+                kill(-c->pid, SIGTERM);
+                c->closing = 2;
+            }
+            continue; // freed after it has been reaped
+        }
+        free_client(c);
+    }
+}
+
+// Run the server until SIGINT or SIGTERM. Returns the exit status.
+int serve(const char *socket_path) {
+    struct sockaddr_un addr = {0};
+    struct watch listen_watch = {WATCH_LISTEN, NULL}, signal_watch = {WATCH_SIGNAL, NULL};
+    sigset_t mask;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "cseshell: socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    // Whoever can connect runs commands as this user, so the socket is owner-only
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    unlink(socket_path);
+    mode_t old_umask = umask(077);
+    int bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(old_umask);
+    if (!bound || listen(listen_fd, 128) != 0) {
+        fprintf(stderr, "cseshell: %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    watch_fd(listen_fd, &listen_watch);
+    watch_fd(signal_fd, &signal_watch);
+    fprintf(stderr, "cseshell: serving on %s\n", socket_path);
+
+    int running = 1;
+    while (running) {
+        struct epoll_event events[64];
+        int n = epoll_wait(epoll_fd, events, 64, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("cseshell: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            struct watch *watch = events[i].data.ptr;
+            if (watch->kind == WATCH_LISTEN) {
+                accept_client(listen_fd);
+            } else if (watch->kind == WATCH_SIGNAL) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo == SIGCHLD) {
+                        reap_children();
+                    } else {
+                        running = 0;
+                    }
+                }
+            } else if (watch->kind == WATCH_CLIENT) {
+                read_client(watch->client);
+            } else {
+                read_report(watch->client);
+            }
+        }
+        sweep_clients();
+    }
+
+    for (struct client *c = clients; c != NULL; c = c->next) {
+        if (c->pid != 0) {
+            kill(-c->pid, SIGTERM);
+        }
+    }
+    while (clients != NULL) {
+        if (clients->pid != 0) {
+            waitpid(clients->pid, NULL, 0);
+            clients->pid = 0;
+        }
+        free_client(clients);
+    }
+    close(listen_fd);
+    close(signal_fd);
+    close(epoll_fd);
+    unlink(socket_path);
+    return 0;
+}
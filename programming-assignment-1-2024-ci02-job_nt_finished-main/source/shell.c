@@ -10,7 +10,6 @@
 #include <sys/stat.h>
 #include <pwd.h>
 #include <grp.h>
-#define HISTORY_SIZE 100
 
 // ANSI color escape codes
 #define ANSI_COLOR_RED "\x1b[31m"
@@ -30,6 +29,8 @@
 #define GREEN_PROMPT_COLOR ANSI_COLOR_GREEN
 
 int current_theme = THEME_DEFAULT;
+int last_status = 0;
+int exit_requested = 0;
 
 // Array of built-in command names
 const char *builtin_commands[] = {
@@ -42,7 +43,12 @@ const char *builtin_commands[] = {
     "unsetenv",
     "history",
     "settheme",
-    "ld"
+    "ld",
+    "perf",
+    "parallel",
+    "zygote",
+    "cached",
+    "ulimit"
 };
 
 /*
@@ -58,6 +64,11 @@ int unset_env_var(char **args);
 int print_history(char **args);
 int set_theme(char **args);
 int shell_ld(char **args);
+int shell_perf(char **args);
+int shell_parallel(char **args);
+int shell_zygote(char **args);
+int shell_cached(char **args);
+int shell_ulimit(char **args);
 
 // Array of function pointers for built-in commands
 int (*builtin_command_func[])(char **) = {
@@ -70,30 +81,20 @@ int (*builtin_command_func[])(char **) = {
     &unset_env_var,
     &print_history,
     &set_theme,
-    &shell_ld
+    &shell_ld,
+    &shell_perf,
+    &shell_parallel,
+    &shell_zygote,
+    &shell_cached,
+    &shell_ulimit
 };
 
 // Extra history function
-char *command_history[HISTORY_SIZE];
-int history_count = 0;
-
-void add_to_history(char *cmd) {
-    if (history_count < HISTORY_SIZE) {
-        command_history[history_count++] = strdup(cmd);
-    } else {
-        free(command_history[0]);
-        for (int i = 1; i < HISTORY_SIZE; i++) {
-            command_history[i - 1] = command_history[i];
-        }
-        command_history[HISTORY_SIZE - 1] = strdup(cmd);
-    }
-}
-
 int print_history(char **args) {
-    for (int i = 0; i < history_count; i++) {
-        printf("%d: %s\n", i + 1, command_history[i]);
+    for (int i = 0; i < history_length(); i++) {
+        printf("%d: %s\n", i + 1, history_entry(i));
     }
-    return 1;
+    return 0;
 }
 
 int set_theme(char **args) {
@@ -111,46 +112,34 @@ int set_theme(char **args) {
         printf("Theme set to green.\n");
     } else {
         fprintf(stderr, "settheme: unknown theme %s\n", args[1]);
+        return 1;
     }
-    return 1;
-}
-
-void get_permissions_string(mode_t mode, char *str) {
-    str[0] = (S_ISDIR(mode)) ? 'd' : '-';
-    str[1] = (mode & S_IRUSR) ? 'r' : '-';
-    str[2] = (mode & S_IWUSR) ? 'w' : '-';
-    str[3] = (mode & S_IXUSR) ? 'x' : '-';
-    str[4] = (mode & S_IRGRP) ? 'r' : '-';
-    str[5] = (mode & S_IWGRP) ? 'w' : '-';
-    str[6] = (mode & S_IXGRP) ? 'x' : '-';
-    str[7] = (mode & S_IROTH) ? 'r' : '-';
-    str[8] = (mode & S_IWOTH) ? 'w' : '-';
-    str[9] = (mode & S_IXOTH) ? 'x' : '-';
-    str[10] = '\0';
+    return 0;
 }
 
 // Handler for 'ld' command
 int shell_ld(char **args) {
-    DIR *d;
-    struct dirent *dir;
-    struct stat file_stat;
-    char permissions[11];
-    d = opendir(".");
-    if (d) {
-        while ((dir = readdir(d)) != NULL) {
-            if (stat(dir->d_name, &file_stat) == 0) {
-                get_permissions_string(file_stat.st_mode, permissions);
-                printf("%s %s\n", permissions, dir->d_name);
-            } else {
-                perror("stat");
-            }
+    // Listing, sorting and the options are all done by the ld system
+    // program. Use the one beside the shell: from a subdirectory a PATH
+    // lookup would find the linker.
+    char path[PATH_MAX];
+    int status;
+    ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - sizeof("/bin/ld"));
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        char *slash = len > 0 ? memrchr(path, '/', len) : NULL;
+        if (slash != NULL) {
+            strcpy(slash, "/bin/ld");
+            execv(path, args);
         }
-        closedir(d);
-    } else {
-        perror("opendir");
+        exec_system_program(args);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        perror("ld");
         return 1;
     }
-    return 1;
+    return status_from_wait(status);
 }
 
 // Function to get the prompt color based on the current theme
@@ -168,14 +157,17 @@ const char* get_prompt_color() {
 
 // Function to process .cseshellrc file
 void process_rc_file(const char *filePath) {
-    FILE *file = fopen(filePath, "r");
+    FILE *file = fopen(filePath, "re");
     if (file == NULL) {
         perror("Failed to open .cseshellrc file");
         return;
     }
 
+    // Every other line runs through the shell's own parser and executor,
+    // so lists like "a && b || c" need no /bin/sh
+    struct command_line cl = {0};
     char line[MAX_LINE];
-    while (fgets(line, sizeof(line), file)) {
+    while (fgets(line, sizeof(line), file) && !exit_requested) {
         line[strcspn(line, "\n")] = 0;
 
         if (strncmp(line, "PATH", 4) == 0) {
@@ -187,21 +179,11 @@ void process_rc_file(const char *filePath) {
                 }
             }
         } else {
-            pid_t pid = fork();
-            if (pid == 0) {
-                char *args[] = {"/bin/sh", "-c", line, NULL};
-                execvp(args[0], args);
-                perror("execvp failed");
-                _exit(EXIT_FAILURE);
-            } else if (pid > 0) {
-                int status;
-                waitpid(pid, &status, 0);
-            } else {
-                perror("fork failed");
-            }
+            execute_line(line, &cl);
         }
     }
 
+    command_line_free(&cl);
     fclose(file);
 }
 
@@ -211,11 +193,11 @@ int shell_cd(char **args) {
 
     if (args[1] == NULL) {
         fprintf(stderr, "cd: expected argument\n");
-        return -1; // Indicate failure
+        return 1; // Indicate failure
     } else {
         if (chdir(args[1]) != 0) {
             perror("cd");
-            return -1; // Indicate failure
+            return 1; // Indicate failure
         } else {
             // Get and print the current working directory
             if (getcwd(cwd, sizeof(cwd)) != NULL) {
@@ -234,7 +216,7 @@ int shell_cd(char **args) {
                 char *new_path = malloc(new_path_size);
                 if (new_path == NULL) {
                     perror("malloc");
-                    return -1; // Indicate failure
+                    return 1; // Indicate failure
                 }
 
                 // Construct new_path
@@ -244,18 +226,18 @@ int shell_cd(char **args) {
                 if (setenv("PATH", new_path, 1) != 0) {
                     perror("setenv");
                     free(new_path);
-                    return -1; // Indicate failure
+                    return 1; // Indicate failure
                 }
 
                 // Free the allocated buffer
                 free(new_path);
             } else {
                 perror("getcwd");
-                return -1; // Indicate failure
+                return 1; // Indicate failure
             }
         }
     }
-    return 1; // Indicate success
+    return 0; // Indicate success
 }
 
 // Handler for 'help' command
@@ -267,19 +249,20 @@ int shell_help(char **args) {
     for (int i = 0; i < sizeof(builtin_commands) / sizeof(char *); i++) {
         printf("  %s\n", builtin_commands[i]);
     }
-    return 1;
+    return 0;
 }
 
 // Handler for 'exit' command
 int shell_exit(char **args) {
-    return 0;  // Return 0 to signal the shell to terminate
+    exit_requested = 1; // Signal the shell to terminate after this command
+    return args[1] != NULL ? atoi(args[1]) & 0xff : last_status;
 }
 
 // Handler for 'usage' command
 int shell_usage(char **args) {
     if (args[1] == NULL) {
         printf("Command not given: Type usage <command>.\n");
-        return 1; // Indicate command was successful, but shell should continue running
+        return 1; // Indicate failure
     }
 
     if (strcmp(args[1], "cd") == 0) {
@@ -296,11 +279,24 @@ int shell_usage(char **args) {
         printf("Type: setenv ENV=VALUE to set a new env variable\n");
     } else if (strcmp(args[1], "unsetenv") == 0) {
         printf("Type: unsetenv ENV to remove this env from the list of env variables\n");
+    } else if (strcmp(args[1], "perf") == 0) {
+        printf("Type: perf command [args] to run a command and report its performance counters\n");
+    } else if (strcmp(args[1], "parallel") == 0) {
+        printf("Type: parallel [-j N] [--pin] [--halt-on-error] command [args...] ::: arg1 arg2 ... to run command once per argument over N slots, one per CPU by default (arguments are read from stdin without :::; --pin binds each job to a NUMA node)\n");
+    } else if (strcmp(args[1], "ld") == 0) {
+        printf("Type: ld [-1 | -l] [-S | -t | -U] to list the current directory (names only or long format, sorted by size, time or not at all), or ld -r to list it recursively\n");
+    } else if (strcmp(args[1], "zygote") == 0) {
+        printf("Type: zygote start [N] / stop / stats / bench RUNS command to manage the pool of pre-forked launch helpers\n");
+    } else if (strcmp(args[1], "cached") == 0) {
+        printf("Type: cached [-d DIR]... [-f FILE]... [-n] [-t SECONDS] command [args...] to replay a command's saved output while its inputs are unchanged, or cached --stats / --clear\n");
+    } else if (strcmp(args[1], "ulimit") == 0) {
+        printf("Type: ulimit [-H|-S] -c|-d|-f|-l|-n|-s|-t|-u|-v [VALUE|unlimited] to limit the resources of the commands the shell runs, ulimit -a to list the limits, or ulimit --cgroup [on|off] [cpu=PERCENT] [memory=SIZE] [io=WEIGHT] to run each command in its own cgroup\n");
     } else if (strcmp(args[1], "clear") == 0) {
         printf("The command you gave: clear, is not part of CSEShell's builtin command\n");
+        return 1;
     }
 
-    return 1; // Indicate success
+    return 0; // Indicate success
 }
 
 // Handler for 'env' command
@@ -309,149 +305,361 @@ int list_env(char **args) {
     for (char **env = environ; *env != 0; env++) {
         printf("%s\n", *env);
     }
-    return 1;
+    return 0;
 }
 
 // Handler for 'setenv' command
 int set_env_var(char **args) {
     if (args[1] == NULL) {
         fprintf(stderr, "setenv VAR=VALUE\n");
+        return 1;
     } else {
-        char *env_var = strtok(args[1], "=");
-        char *env_value = strtok(NULL, "=");
+        // Split on the first '=' only, so values may contain '=' themselves
+        char *env_var = args[1];
+        char *env_value = strchr(args[1], '=');
 
-        if (env_var == NULL || env_value == NULL) {
+        if (env_value == NULL || env_value == env_var) {
             fprintf(stderr, "setenv VAR=VALUE\n");
+            return 1;
         } else {
+            *env_value++ = '\0';
             if (setenv(env_var, env_value, 1) != 0) {
                 perror("setenv");
+                return 1;
             }
         }
     }
-    return 1;
+    return 0;
 }
 
 // Handler for 'unsetenv' command
 int unset_env_var(char **args) {
     if (args[1] == NULL) {
         fprintf(stderr, "unsetenv VAR\n");
+        return 1;
     } else {
         if (unsetenv(args[1]) != 0) {
             perror("unsetenv");
+            return 1;
         }
     }
-    return 1;
+    return 0;
 }
 
-int execute_builtin_command(char **cmd) {
+int num_builtin_functions() {
+    return sizeof(builtin_commands) / sizeof(char *);
+}
+
+// Index of a builtin in builtin_commands[], or -1 if 'name' is not one
+int find_builtin(const char *name) {
     for (int i = 0; i < sizeof(builtin_commands) / sizeof(char *); i++) {
-        if (strcmp(cmd[0], builtin_commands[i]) == 0) {
-            return (*builtin_command_func[i])(cmd);
+        if (strcmp(name, builtin_commands[i]) == 0) {
+            return i;
         }
     }
+    return -1;
+}
+
+// Returns the builtin's exit status, or -1 if cmd[0] is not a builtin
+int execute_builtin_command(char **cmd) {
+    int i = find_builtin(cmd[0]);
+    if (i >= 0) {
+        return (*builtin_command_func[i])(cmd);
+    }
     return -1; // Command not found
 }
 
-// Function to read a command from the user input
-void read_command(char **cmd) {
-    char line[MAX_LINE];
-    int count = 0, i = 0;
-    char *array[MAX_ARGS], *command_token;
+// Replace the current (child) process with the system program in ./bin
+void exec_system_program(char **cmd) {
+    char full_path[PATH_MAX];
+    char cwd[1024];
 
-    for (;;) {
-        int current_char = fgetc(stdin);
-        line[count++] = (char)current_char;
-        if (current_char == '\n')
-            break;
-        if (count >= MAX_LINE) {
-            printf("Command is too long, unable to process\n");
-            exit(1);
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        snprintf(full_path, sizeof(full_path), "%s/bin/%s", cwd, cmd[0]);
+    } else {
+        printf("Failed to get current working directory.");
+        exit(1);
+    }
+
+    execvp(full_path, cmd);
+
+    // Not a system program: fall back to a PATH lookup (e.g. echo in .cseshellrc)
+    if (errno == ENOENT && strchr(cmd[0], '/') == NULL) {
+        execvp(cmd[0], cmd);
+    }
+    if (errno == ENOENT) {
+        fprintf(stderr, "cseshell: %s: command not found\n", cmd[0]);
+        _exit(127);
+    }
+    fprintf(stderr, "cseshell: %s: %s\n", cmd[0], strerror(errno));
+    _exit(126);
+}
+
+// The prompt as printed by type_prompt()
+static const char *prompt_text(void) {
+    static char prompt[64];
+    snprintf(prompt, sizeof(prompt), "%s☆☆ " ANSI_COLOR_RESET, get_prompt_color());
+    return prompt;
+}
+
+// Use the line editor only when talking to a terminal that understands it
+static int use_line_editor(void) {
+    const char *term = getenv("TERM");
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && !(term != NULL && strcmp(term, "dumb") == 0);
+}
+
+// Function to read a command from the user input.
+// Returns 1 when cl->line holds a command, 0 for an empty line, -1 on EOF.
+int read_command(struct command_line *cl) {
+    int edited = use_line_editor() ? line_edit(cl, prompt_text()) : -2;
+
+    if (edited == -1 || edited == 0)
+        return edited;
+    if (edited == -2 && getline(&cl->line, &cl->line_capacity, stdin) < 0)
+        return -1;
+
+    cl->line[strcspn(cl->line, "\n")] = '\0';
+    if (cl->line[0] == '\0')
+        return 0;
+
+    add_to_history(cl->line);
+    return 1;
+}
+
+// Run a builtin in-process (swapping fds for its redirections) or fork and
+// exec a system program. Returns the exit status, also stored in last_status.
+int run_command(struct command *cmd) {
+    struct saved_fds saved;
+    char **argv = cmd->args.argv;
+    int status;
+
+    if (cmd->args.argc == 0) {
+        // Redirections only, e.g. "> file": create/truncate the files
+        save_std_fds(cmd, &saved);
+        status = apply_redirections(cmd) == 0 ? 0 : 1;
+        restore_std_fds(&saved);
+        return last_status = status;
+    }
+
+    int builtin = find_builtin(argv[0]);
+    if (builtin >= 0) {
+        if (cmd->num_redirs == 0) {
+            return last_status = (*builtin_command_func[builtin])(argv);
+        }
+        save_std_fds(cmd, &saved);
+        status = 1;
+        if (apply_redirections(cmd) == 0) {
+            status = (*builtin_command_func[builtin])(argv);
         }
+        restore_std_fds(&saved);
+        return last_status = status;
     }
-    line[count] = '\0';
 
-    if (count == 1)
-        return;
+    pid_t pid = spawn_command(argv, cmd, NULL);
+    if (pid < 0) {
+        printf("Failed to fork the process\n");
+        return last_status = 1;
+    }
+
+    // Replace a consumed zygote helper while the command runs
+    zygote_refill();
+    waitpid(pid, &status, 0);
+    zygote_record_exit(pid);
+    job_finished(pid, argv[0]);
+    return last_status = status_from_wait(status);
+}
+
+// Convert a waitpid() status into a shell exit status
+int status_from_wait(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
+}
+
+/*
+ The shell's launcher: fork a child running argv without waiting for it.
+ 'std_fds' (optional) replaces the child's standard descriptors, -1 keeping
+ the shell's; the redirections of 'cmd' (optional) are applied after that.
+ Builtins run inside the child and exit with their status. The child
+ gets the job limits set with 'ulimit' (see limits.c). Returns the child's
+ pid or -1; once it is reaped the caller reports it with job_finished().
+*/
+pid_t spawn_command(char **argv, const struct command *cmd, const int *std_fds) {
+    double start = now_us();
+    pid_t pid;
+
+    job_prepare();
+    if (zygote_active() && find_builtin(argv[0]) < 0) {
+        pid = zygote_spawn(argv, cmd, std_fds);
+        if (pid > 0) {
+            zygote_record_launch(pid, 1, start);
+            job_started(pid);
+            return pid;
+        }
+    }
+
+    fflush(stdout); // keep builtin output ordered before the child's
+    fflush(stderr);
+    pid = fork();
 
-    if (count > 1) {
-        add_to_history(line);
+    if (pid > 0)
+        zygote_record_launch(pid, 0, start);
+    if (pid != 0) {
+        job_started(pid);
+        return pid;
     }
 
-    command_token = strtok(line, " \n");
-    while (command_token != NULL) {
-        array[i++] = strdup(command_token);
-        command_token = strtok(NULL, " \n");
+    job_apply(0);
+    for (int fd = 0; std_fds != NULL && fd < 3; fd++) {
+        if (std_fds[fd] >= 0 && dup2(std_fds[fd], fd) < 0)
+            _exit(1);
     }
+    if (cmd != NULL && apply_redirections(cmd) != 0)
+        _exit(1);
+
+    int builtin = find_builtin(argv[0]);
+    if (builtin >= 0) {
+        int status = (*builtin_command_func[builtin])(argv);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+    exec_system_program(argv);
+    _exit(1);
+}
+
+/*
+ Run a parsed list: each command is skipped when its connector does not
+ match the status so far ('&&' needs success, '||' needs failure), as in
+ sh. Expansion happens just before each command runs, so "setenv X=1 && ..."
+ is visible to the commands after it. Returns the status of the list.
+*/
+int run_command_list(const struct token_list *tokens, const struct command_list *list, struct command *cmd) {
+    const char *error;
+
+    for (int i = 0; i < list->count && !exit_requested; i++) {
+        const struct list_entry *entry = &list->entries[i];
+
+        if ((entry->connector == TOK_AND && last_status != 0) ||
+            (entry->connector == TOK_OR && last_status == 0)) {
+            continue;
+        }
+
+        if (build_command(tokens, entry->first, entry->count, cmd, &error) != 0) {
+            fprintf(stderr, "cseshell: syntax error: %s\n", error);
+            last_status = 2;
+        } else {
+            run_command(cmd);
+        }
+        command_reset(cmd);
+    }
+    return last_status;
+}
+
+// Lex, parse and run one line of input (modified in place) using the buffers in 'cl'
+int execute_line(char *line, struct command_line *cl) {
+    const char *error;
 
-    for (int j = 0; j < i; j++) {
-        cmd[j] = array[j];
+    if (lex_line(line, &cl->tokens, &error) != 0 ||
+        parse_command_list(&cl->tokens, &cl->list, &error) != 0) {
+        fprintf(stderr, "cseshell: syntax error: %s\n", error);
+        return last_status = 2;
     }
-    cmd[i] = NULL;
+    return run_command_list(&cl->tokens, &cl->list, &cl->cmd);
+}
+
+void command_line_free(struct command_line *cl) {
+    command_free(&cl->cmd);
+    token_list_free(&cl->tokens);
+    free(cl->list.entries);
+    free(cl->line);
+    memset(cl, 0, sizeof(*cl));
 }
 
 // Function to display the shell prompt
 void type_prompt() {
     static int first_time = 1;
     if (first_time) {
-#ifdef _WIN32
-        system("cls");
-#else
-        system("clear");
-#endif
+        // Clear the screen and scrollback, as clear(1) does
+        if (isatty(STDOUT_FILENO)) {
+            printf("\x1b[H\x1b[2J\x1b[3J");
+        }
         first_time = 0;
     }
+    printf("%s", prompt_text());
     fflush(stdout);
-    printf("%s☆☆ " ANSI_COLOR_RESET, get_prompt_color());
 }
 
-// The main function where the shell's execution begins
-int main(void) {
-    char *cmd[MAX_ARGS];
-    int child_status, status;
-    pid_t pid;
+// The main function where the shell's execution begins.
+// Usage: cseshell [--zygote[=N]] [--cgroup] [--dump-bytecode] [--timing] [script]
+//        cseshell --serve socket
+int main(int argc, char **argv) {
+    struct command_line cl = {0};
+    int ready, dump = 0, timing = 0, helpers = 0;
+    const char *serve_path = NULL;
+    int arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "--dump-bytecode") == 0) {
+            dump = 1;
+        } else if (strcmp(argv[arg], "--timing") == 0) {
+            timing = 1;
+        } else if (strcmp(argv[arg], "--zygote") == 0) {
+            helpers = 4;
+        } else if (strncmp(argv[arg], "--zygote=", 9) == 0) {
+            helpers = atoi(argv[arg] + 9);
+        } else if (strcmp(argv[arg], "--cgroup") == 0) {
+            if (job_cgroup_enable() != 0) {
+                return 2;
+            }
+        } else if (strcmp(argv[arg], "--serve") == 0 && arg + 1 < argc) {
+            serve_path = argv[++arg];
+        } else if (strcmp(argv[arg], "--") == 0) {
+            arg++;
+            break;
+        } else {
+            fprintf(stderr, "Usage: %s [--zygote[=N]] [--cgroup] [--dump-bytecode] [--timing] [script]\n", argv[0]);
+            fprintf(stderr, "       %s --serve socket\n", argv[0]);
+            return 2;
+        }
+    }
 
-    process_rc_file(".cseshellrc");
+    // Fork the helpers first, while the shell is still small
+    if (helpers > 0 && zygote_start(helpers) != 0) {
+        fprintf(stderr, "cseshell: could not start the zygote pool\n");
+    }
 
-    while (1) {
-        type_prompt();
-        read_command(cmd);
+    if (arg < argc) {
+        int status = run_script(argv[arg], dump, timing);
+        zygote_stop();
+        return status;
+    }
 
-        if (cmd[0] == NULL)
-            continue;
+    process_rc_file(".cseshellrc");
 
-        if (execute_builtin_command(cmd) == 0)
-            break;
+    if (serve_path != NULL) {
+        zygote_stop();
+        return serve(serve_path);
+    }
 
-        pid = fork();
+    while (!exit_requested) {
+        type_prompt();
+        ready = read_command(&cl);
 
-        if (pid < 0) {
-            printf("Failed to fork the process\n");
+        if (ready < 0)
+            break;
+        if (ready == 0)
             continue;
-        } else if (pid == 0) {
-            char full_path[PATH_MAX];
-            char cwd[1024];
-
-            if (getcwd(cwd, sizeof(cwd)) != NULL) {
-                snprintf(full_path, sizeof(full_path), "%s/bin/%s", cwd, cmd[0]);
-            } else {
-                printf("Failed to get current working directory.");
-                exit(1);
-            }
 
-            execvp(full_path, cmd);
-            exit(1);
-        } else {
-            waitpid(pid, &status, 0);
-            if (WIFEXITED(status)) {
-                child_status = WEXITSTATUS(status);
-            }
-        }
-
-        for (int i = 0; cmd[i] != NULL; i++) {
-            free(cmd[i]);
-        }
-        memset(cmd, '\0', sizeof(cmd));
+        execute_line(cl.line, &cl);
+        if (exit_requested)
+            break;
     }
 
-    return 0;
+    command_line_free(&cl);
+    zygote_stop();
+    return last_status;
 }
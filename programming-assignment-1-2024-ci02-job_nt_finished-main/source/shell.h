@@ -1,6 +1,10 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // memfd_create, pipe2, sched_getaffinity, ...
+#endif
+
 #include <limits.h> // For PATH_MAX
 #include <stdlib.h>
 #include <stdio.h>
@@ -8,12 +12,191 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 
 #define MAX_LINE 1024
-#define MAX_ARGS 64
 #define BIN_PATH "./bin/"
 
+// Growable string used by the lexer and expansion code
+struct strbuf {
+    char *buf;
+    size_t len;
+    size_t capacity;
+};
+
+void strbuf_grow(struct strbuf *sb, size_t extra);
+void strbuf_append(struct strbuf *sb, const char *data, size_t len);
+void strbuf_append_char(struct strbuf *sb, char c);
+void strbuf_append_str(struct strbuf *sb, const char *str);
+void strbuf_reset(struct strbuf *sb);
+char *strbuf_detach(struct strbuf *sb);
+void strbuf_free(struct strbuf *sb);
+
+// Sorted directory listings read with getdents64, cached by path
+struct dir_entry {
+    char *name;
+    unsigned char type; // DT_* from the directory entry
+};
+
+struct dir_listing {
+    struct dir_entry *entries;
+    int count;
+    int capacity;
+    struct strbuf names; // storage for every name
+};
+
+struct cached_dir {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct dir_listing listing;
+};
+
+struct dir_cache {
+    struct cached_dir **dirs;
+    int count;
+    int capacity;
+    int *slots; // hash index by path into 'dirs', -1 when empty
+    int num_slots;
+};
+
+int dir_listing_read(int fd, struct dir_listing *listing);
+void dir_listing_free(struct dir_listing *listing);
+int dir_entry_is_dir(const char *dir, const struct dir_entry *entry);
+const struct dir_listing *dir_cache_get(struct dir_cache *cache, const char *path, int validate);
+void dir_cache_clear(struct dir_cache *cache);
+void dir_cache_free(struct dir_cache *cache);
+
+// Glob expansion; the matched paths are allocated
+struct glob_matches {
+    char **paths;
+    int count;
+    int capacity;
+};
+
+int glob_expand(const char *pattern, struct dir_cache *cache, struct glob_matches *matches);
+
+// Token types produced by lex_line()
+#define TOK_WORD 0
+#define TOK_REDIR_IN 1     // [fd]<file
+#define TOK_REDIR_OUT 2    // [fd]>file
+#define TOK_REDIR_APPEND 3 // [fd]>>file
+#define TOK_REDIR_DUP 4    // [fd]>&dup_fd, e.g. 2>&1
+#define TOK_SEMI 5         // ;
+#define TOK_AND 6          // &&
+#define TOK_OR 7           // ||
+
+// Token flags
+#define TOK_EXPAND 0x1 // word contains $VAR, ${VAR} or $? and must go through expand_token()
+#define TOK_GLOB 0x2   // word contains unquoted glob metacharacters
+#define TOK_QUOTED 0x4 // word contained quotes or backslash escapes
+
+// Segment types describing the parts of an expandable word
+#define SEG_LITERAL 0
+#define SEG_VAR 1
+#define SEG_STATUS 2
+
+// A run of a word, stored as an offset into the word's text
+struct segment {
+    int type;
+    int quoted;
+    int offset;
+    int length;
+};
+
+// A token; 'text' points into the lexed line buffer
+struct token {
+    int type;
+    int flags;
+    char *text;
+    int length;
+    int first_segment; // index into token_list.segments, only used if num_segments > 0
+    int num_segments;
+    int fd;            // redirections: the descriptor being redirected
+    int dup_fd;        // TOK_REDIR_DUP: the descriptor copied onto fd
+};
+
+struct token_list {
+    struct token *tokens;
+    int count;
+    int capacity;
+    struct segment *segments;
+    int num_segments;
+    int segments_capacity;
+};
+
+// NULL-terminated argument vector; 'owned' lists the strings it allocated
+struct arg_vector {
+    char **argv;
+    int argc;
+    int capacity;
+    char **owned;
+    int num_owned;
+    int owned_capacity;
+};
+
+// A redirection of one of the standard descriptors
+struct redirection {
+    int type;   // TOK_REDIR_*
+    int fd;
+    int dup_fd;
+    char *path; // expanded target file, NULL for TOK_REDIR_DUP
+};
+
+// A simple command ready to run: argv plus its redirections. 'dirs' holds
+// the directories read by its globs, so each is listed once per command.
+struct command {
+    struct arg_vector args;
+    struct redirection *redirs;
+    int num_redirs;
+    int redirs_capacity;
+    struct dir_cache dirs;
+};
+
+// One simple command of a list, as a range of tokens, and the operator
+// (TOK_SEMI, TOK_AND or TOK_OR) joining it to the previous command
+struct list_entry {
+    int connector;
+    int first;
+    int count;
+};
+
+struct command_list {
+    struct list_entry *entries;
+    int count;
+    int capacity;
+};
+
+int lex_line(char *line, struct token_list *list, const char **error);
+int parse_command_list(const struct token_list *tokens, struct command_list *list, const char **error);
+void expand_token(const struct token_list *list, const struct token *tok, struct strbuf *out, int glob_escape);
+int build_command(const struct token_list *list, int first, int count, struct command *cmd, const char **error);
+void command_reset(struct command *cmd);
+void command_free(struct command *cmd);
+void arg_vector_reset(struct arg_vector *av);
+void arg_vector_free(struct arg_vector *av);
+void token_list_free(struct token_list *list);
+
+// Redirections: applied in the child before exec, or around a builtin by
+// swapping the standard descriptors in-process
+struct saved_fds {
+    int fd[3];
+};
+
+int apply_redirections(const struct command *cmd);
+void save_std_fds(const struct command *cmd, struct saved_fds *saved);
+void restore_std_fds(struct saved_fds *saved);
+
+// Exit status of the last command, expanded by $?
+extern int last_status;
+
+// Set by the 'exit' builtin; the shell stops once the current command returns
+extern int exit_requested;
+
 // Array of built-in commands
 
 extern const char *builtin_commands[]; 
@@ -29,17 +212,73 @@ int unset_env_var(char **args);
 int print_history(char **args);
 int set_theme(char **args);
 int shell_ld(char **args);
+int shell_perf(char **args);
+int shell_parallel(char **args);
+int shell_zygote(char **args);
+int shell_cached(char **args);
+int shell_ulimit(char **args);
+
+// Buffers reused for every command: the input line, its tokens and argv
+struct command_line {
+    char *line;
+    size_t line_capacity;
+    struct token_list tokens;
+    struct command_list list;
+    struct command cmd;
+};
 
 // // Function declarations for reading commands and displaying the prompt
-void read_command(char **cmd);
+int read_command(struct command_line *cl);
 void type_prompt();
+int line_edit(struct command_line *cl, const char *prompt);
+
+// History ring with an index for reverse search
+void add_to_history(const char *cmd);
+int history_length(void);
+const char *history_entry(int n);
+int history_search(const char *query, int before);
+
+
+// Tab completion of command names and paths
+int complete_word(const char *line, size_t pos, struct strbuf *insert, struct strbuf *matches);
 
 // Helper function to get the number of built-in commands
  int num_builtin_functions();
 //     // return sizeof(builtin_commands) / sizeof(char *);
 
 
-// Function to execute built-in command
+// Function to execute built-in command; builtins return an exit status
 int execute_builtin_command(char **cmd);
+int find_builtin(const char *name);
+
+// Run one command, builtin or system program, with its redirections
+int run_command(struct command *cmd);
+pid_t spawn_command(char **argv, const struct command *cmd, const int *std_fds);
+int status_from_wait(int status);
+int run_command_list(const struct token_list *tokens, const struct command_list *list, struct command *cmd);
+int execute_line(char *line, struct command_line *cl);
+int run_script(const char *path, int dump, int timing);
+int serve(const char *socket_path);
+
+// Zygote mode: pre-forked helpers that exec commands handed to them over a socket
+int zygote_start(int helpers);
+void zygote_stop(void);
+void zygote_refill(void);
+int zygote_active(void);
+pid_t zygote_spawn(char **argv, const struct command *cmd, const int *std_fds);
+void zygote_record_launch(pid_t pid, int via_zygote, double start_us);
+void zygote_record_exit(pid_t pid);
+double now_us(void);
+
+// Job limits ('ulimit') and cgroup mode, applied by spawn_command()
+int job_cgroup_enable(void);
+void job_prepare(void);
+void job_apply(pid_t pid);
+void job_started(pid_t pid);
+void job_finished(pid_t pid, const char *name);
+void command_line_free(struct command_line *cl);
+
+// Replace the calling (child) process with ./bin/<cmd[0]>; returns only on failure
+void exec_system_program(char **cmd);
 
 #endif // SHELL_H
\ No newline at end of file
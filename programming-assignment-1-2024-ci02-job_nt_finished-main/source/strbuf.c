@@ -0,0 +1,57 @@
+#include "shell.h"
+
+// Make room for at least 'extra' more bytes plus a terminating NUL
+void strbuf_grow(struct strbuf *sb, size_t extra) {
+    if (sb->len + extra + 1 <= sb->capacity) {
+        return;
+    }
+    size_t capacity = sb->capacity ? sb->capacity : 64;
+    while (capacity < sb->len + extra + 1) {
+        capacity *= 2;
+    }
+    char *buf = realloc(sb->buf, capacity);
+    if (buf == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    sb->buf = buf;
+    sb->capacity = capacity;
+}
+
+void strbuf_append(struct strbuf *sb, const char *data, size_t len) {
+    strbuf_grow(sb, len);
+    memcpy(sb->buf + sb->len, data, len);
+    sb->len += len;
+    sb->buf[sb->len] = '\0';
+}
+
+void strbuf_append_char(struct strbuf *sb, char c) {
+    strbuf_grow(sb, 1);
+    sb->buf[sb->len++] = c;
+    sb->buf[sb->len] = '\0';
+}
+
+void strbuf_append_str(struct strbuf *sb, const char *str) {
+    strbuf_append(sb, str, strlen(str));
+}
+
+void strbuf_reset(struct strbuf *sb) {
+    sb->len = 0;
+    if (sb->buf) {
+        sb->buf[0] = '\0';
+    }
+}
+
+// Hand the buffer over to the caller and leave 'sb' empty
+char *strbuf_detach(struct strbuf *sb) {
+    char *buf = sb->buf ? sb->buf : strdup("");
+    sb->buf = NULL;
+    sb->len = sb->capacity = 0;
+    return buf;
+}
+
+void strbuf_free(struct strbuf *sb) {
+    free(sb->buf);
+    sb->buf = NULL;
+    sb->len = sb->capacity = 0;
+}
@@ -1,8 +1,26 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "backup_index.h"
+#include "walk.h"
+
+// Hand one path to zip on its stdin; stop the walk if zip went away
+static int add_path(const struct walk_entry *entry, void *zip_in) {
+    if (strchr(entry->path, '\n') != NULL) {
+        fprintf(stderr, "backup: skipping '%s': name contains a newline\n", entry->path);
+        return WALK_PRUNE;
+    }
+    if (fprintf(zip_in, "%s\n", entry->path) < 0) {
+        return WALK_STOP;
+    }
+    return WALK_CONTINUE;
+}
 
 int main() {
     char *backup_dir = getenv("BACKUP_DIR");
@@ -18,23 +36,82 @@ int main() {
     // Create the zip filename with the current datetime
     strftime(zip_filename, sizeof(zip_filename) - 1, "backup_%Y%m%d%H%M%S.zip", t);
 
-    // Create the zip command
-    char zip_command[512];
-    snprintf(zip_command, sizeof(zip_command), "zip -r %s %s", zip_filename, backup_dir);
-
-    // Execute the zip command
-    if (system(zip_command) == -1) {
+    // Start zip reading the list of paths from stdin; the tree is walked here, not by zip -r
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        dup2(fds[0], STDIN_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp("zip", "zip", zip_filename, "-@", (char *)NULL);
         perror("zip command failed");
+        _exit(127);
+    }
+    close(fds[0]);
+    signal(SIGPIPE, SIG_IGN);
+    FILE *zip_in = fdopen(fds[1], "w");
+
+    // Like zip -r: the directory itself, then everything in it, following symlinks
+    struct walk_options options = {0};
+    options.symlinks = WALK_SYMLINKS_FOLLOW;
+    int walked = -1;
+    if (add_path(&(struct walk_entry){.path = backup_dir}, zip_in) == WALK_CONTINUE) {
+        walked = walk(backup_dir, &options, add_path, zip_in);
+    }
+    fclose(zip_in);
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if (walked != 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "zip command failed\n");
         return EXIT_FAILURE;
     }
 
-    // Create the move command to move the zip file to the archive directory
-    char move_command[512];
-    snprintf(move_command, sizeof(move_command), "mv %s ./archive/", zip_filename);
+    // Index the archive for restore; without the index restore reads the central directory instead
+    char index_filename[sizeof(zip_filename) + 4];
+    struct backup_index index;
+    snprintf(index_filename, sizeof(index_filename), "%s.idx", zip_filename);
+    int zip_fd = open(zip_filename, O_RDONLY | O_CLOEXEC);
+    int indexed = zip_fd >= 0 && backup_index_build(zip_fd, &index) == 0;
+    if (indexed) {
+        indexed = backup_index_write(index_filename, &index) == 0;
+        backup_index_free(&index);
+    }
+    if (!indexed) {
+        fprintf(stderr, "backup: cannot index %s: %s\n", zip_filename, strerror(errno));
+    }
+    if (zip_fd >= 0) {
+        close(zip_fd);
+    }
 
-    // Execute the move command
-    if (system(move_command) == -1) {
+    // Move the zip file and its index (when there is one) to the archive directory
+    pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        if (indexed) {
+            execlp("mv", "mv", zip_filename, index_filename, "./archive/", (char *)NULL);
+        } else {
+            execlp("mv", "mv", zip_filename, "./archive/", (char *)NULL);
+        }
         perror("move command failed");
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "move command failed\n");
         return EXIT_FAILURE;
     }
 
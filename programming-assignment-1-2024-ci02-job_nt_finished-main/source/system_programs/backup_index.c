@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include "backup_index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ Building, writing and searching backup indexes (see backup_index.h).
+
+ The records are built from the archive's central directory, found through
+ the end-of-central-directory record in the last 64 KiB (and its zip64
+ counterpart for archives over 4 GiB or 65535 members).
+*/
+
+#define EOCD_SIGNATURE 0x06054b50
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_EOCD_SIGNATURE 0x06064b50
+#define CENTRAL_SIGNATURE 0x02014b50
+#define LOCAL_SIGNATURE 0x04034b50
+#define EOCD_SIZE 22
+#define CENTRAL_SIZE 46
+#define LOCAL_SIZE 30
+#define MAX_COMMENT 65535
+
+static uint16_t get16(const unsigned char *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p) {
+    return (uint32_t)get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+static uint64_t get64(const unsigned char *p) {
+    return (uint64_t)get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static int read_at(int fd, void *buf, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, (char *)buf + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            errno = n == 0 ? EINVAL : errno; // truncated archive
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// Locate the central directory; returns 0 and its offset, size and member count
+static int find_central_directory(int fd, uint64_t archive_size, uint64_t *offset, uint64_t *size,
+                                  uint64_t *count) {
+    size_t tail_size = archive_size < EOCD_SIZE + MAX_COMMENT ? archive_size : EOCD_SIZE + MAX_COMMENT;
+    unsigned char *tail = malloc(tail_size);
+    uint64_t tail_start = archive_size - tail_size;
+    int result = -1;
+
+    if (tail == NULL || read_at(fd, tail, tail_size, tail_start) != 0) {
+        free(tail);
+        return -1;
+    }
+    for (size_t i = tail_size >= EOCD_SIZE ? tail_size - EOCD_SIZE + 1 : 0; i-- > 0;) {
+        if (get32(tail + i) != EOCD_SIGNATURE) {
+            continue;
+        }
+        *count = get16(tail + i + 10);
+        *size = get32(tail + i + 12);
+        *offset = get32(tail + i + 16);
+        result = 0;
+
+        // Zip64: the locator sits just before the end record and points at the zip64 end record
+        unsigned char locator[20], record[56];
+        uint64_t eocd = tail_start + i;
+        if (eocd >= sizeof(locator) && read_at(fd, locator, sizeof(locator), eocd - sizeof(locator)) == 0 &&
+            get32(locator) == ZIP64_LOCATOR_SIGNATURE &&
+            read_at(fd, record, sizeof(record), get64(locator + 8)) == 0 && get32(record) == ZIP64_EOCD_SIGNATURE) {
+            *count = get64(record + 32);
+            *size = get64(record + 40);
+            *offset = get64(record + 48);
+        }
+        break;
+    }
+    free(tail);
+    if (result != 0 || *offset + *size > archive_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int by_name(const void *a, const void *b, void *names) {
+    const struct backup_index_record *x = a, *y = b;
+    size_t length = x->name_length < y->name_length ? x->name_length : y->name_length;
+    int cmp = memcmp((char *)names + x->name_offset, (char *)names + y->name_offset, length);
+    return cmp != 0 ? cmp : (x->name_length > y->name_length) - (x->name_length < y->name_length);
+}
+
+static void set_pointers(struct backup_index *index) {
+    index->header = index->base;
+    index->records = (const struct backup_index_record *)(index->header + 1);
+    index->names = (const char *)(index->records + index->header->count);
+}
+
+/*
+ Build the index image of the archive open on 'archive_fd' from its central
+ directory. Returns 0 on success, or -1 with errno set (EINVAL for an
+ archive that is not a zip file).
+*/
+int backup_index_build(int archive_fd, struct backup_index *index) {
+    struct stat st;
+    uint64_t cd_offset, cd_size, count;
+
+    memset(index, 0, sizeof(*index));
+    if (fstat(archive_fd, &st) != 0 || find_central_directory(archive_fd, st.st_size, &cd_offset, &cd_size, &count) != 0) {
+        return -1;
+    }
+    if (count > cd_size / CENTRAL_SIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    unsigned char *cd = malloc(cd_size ? cd_size : 1);
+    if (cd == NULL || read_at(archive_fd, cd, cd_size, cd_offset) != 0) {
+        free(cd);
+        return -1;
+    }
+
+    // Paths take at most cd_size bytes, so the image can be sized up front
+    size_t records_size = count * sizeof(struct backup_index_record);
+    index->base = calloc(1, sizeof(struct backup_index_header) + records_size + cd_size);
+    if (index->base == NULL) {
+        free(cd);
+        return -1;
+    }
+    struct backup_index_header *header = index->base;
+    struct backup_index_record *records = (struct backup_index_record *)(header + 1);
+    char *names = (char *)(records + count);
+    memcpy(header->magic, BACKUP_INDEX_MAGIC, sizeof(header->magic));
+    header->archive_size = st.st_size;
+    header->count = count;
+
+    size_t pos = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        const unsigned char *entry = cd + pos;
+        uint16_t name_length = 0, extra_length = 0, comment_length = 0;
+        if (pos + CENTRAL_SIZE <= cd_size && get32(entry) == CENTRAL_SIGNATURE) {
+            name_length = get16(entry + 28);
+            extra_length = get16(entry + 30);
+            comment_length = get16(entry + 32);
+        }
+        if (name_length == 0 || pos + CENTRAL_SIZE + name_length + extra_length + comment_length > cd_size) {
+            free(cd);
+            backup_index_free(index);
+            errno = EINVAL;
+            return -1;
+        }
+        struct backup_index_record *record = &records[i];
+        record->method = get16(entry + 10);
+        record->crc32 = get32(entry + 16);
+        record->compressed_size = get32(entry + 20);
+        record->size = get32(entry + 24);
+        record->offset = get32(entry + 42);
+        record->name_length = name_length;
+        record->name_offset = header->names_size;
+        memcpy(names + header->names_size, entry + CENTRAL_SIZE, name_length);
+        header->names_size += name_length;
+
+        // Zip64 extra field: 64-bit values for whichever fields were saturated, in this order
+        const unsigned char *extra = entry + CENTRAL_SIZE + name_length, *end = extra + extra_length;
+        while (extra + 4 <= end) {
+            uint16_t id = get16(extra), length = get16(extra + 2);
+            const unsigned char *field = extra + 4, *field_end = field + length;
+            if (id == 0x0001 && field_end <= end) {
+                uint64_t *values[] = {&record->size, &record->compressed_size, &record->offset};
+                for (int v = 0; v < 3; v++) {
+                    if (*values[v] == UINT32_MAX && field + 8 <= field_end) {
+                        *values[v] = get64(field);
+                        field += 8;
+                    }
+                }
+            }
+            extra = field_end;
+        }
+        pos += CENTRAL_SIZE + name_length + extra_length + comment_length;
+    }
+    free(cd);
+
+    qsort_r(records, count, sizeof(struct backup_index_record), by_name, names);
+    index->length = sizeof(struct backup_index_header) + records_size + header->names_size;
+    set_pointers(index);
+    return 0;
+}
+
+/*
+ Use the archive's .idx file if it matches the archive, or build the index
+ from the central directory otherwise. Returns 0 on success.
+*/
+int backup_index_load(const char *archive, int archive_fd, struct backup_index *index) {
+    char path[PATH_MAX];
+    struct stat st, archive_st;
+
+    memset(index, 0, sizeof(*index));
+    snprintf(path, sizeof(path), "%s.idx", archive);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && fstat(fd, &st) == 0 && fstat(archive_fd, &archive_st) == 0 &&
+        st.st_size >= (off_t)sizeof(struct backup_index_header)) {
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        const struct backup_index_header *header = base;
+        if (base != MAP_FAILED && memcmp(header->magic, BACKUP_INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+            header->archive_size == (uint64_t)archive_st.st_size &&
+            header->count <= (st.st_size - sizeof(*header)) / sizeof(struct backup_index_record) &&
+            sizeof(*header) + header->count * sizeof(struct backup_index_record) + header->names_size ==
+                (uint64_t)st.st_size) {
+            index->base = base;
+            index->length = st.st_size;
+            index->mapped = 1;
+            set_pointers(index);
+            close(fd);
+            return 0;
+        }
+        if (base != MAP_FAILED) {
+            munmap(base, st.st_size);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return backup_index_build(archive_fd, index);
+}
+
+// Write the index image to 'path' (through a temporary file). Returns 0 on success.
+int backup_index_write(const char *path, const struct backup_index *index) {
+    char tmp_path[PATH_MAX];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    int ok = fwrite(index->base, 1, index->length, file) == index->length;
+    if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_name(const struct backup_index *index, size_t i, const char *path, size_t length) {
+    const struct backup_index_record *record = &index->records[i];
+    size_t common = record->name_length < length ? record->name_length : length;
+    int cmp = memcmp(index->names + record->name_offset, path, common);
+    return cmp != 0 ? cmp : (record->name_length > length) - (record->name_length < length);
+}
+
+// Index of the first record whose path is not less than 'path' (count if none)
+size_t backup_index_lower_bound(const struct backup_index *index, const char *path, size_t length) {
+    size_t low = 0, high = index->header->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (compare_name(index, mid, path, length) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Whether record i's path is exactly 'path'
+int backup_index_name_is(const struct backup_index *index, size_t i, const char *path, size_t length) {
+    return i < index->header->count && compare_name(index, i, path, length) == 0;
+}
+
+/*
+ Find where record i's compressed bytes start, from its local header, after
+ checking that the header is there and names the same path. Returns 0 on
+ success, or -1 with errno set (EINVAL if the archive does not match).
+*/
+int backup_index_data_offset(int archive_fd, const struct backup_index *index, size_t i, uint64_t *offset) {
+    const struct backup_index_record *record = &index->records[i];
+    unsigned char local[LOCAL_SIZE + 65535];
+
+    if (read_at(archive_fd, local, LOCAL_SIZE + record->name_length, record->offset) != 0) {
+        return -1;
+    }
+    if (get32(local) != LOCAL_SIGNATURE || get16(local + 26) != record->name_length ||
+        memcmp(local + LOCAL_SIZE, index->names + record->name_offset, record->name_length) != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    *offset = record->offset + LOCAL_SIZE + record->name_length + get16(local + 28);
+    return 0;
+}
+
+void backup_index_free(struct backup_index *index) {
+    if (index->mapped) {
+        munmap(index->base, index->length);
+    } else {
+        free(index->base);
+    }
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,63 @@
+#ifndef BACKUP_INDEX_H
+#define BACKUP_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ Index of a backup archive, shared by backup (the writer) and restore.
+
+ A backup_*.zip is already a series of independently compressed members,
+ but finding one means reading the central directory at the end of the
+ archive, which lists the members in the order they were added. backup
+ therefore also writes backup_*.zip.idx: a header, then one fixed-size
+ record per member sorted by path, then the paths. restore maps it and
+ binary-searches the records, so getting one file back reads the index
+ pages on the search path, that member's local header and its compressed
+ bytes, and nothing else.
+
+ The hash is the member's CRC-32 from the archive. An index whose
+ archive_size does not match the archive is stale and is not used; the
+ same records are then built from the central directory instead.
+*/
+
+#define BACKUP_INDEX_MAGIC "CSEBIDX1"
+
+#define BACKUP_STORED 0   // compression methods used by zip
+#define BACKUP_DEFLATED 8
+
+struct backup_index_header {
+    char magic[8];
+    uint64_t archive_size;
+    uint64_t count;
+    uint64_t names_size;
+};
+
+struct backup_index_record {
+    uint64_t offset;          // of the member's local header in the archive
+    uint64_t compressed_size;
+    uint64_t size;
+    uint64_t name_offset;     // into the paths that follow the records
+    uint32_t crc32;
+    uint16_t method;          // BACKUP_STORED or BACKUP_DEFLATED
+    uint16_t name_length;
+};
+
+struct backup_index {
+    void *base;        // the whole index image, mapped or allocated
+    size_t length;
+    int mapped;
+    const struct backup_index_header *header;
+    const struct backup_index_record *records;
+    const char *names;
+};
+
+int backup_index_build(int archive_fd, struct backup_index *index);
+int backup_index_load(const char *archive, int archive_fd, struct backup_index *index);
+int backup_index_write(const char *path, const struct backup_index *index);
+size_t backup_index_lower_bound(const struct backup_index *index, const char *path, size_t length);
+int backup_index_name_is(const struct backup_index *index, size_t i, const char *path, size_t length);
+int backup_index_data_offset(int archive_fd, const struct backup_index *index, size_t i, uint64_t *offset);
+void backup_index_free(struct backup_index *index);
+
+#endif
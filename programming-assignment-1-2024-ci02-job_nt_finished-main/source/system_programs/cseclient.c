@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ Thin client for a shell started with 'cseshell --serve SOCKET'.
+
+   cseclient [-s SOCKET] [-e NAME=VALUE]... -c 'command line'
+   cseclient [-s SOCKET] [-e NAME=VALUE]... < script
+
+ The socket defaults to $CSESHELL_SOCKET. The session starts in the
+ client's working directory, with the server's environment plus the -e
+ overrides. With -c the line runs on the client's own stdin, stdout and
+ stderr; otherwise each line of stdin is run in turn (with stdin from
+ /dev/null) until one runs 'exit'. The exit status is that of the last line.
+*/
+
+struct frame_header {
+    uint32_t type;
+    uint32_t length;
+};
+
+static int send_all(int sock, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int sock, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Send a command line with the descriptors it should run on
+static int send_request(int sock, const char *line, const int fds[3]) {
+    struct frame_header header = {'R', (uint32_t)strlen(line)};
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = {&header, sizeof(header)};
+    struct msghdr msg = {0};
+
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(3 * sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, 3 * sizeof(int));
+
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(header)) {
+        return -1;
+    }
+    return send_all(sock, line, header.length);
+}
+
+// Wait for the line to finish. Returns its status, or -1 if the server went
+// away; *quit is set when the line ran 'exit', which ends the session.
+static int wait_status(int sock, int *quit) {
+    struct frame_header header;
+    int32_t reply[2]; // status, quit
+
+    while (recv_all(sock, &header, sizeof(header)) == 0) {
+        char payload[64];
+        if (header.length > sizeof(payload) || recv_all(sock, payload, header.length) != 0) {
+            return -1;
+        }
+        if (header.type == 'X' && header.length == sizeof(reply)) {
+            memcpy(reply, payload, sizeof(reply));
+            *quit = reply[1];
+            return reply[0];
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = getenv("CSESHELL_SOCKET");
+    const char *command = NULL;
+    char *hello = NULL;
+    size_t hello_len = 0;
+    char cwd[PATH_MAX];
+    int opt;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("cseclient: getcwd");
+        return 1;
+    }
+    hello_len = strlen(cwd) + 1;
+    hello = strdup(cwd);
+
+    while ((opt = getopt(argc, argv, "s:e:c:")) != -1) {
+        if (opt == 's') {
+            socket_path = optarg;
+        } else if (opt == 'c') {
+            command = optarg;
+        } else if (opt == 'e' && strchr(optarg, '=') != NULL) {
+            size_t len = strlen(optarg) + 1;
+            hello = realloc(hello, hello_len + len);
+            memcpy(hello + hello_len, optarg, len);
+            hello_len += len;
+        } else {
+            fprintf(stderr, "Usage: %s [-s socket] [-e NAME=VALUE]... [-c command]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (socket_path == NULL) {
+        fprintf(stderr, "cseclient: no socket given (-s or $CSESHELL_SOCKET)\n");
+        return 2;
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "cseclient: %s: %s\n", socket_path, strerror(errno));
+        return 1;
+    }
+
+    struct frame_header header = {'H', (uint32_t)hello_len};
+    if (send_all(sock, &header, sizeof(header)) != 0 || send_all(sock, hello, hello_len) != 0) {
+        fprintf(stderr, "cseclient: lost connection to the shell\n");
+        return 1;
+    }
+    free(hello);
+
+    int status = 0, quit = 0;
+    if (command != NULL) {
+        int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+        if (send_request(sock, command, fds) != 0 || (status = wait_status(sock, &quit)) < 0) {
+            fprintf(stderr, "cseclient: lost connection to the shell\n");
+            return 1;
+        }
+        return status;
+    }
+
+    int null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int fds[3] = {null_fd, STDOUT_FILENO, STDERR_FILENO};
+    char *line = NULL;
+    size_t capacity = 0;
+    while (!quit && getline(&line, &capacity, stdin) >= 0) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (send_request(sock, line, fds) != 0 || (status = wait_status(sock, &quit)) < 0) {
+            fprintf(stderr, "cseclient: lost connection to the shell\n");
+            return 1;
+        }
+    }
+    free(line);
+    close(sock);
+    return status;
+}
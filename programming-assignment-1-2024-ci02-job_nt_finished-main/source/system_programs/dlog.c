@@ -0,0 +1,379 @@
+#include "system_program.h"
+#include <zlib.h>
+#include "dspawn_log.h"
+
+/*
+ dlog - query dspawn.log through its index
+
+   dlog [-p PID] [-s START] [-e END] [logfile]
+   dlog -l [logfile]
+
+ Prints the lines of one daemon (-p) and/or a time range (-s, -e), oldest
+ first, across the rotated, compressed and live segments of the log
+ (default ./dspawn.log). Times are "YYYY-MM-DD HH:MM[:SS]", "HH:MM[:SS]"
+ (today), "@EPOCH" or relative to now such as "-10m" or "-2h". -l lists
+ the segments with their time span instead.
+
+ Only each segment's index is read in full; the text is read just for
+ the windows that match, and in a compressed segment only the gzip members
+ holding them are inflated. Lines written before the log was indexed
+ are not found.
+*/
+
+struct segment {
+    int seq; // 0 for the live segment
+    int compressed;
+};
+
+struct query {
+    long pid; // 0 for any
+    int64_t start_ms, end_ms;
+};
+
+static char log_path[PATH_MAX];
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Parse a time argument into milliseconds since the epoch, or -1
+static int64_t parse_time(const char *text) {
+    struct tm tm;
+    time_t now = time(NULL);
+    char unit = 's';
+    double amount;
+    int n = 0;
+
+    if (text[0] == '@') {
+        return (int64_t)(atof(text + 1) * 1000);
+    }
+    if (text[0] == '-' && sscanf(text + 1, "%lf%c%n", &amount, &unit, &n) >= 1) {
+        double scale = unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : 1;
+        return now_ms() - (int64_t)(amount * scale * 1000);
+    }
+    int year, month, day, hour, minute, second = 0;
+    localtime_r(&now, &tm);
+    if (sscanf(text, "%d-%d-%d %d:%d:%d", &year, &month, &day, &hour, &minute, &second) >= 5) {
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+    } else if (sscanf(text, "%d:%d:%d", &hour, &minute, &second) < 2) {
+        return -1;
+    }
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    tm.tm_sec = second;
+    tm.tm_isdst = -1;
+    return (int64_t)mktime(&tm) * 1000;
+}
+
+static int digits(const char *p, int n) {
+    int value = 0;
+    for (int i = 0; i < n; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + p[i] - '0';
+    }
+    return value;
+}
+
+// Time of a line stamped "YYYY-MM-DD HH:MM:SS.mmm", or -1. The stamp is
+// parsed by hand and mktime runs once per hour of log, since every
+// candidate line goes through here.
+static int64_t line_time(const char *line, size_t len) {
+    static char cached_hour[13];
+    static int64_t cached_base = -1;
+
+    if (len < 23) {
+        return -1;
+    }
+    int minute = digits(line + 14, 2), second = digits(line + 17, 2), ms = digits(line + 20, 3);
+    if (minute < 0 || second < 0 || ms < 0) {
+        return -1;
+    }
+    if (memcmp(line, cached_hour, 13) != 0) {
+        struct tm tm = {0};
+        tm.tm_year = digits(line, 4) - 1900;
+        tm.tm_mon = digits(line + 5, 2) - 1;
+        tm.tm_mday = digits(line + 8, 2);
+        tm.tm_hour = digits(line + 11, 2);
+        tm.tm_isdst = -1;
+        cached_base = tm.tm_year < 0 || tm.tm_mon < 0 || tm.tm_mday < 0 || tm.tm_hour < 0 ? -1 : (int64_t)mktime(&tm) * 1000;
+        memcpy(cached_hour, line, 13);
+    }
+    return cached_base < 0 ? -1 : cached_base + (minute * 60 + second) * 1000 + ms;
+}
+
+static void segment_path(char *out, size_t size, const struct segment *seg, const char *suffix) {
+    if (seg->seq > 0) {
+        snprintf(out, size, "%s.%d%s%s", log_path, seg->seq, seg->compressed ? ".gz" : "", suffix);
+    } else {
+        snprintf(out, size, "%s%s", log_path, suffix);
+    }
+}
+
+static int compare_segments(const void *a, const void *b) {
+    return ((const struct segment *)a)->seq - ((const struct segment *)b)->seq;
+}
+
+// Rotated segments in order, then the live one. Returns the count.
+static int find_segments(struct segment **out) {
+    char dir_path[PATH_MAX];
+    const char *slash = strrchr(log_path, '/');
+    const char *base = slash != NULL ? slash + 1 : log_path;
+    size_t base_len = strlen(base);
+    struct segment *segs = NULL;
+    int count = 0, capacity = 0;
+
+    snprintf(dir_path, sizeof(dir_path), "%.*s", slash != NULL ? (int)(slash - log_path + 1) : 1,
+             slash != NULL ? log_path : ".");
+    DIR *dir = opendir(dir_path);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        char *end;
+        if (strncmp(name, base, base_len) != 0 || name[base_len] != '.' || !isdigit((unsigned char)name[base_len + 1])) {
+            continue;
+        }
+        int seq = strtol(name + base_len + 1, &end, 10);
+        int compressed = strcmp(end, ".gz.idx") == 0;
+        if (!compressed && strcmp(end, ".idx") != 0) {
+            continue;
+        }
+        // A segment being compressed has both forms; either will do
+        int seen = 0;
+        for (int i = 0; i < count; i++) {
+            seen |= segs[i].seq == seq;
+        }
+        if (seen) {
+            continue;
+        }
+        if (count + 1 >= capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            segs = realloc(segs, capacity * sizeof(struct segment));
+        }
+        segs[count].seq = seq;
+        segs[count].compressed = compressed;
+        count++;
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    if (count + 1 >= capacity) {
+        segs = realloc(segs, (count + 1) * sizeof(struct segment));
+    }
+    qsort(segs, count, sizeof(struct segment), compare_segments);
+    segs[count].seq = 0;
+    segs[count].compressed = 0;
+    *out = segs;
+    return count + 1;
+}
+
+static struct dlog_record *read_index(const struct segment *seg, size_t *count) {
+    char path[PATH_MAX];
+    struct stat st;
+    struct dlog_record *records = NULL;
+
+    *count = 0;
+    segment_path(path, sizeof(path), seg, ".idx");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0) {
+        *count = st.st_size / sizeof(struct dlog_record);
+        records = malloc(*count * sizeof(struct dlog_record) + 1);
+        ssize_t want = *count * sizeof(struct dlog_record);
+        if (records == NULL || pread(fd, records, want, 0) != want) {
+            *count = 0;
+        }
+    }
+    close(fd);
+    return records;
+}
+
+// Inflate gzip members from compressed 'offset' on until 'need' bytes are out
+static int inflate_members(int fd, uint64_t offset, size_t need, char **out, size_t *out_len, size_t *out_cap) {
+    unsigned char in[65536];
+    z_stream z = {0};
+    int rc = Z_OK;
+
+    *out_len = 0;
+    if (inflateInit2(&z, 15 + 16) != Z_OK) {
+        return -1;
+    }
+    while (*out_len < need) {
+        ssize_t n = pread(fd, in, sizeof(in), offset);
+        if (n <= 0) {
+            break;
+        }
+        offset += n;
+        z.next_in = in;
+        z.avail_in = n;
+        while (z.avail_in > 0 && *out_len < need) {
+            if (rc == Z_STREAM_END) {
+                inflateReset(&z); // on to the next member
+            }
+            if (*out_cap - *out_len < 65536) {
+                *out_cap = *out_cap * 2 + 65536;
+                *out = realloc(*out, *out_cap);
+            }
+            z.next_out = (unsigned char *)*out + *out_len;
+            z.avail_out = *out_cap - *out_len;
+            rc = inflate(&z, Z_NO_FLUSH);
+            *out_len = *out_cap - z.avail_out;
+            if (rc != Z_OK && rc != Z_STREAM_END) {
+                inflateEnd(&z);
+                return -1;
+            }
+        }
+    }
+    inflateEnd(&z);
+    return *out_len >= need ? 0 : -1;
+}
+
+static int record_matches(const struct dlog_record *r, const struct query *q) {
+    return (q->pid == 0 || r->pid == q->pid) && r->last_ms >= q->start_ms && r->first_ms <= q->end_ms;
+}
+
+// Print the lines of a stretch of log that match the query
+static void print_lines(const char *text, size_t len, const struct query *q) {
+    const char *end = text + len;
+    int timed = q->start_ms != INT64_MIN || q->end_ms != INT64_MAX;
+    for (const char *line = text; line < end;) {
+        const char *next = memchr(line, '\n', end - line);
+        next = next != NULL ? next + 1 : end;
+        // The pid follows the 23-byte timestamp
+        int keep = q->pid == 0 || (next - line > 24 && atol(line + 24) == q->pid);
+        if (keep && timed) {
+            int64_t t = line_time(line, next - line);
+            keep = t >= q->start_ms && t <= q->end_ms;
+        }
+        if (keep) {
+            fwrite(line, 1, next - line, stdout);
+        }
+        line = next;
+    }
+}
+
+/*
+ Read the windows of matching records. Windows of different daemons
+ overlap, so they are merged into disjoint stretches first and each line
+ is checked against the query on its own.
+*/
+static void query_segment(const struct segment *seg, const struct query *q) {
+    char path[PATH_MAX];
+    size_t count;
+    struct dlog_record *records = read_index(seg, &count);
+    int fd = -1;
+    char *buf = NULL;
+    size_t buf_len = 0, buf_cap = 0;
+    uint64_t buf_start = 0; // segment offset of buf[0]
+
+    for (size_t i = 0; i < count; i++) {
+        if (!record_matches(&records[i], q)) {
+            continue;
+        }
+        const struct dlog_record *first = &records[i];
+        uint64_t start = first->offset, end = first->offset + first->len;
+        // Records are in order of offset; take in every matching one that overlaps
+        while (i + 1 < count && records[i + 1].offset <= end) {
+            i++;
+            if (record_matches(&records[i], q) && records[i].offset + records[i].len > end) {
+                end = records[i].offset + records[i].len;
+            }
+        }
+
+        if (fd < 0) {
+            segment_path(path, sizeof(path), seg, "");
+            if ((fd = open(path, O_RDONLY)) < 0) {
+                fprintf(stderr, "dlog: %s: %s\n", path, strerror(errno));
+                break;
+            }
+        }
+        if (seg->compressed) {
+            if (start < buf_start || end > buf_start + buf_len) {
+                buf_start = first->member_start;
+                if (inflate_members(fd, first->member_offset, end - buf_start, &buf, &buf_len, &buf_cap) != 0) {
+                    fprintf(stderr, "dlog: %s: cannot inflate at %llu\n", path, (unsigned long long)first->member_offset);
+                    break;
+                }
+            }
+            print_lines(buf + (start - buf_start), end - start, q);
+        } else {
+            if (buf_cap < end - start) {
+                buf_cap = end - start;
+                buf = realloc(buf, buf_cap);
+            }
+            if (pread(fd, buf, end - start, start) == (ssize_t)(end - start)) {
+                print_lines(buf, end - start, q);
+            }
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(records);
+    free(buf);
+}
+
+static void list_segments(const struct segment *segs, int count) {
+    for (int i = 0; i < count; i++) {
+        char path[PATH_MAX], from[32] = "-", to[32] = "-";
+        size_t num_records;
+        struct stat st;
+        struct dlog_record *records = read_index(&segs[i], &num_records);
+
+        segment_path(path, sizeof(path), &segs[i], "");
+        if (stat(path, &st) != 0) {
+            free(records);
+            continue;
+        }
+        if (num_records > 0) {
+            time_t first = records[0].first_ms / 1000, last = records[num_records - 1].last_ms / 1000;
+            struct tm tm;
+            strftime(from, sizeof(from), "%Y-%m-%d %H:%M:%S", localtime_r(&first, &tm));
+            strftime(to, sizeof(to), "%Y-%m-%d %H:%M:%S", localtime_r(&last, &tm));
+        }
+        printf("%-28s %10lld bytes %7zu records  %s .. %s\n", path, (long long)st.st_size, num_records, from, to);
+        free(records);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct query q = {0, INT64_MIN, INT64_MAX};
+    int list = 0, opt;
+
+    while ((opt = getopt(argc, argv, "p:s:e:l")) != -1) {
+        if (opt == 'p' && atol(optarg) > 0) {
+            q.pid = atol(optarg);
+        } else if (opt == 's' && (q.start_ms = parse_time(optarg)) >= 0) {
+            continue;
+        } else if (opt == 'e' && (q.end_ms = parse_time(optarg)) >= 0) {
+            q.end_ms += 999; // through the end of that second
+            continue;
+        } else if (opt == 'l') {
+            list = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-p pid] [-s start] [-e end] [logfile]\n       %s -l [logfile]\n", argv[0],
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    snprintf(log_path, sizeof(log_path), "%s", optind < argc ? argv[optind] : "dspawn.log");
+
+    struct segment *segs;
+    int count = find_segments(&segs);
+    if (list) {
+        list_segments(segs, count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            query_segment(&segs[i], &q);
+        }
+    }
+    free(segs);
+    return EXIT_SUCCESS;
+}
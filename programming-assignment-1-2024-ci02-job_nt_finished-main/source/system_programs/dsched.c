@@ -0,0 +1,679 @@
+#include "system_program.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+/*
+ dsched - one daemon for all periodic jobs
+
+   dsched [-f] [-j N] [jobfile]
+
+ Reads a crontab-like job file (default ./dsched.jobs), one job per line:
+
+   @every 30s  command...     (units: ms, s, m, h, d)
+   @hourly     command...     (also @daily, @weekly, @monthly)
+   0,30 9-17 * * 1-5 command  (minute hour day-of-month month day-of-week;
+                               each '*', N, N-M or a comma list of them,
+                               with an optional /step)
+
+ Commands run with /bin/sh -c in the directory dsched was started from.
+ Instead of a sleeping process per job, every job's next fire time sits in
+ a min-heap and one timerfd is armed for the earliest; SIGCHLD, SIGHUP and
+ SIGTERM arrive on the same epoll loop through a signalfd. At most N jobs
+ (default 4) run at once: jobs that come due while all slots are busy wait
+ in order, and a job that is still running or waiting when it comes due
+ again is skipped for that round rather than piling up.
+
+ Every start, exit and skip is appended to dsched.log. SIGHUP re-reads the
+ job file, SIGUSR1 writes each job's counters to the log, and SIGTERM stops
+ the daemon. -f stays in the foreground.
+*/
+
+#define MAX_QUEUE 1024
+
+struct job {
+    char *line; // as written, to recognise the job across reloads
+    char *command;
+    int64_t interval_ms; // @every jobs; 0 for calendar jobs
+    uint64_t minutes;
+    uint32_t hours, days;
+    uint16_t months;
+    uint8_t weekdays;
+    int days_restricted, weekdays_restricted;
+    int64_t next_ms; // -1 if the job never fires
+    pid_t pid;       // running instance, or 0
+    int queued;
+    int64_t started_ms;
+    long runs, failures, skips;
+};
+
+static struct job *jobs = NULL;
+static int num_jobs = 0;
+static int *heap = NULL; // job indices, earliest next_ms first
+static int heap_size = 0;
+static int queue[MAX_QUEUE]; // due jobs waiting for a slot
+static int queue_head = 0, queue_len = 0;
+static int max_running = 4, running = 0;
+static int log_fd = -1;
+static char job_path[PATH_MAX];
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Append one timestamped line to the history log
+static void log_event(const char *fmt, ...) {
+    char line[4096];
+    time_t now = time(NULL);
+    struct tm tm;
+    size_t len;
+    va_list ap;
+
+    localtime_r(&now, &tm);
+    len = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S ", &tm);
+    va_start(ap, fmt);
+    vsnprintf(line + len, sizeof(line) - len - 1, fmt, ap);
+    va_end(ap);
+    len = strlen(line);
+    line[len++] = '\n';
+    if (write(log_fd, line, len) < 0) {
+        // nowhere left to report it
+    }
+}
+
+// Parse one cron field ("*", "N", "N-M", with "/step", comma-separated)
+// into a bitmap of the values lo..hi. Returns -1 if malformed.
+static int parse_field(const char *field, int lo, int hi, uint64_t *bits) {
+    const char *p = field;
+
+    *bits = 0;
+    for (;;) {
+        int from = lo, to = hi, step = 1, star = *p == '*';
+        char *end;
+        if (star) {
+            p++;
+        } else {
+            from = strtol(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+            p = end;
+            to = from;
+            if (*p == '-') {
+                to = strtol(p + 1, &end, 10);
+                if (end == p + 1) {
+                    return -1;
+                }
+                p = end;
+            }
+        }
+        if (*p == '/') {
+            step = strtol(p + 1, &end, 10);
+            if (end == p + 1 || step <= 0) {
+                return -1;
+            }
+            p = end;
+            if (!star && from == to) {
+                to = hi; // "N/step" runs from N to the end
+            }
+        }
+        if (from < lo || to > hi || from > to) {
+            return -1;
+        }
+        for (int v = from; v <= to; v += step) {
+            *bits |= (uint64_t)1 << v;
+        }
+        if (*p == '\0') {
+            return 0;
+        }
+        if (*p++ != ',') {
+            return -1;
+        }
+    }
+}
+
+static int parse_interval(const char *text, int64_t *ms) {
+    char *unit;
+    double value = strtod(text, &unit);
+    double scale = 1000;
+
+    if (unit == text || value <= 0) {
+        return -1;
+    }
+    if (strcmp(unit, "ms") == 0) {
+        scale = 1;
+    } else if (strcmp(unit, "m") == 0) {
+        scale = 60e3;
+    } else if (strcmp(unit, "h") == 0) {
+        scale = 3600e3;
+    } else if (strcmp(unit, "d") == 0) {
+        scale = 86400e3;
+    } else if (strcmp(unit, "s") != 0 && unit[0] != '\0') {
+        return -1;
+    }
+    *ms = (int64_t)(value * scale);
+    return *ms > 0 ? 0 : -1;
+}
+
+// Split off the next whitespace-separated word of *p
+static char *next_word(char **p) {
+    while (**p == ' ' || **p == '\t') {
+        (*p)++;
+    }
+    char *word = *p;
+    while (**p != '\0' && **p != ' ' && **p != '\t') {
+        (*p)++;
+    }
+    if (**p != '\0') {
+        *(*p)++ = '\0';
+    }
+    return word;
+}
+
+static int parse_job(const char *line, struct job *job) {
+    static const char *aliases[][2] = {
+        {"@hourly", "0 * * * *"}, {"@daily", "0 0 * * *"}, {"@midnight", "0 0 * * *"},
+        {"@weekly", "0 0 * * 0"}, {"@monthly", "0 0 1 * *"}, {"@yearly", "0 0 1 1 *"},
+    };
+    char *copy = strdup(line), *p = copy;
+    char *fields[5];
+    char spec[64];
+    int ok = 0;
+
+    memset(job, 0, sizeof(*job));
+    char *first = next_word(&p);
+    if (strcmp(first, "@every") == 0) {
+        ok = parse_interval(next_word(&p), &job->interval_ms) == 0;
+    } else {
+        const char *expanded = NULL;
+        for (size_t i = 0; i < sizeof(aliases) / sizeof(aliases[0]); i++) {
+            if (strcmp(first, aliases[i][0]) == 0) {
+                expanded = aliases[i][1];
+            }
+        }
+        if (expanded != NULL) {
+            char *s;
+            strcpy(spec, expanded);
+            s = spec;
+            for (int i = 0; i < 5; i++) {
+                fields[i] = next_word(&s);
+            }
+        } else {
+            fields[0] = first;
+            for (int i = 1; i < 5; i++) {
+                fields[i] = next_word(&p);
+            }
+        }
+        uint64_t bits[5];
+        ok = parse_field(fields[0], 0, 59, &bits[0]) == 0 && parse_field(fields[1], 0, 23, &bits[1]) == 0 &&
+             parse_field(fields[2], 1, 31, &bits[2]) == 0 && parse_field(fields[3], 1, 12, &bits[3]) == 0 &&
+             parse_field(fields[4], 0, 7, &bits[4]) == 0;
+        if (ok) {
+            job->minutes = bits[0];
+            job->hours = bits[1];
+            job->days = bits[2];
+            job->months = bits[3];
+            job->weekdays = (bits[4] | bits[4] >> 7) & 0x7f; // 7 is Sunday too
+            job->days_restricted = fields[2][0] != '*';
+            job->weekdays_restricted = fields[4][0] != '*';
+        }
+    }
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (ok && *p != '\0') {
+        job->line = strdup(line);
+        job->command = strdup(p);
+    }
+    free(copy);
+    return job->command != NULL ? 0 : -1;
+}
+
+// As in cron, when both day fields are restricted either one may match
+static int day_matches(const struct job *job, const struct tm *tm) {
+    int dom = (job->days >> tm->tm_mday) & 1;
+    int dow = (job->weekdays >> tm->tm_wday) & 1;
+    if (job->days_restricted && job->weekdays_restricted) {
+        return dom || dow;
+    }
+    return dom && dow;
+}
+
+// The first fire time strictly after 'after', or -1 if there is none
+static int64_t next_fire(const struct job *job, int64_t after) {
+    if (job->interval_ms > 0) {
+        return after + job->interval_ms;
+    }
+
+    // Walk forward in local time, skipping whole months, days and hours
+    // that cannot match before trying individual minutes
+    time_t t = after / 1000 / 60 * 60 + 60;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    tm.tm_sec = 0;
+    for (int steps = 0; steps < 100000; steps++) {
+        if (!((job->months >> (tm.tm_mon + 1)) & 1)) {
+            tm.tm_mon++;
+            tm.tm_mday = 1;
+            tm.tm_hour = tm.tm_min = 0;
+        } else if (!day_matches(job, &tm)) {
+            tm.tm_mday++;
+            tm.tm_hour = tm.tm_min = 0;
+        } else if (!((job->hours >> tm.tm_hour) & 1)) {
+            tm.tm_hour++;
+            tm.tm_min = 0;
+        } else if (!((job->minutes >> tm.tm_min) & 1)) {
+            tm.tm_min++;
+        } else {
+            return (int64_t)t * 1000;
+        }
+        tm.tm_isdst = -1;
+        t = mktime(&tm); // normalises the fields we pushed past their range
+    }
+    return -1;
+}
+
+static int heap_less(int a, int b) {
+    return jobs[heap[a]].next_ms < jobs[heap[b]].next_ms;
+}
+
+static void heap_swap(int a, int b) {
+    int tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+}
+
+static void heap_push(int job) {
+    int i = heap_size++;
+    heap[i] = job;
+    while (i > 0 && heap_less(i, (i - 1) / 2)) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int heap_pop(void) {
+    int top = heap[0];
+    int i = 0;
+
+    heap[0] = heap[--heap_size];
+    for (;;) {
+        int least = i, left = 2 * i + 1, right = left + 1;
+        if (left < heap_size && heap_less(left, least)) {
+            least = left;
+        }
+        if (right < heap_size && heap_less(right, least)) {
+            least = right;
+        }
+        if (least == i) {
+            break;
+        }
+        heap_swap(i, least);
+        i = least;
+    }
+    return top;
+}
+
+// Schedule every job from 'now' on
+static void schedule_all(int64_t now) {
+    heap_size = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        jobs[i].next_ms = next_fire(&jobs[i], now);
+        if (jobs[i].next_ms >= 0) {
+            heap_push(i);
+        } else {
+            log_event("job %d never fires: %s", i + 1, jobs[i].line);
+        }
+    }
+}
+
+static void free_jobs(struct job *list, int count) {
+    for (int i = 0; i < count; i++) {
+        free(list[i].line);
+        free(list[i].command);
+    }
+    free(list);
+}
+
+/*
+ (Re)read the job file. Jobs whose line is unchanged keep their counters,
+ running instance and place in the run queue; waiting runs of jobs that
+ are gone are logged as skipped. Returns -1 if the file cannot be read,
+ leaving the current jobs in place.
+*/
+static int load_jobs(void) {
+    FILE *file = fopen(job_path, "r");
+    struct job *loaded = NULL;
+    int count = 0, capacity = 0, line_no = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    int *moved; // new index of each old job, or -1
+
+    if (file == NULL) {
+        return -1;
+    }
+    moved = malloc((num_jobs + 1) * sizeof(int));
+    if (moved == NULL) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        moved[i] = -1;
+    }
+    while (getline(&line, &line_cap, file) >= 0) {
+        struct job job;
+        line_no++;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *text = line + strspn(line, " \t");
+        if (*text == '\0' || *text == '#') {
+            continue;
+        }
+        if (parse_job(text, &job) != 0) {
+            log_event("%s:%d: bad job line: %s", job_path, line_no, text);
+            continue;
+        }
+        for (int i = 0; i < num_jobs; i++) {
+            if (jobs[i].line != NULL && strcmp(jobs[i].line, job.line) == 0) {
+                job.pid = jobs[i].pid;
+                job.started_ms = jobs[i].started_ms;
+                job.runs = jobs[i].runs;
+                job.failures = jobs[i].failures;
+                job.skips = jobs[i].skips;
+                moved[i] = count;
+                free(jobs[i].line);
+                jobs[i].line = NULL; // matched once only
+                break;
+            }
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            loaded = realloc(loaded, capacity * sizeof(struct job));
+            if (loaded == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        loaded[count++] = job;
+    }
+    free(line);
+    fclose(file);
+
+    // Queued indices refer to the old table: carry over the runs of kept jobs
+    int kept = 0;
+    for (int n = 0; n < queue_len; n++) {
+        int old = queue[(queue_head + n) % MAX_QUEUE];
+        if (moved[old] >= 0) {
+            loaded[moved[old]].queued = 1;
+            queue[(queue_head + kept++) % MAX_QUEUE] = moved[old];
+        } else {
+            log_event("skip job %d: removed from %s while waiting: %s", old + 1, job_path, jobs[old].command);
+        }
+    }
+    queue_len = kept;
+    free(moved);
+
+    free_jobs(jobs, num_jobs);
+    jobs = loaded;
+    num_jobs = count;
+    free(heap);
+    heap = malloc((count + 1) * sizeof(int));
+    running = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        running += jobs[i].pid != 0;
+    }
+    log_event("loaded %d job(s) from %s", num_jobs, job_path);
+    return 0;
+}
+
+static void start_job(int index) {
+    struct job *job = &jobs[index];
+    sigset_t none;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        setpgid(0, 0);
+        execl("/bin/sh", "sh", "-c", job->command, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) {
+        log_event("job %d: fork: %s", index + 1, strerror(errno));
+        job->failures++;
+        return;
+    }
+    job->pid = pid;
+    job->started_ms = now_ms();
+    job->runs++;
+    running++;
+    log_event("start job %d pid %d: %s", index + 1, pid, job->command);
+}
+
+// Start waiting jobs while there are free slots
+static void drain_queue(void) {
+    while (queue_len > 0 && running < max_running) {
+        int index = queue[queue_head];
+        queue_head = (queue_head + 1) % MAX_QUEUE;
+        queue_len--;
+        jobs[index].queued = 0;
+        start_job(index);
+    }
+}
+
+static void job_due(int index) {
+    struct job *job = &jobs[index];
+
+    if (job->pid != 0 || job->queued) {
+        job->skips++;
+        log_event("skip job %d: previous run still %s", index + 1, job->pid != 0 ? "running" : "waiting");
+    } else if (running < max_running) {
+        start_job(index);
+    } else if (queue_len < MAX_QUEUE) {
+        queue[(queue_head + queue_len++) % MAX_QUEUE] = index;
+        job->queued = 1;
+    } else {
+        job->skips++;
+        log_event("skip job %d: too many jobs waiting", index + 1);
+    }
+}
+
+// Fire every job that is due and push it back with its next time
+static void run_due_jobs(int64_t now) {
+    while (heap_size > 0 && jobs[heap[0]].next_ms <= now) {
+        int index = heap_pop();
+        struct job *job = &jobs[index];
+        job_due(index);
+        // Interval jobs keep their phase; a late wakeup drops missed rounds
+        job->next_ms = next_fire(job, job->interval_ms > 0 ? job->next_ms : now);
+        if (job->interval_ms > 0 && job->next_ms <= now) {
+            job->next_ms += (now - job->next_ms) / job->interval_ms * job->interval_ms + job->interval_ms;
+        }
+        if (job->next_ms >= 0) {
+            heap_push(index);
+        }
+    }
+}
+
+static void reap_jobs(void) {
+    int status;
+    pid_t pid;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        for (int i = 0; i < num_jobs; i++) {
+            if (jobs[i].pid == pid) {
+                double secs = (now_ms() - jobs[i].started_ms) / 1000.0;
+                jobs[i].pid = 0;
+                jobs[i].failures += code != 0;
+                running--;
+                log_event("exit job %d pid %d status %d after %.3fs", i + 1, pid, code, secs);
+                pid = 0;
+                break;
+            }
+        }
+        if (pid != 0) {
+            log_event("exit pid %d status %d (job removed from %s)", pid, code, job_path);
+        }
+    }
+}
+
+static void log_stats(void) {
+    for (int i = 0; i < num_jobs; i++) {
+        char when[32] = "never";
+        if (jobs[i].next_ms >= 0) {
+            time_t t = jobs[i].next_ms / 1000;
+            struct tm tm;
+            localtime_r(&t, &tm);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        log_event("job %d: runs %ld failures %ld skips %ld next %s%s: %s", i + 1, jobs[i].runs, jobs[i].failures,
+                  jobs[i].skips, when, jobs[i].pid != 0 ? " (running)" : "", jobs[i].line);
+    }
+}
+
+static void arm_timer(int timer_fd) {
+    struct itimerspec spec = {0};
+    if (heap_size > 0) {
+        int64_t due = jobs[heap[0]].next_ms;
+        spec.it_value.tv_sec = due / 1000;
+        spec.it_value.tv_nsec = due % 1000 * 1000000;
+    }
+    // Absolute realtime, and woken if the clock is set so we can reschedule
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, NULL);
+}
+
+// Same double fork as dspawn, but the jobs keep our working directory
+static void daemonize(void) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        printf("Scheduler started with %d job(s), logging to dsched.log.\n", num_jobs);
+        exit(EXIT_SUCCESS);
+    }
+    if (setsid() < 0) {
+        perror("setsid failed");
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGHUP, SIG_IGN);
+    pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid > 0) {
+        exit(EXIT_SUCCESS);
+    }
+    umask(022); // jobs create files as from a login shell, not world-writable
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    if (null_fd > STDERR_FILENO) {
+        close(null_fd);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = "dsched.jobs";
+    int foreground = 0, opt;
+    sigset_t mask;
+
+    while ((opt = getopt(argc, argv, "fj:")) != -1) {
+        if (opt == 'f') {
+            foreground = 1;
+        } else if (opt == 'j' && atoi(optarg) > 0) {
+            max_running = atoi(optarg);
+        } else {
+            fprintf(stderr, "Usage: %s [-f] [-j max_running] [jobfile]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        path = argv[optind];
+    }
+    if (realpath(path, job_path) == NULL) {
+        fprintf(stderr, "dsched: %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    log_fd = open("dsched.log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0) {
+        perror("dsched: dsched.log");
+        return EXIT_FAILURE;
+    }
+    if (load_jobs() != 0) {
+        fprintf(stderr, "dsched: %s: %s\n", job_path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (!foreground) {
+        daemonize();
+    }
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    int timer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {0};
+    ev.events = EPOLLIN;
+    ev.data.fd = signal_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    log_event("dsched started, pid %d, at most %d job(s) at once", getpid(), max_running);
+    schedule_all(now_ms());
+    arm_timer(timer_fd);
+
+    int stop = 0;
+    while (!stop) {
+        struct epoll_event events[2];
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+        if (n < 0 && errno != EINTR) {
+            log_event("epoll_wait: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == ECANCELED) {
+                    log_event("clock changed, rescheduling");
+                    schedule_all(now_ms());
+                }
+                continue;
+            }
+            struct signalfd_siginfo info;
+            while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGCHLD) {
+                    reap_jobs();
+                } else if (info.ssi_signo == SIGHUP) {
+                    if (load_jobs() != 0) {
+                        log_event("cannot reload %s: %s", job_path, strerror(errno));
+                    }
+                    schedule_all(now_ms());
+                } else if (info.ssi_signo == SIGUSR1) {
+                    log_stats();
+                } else {
+                    stop = 1;
+                }
+            }
+        }
+        run_due_jobs(now_ms());
+        drain_queue();
+        arm_timer(timer_fd);
+    }
+
+    log_event("dsched stopping, %d job(s) still running", running);
+    return EXIT_SUCCESS;
+}
@@ -7,48 +7,315 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>  
+#include <stdarg.h>
+#include <sys/file.h>
+#include <zlib.h>
+#include "dspawn_log.h"
 
 char output_file_path[PATH_MAX]; 
 
+/*
+ Several daemons append to dspawn.log at once, so every write happens under
+ an flock on dspawn.log.lock. The writer stamps each line, extends its own
+ index record (or starts a new one once the record's window would pass
+ DLOG_WINDOW bytes), and rotates the segment once it is too big or
+ too old; the rotated segment is compressed by a child process so the
+ daemon goes straight back to work. See dspawn_log.h for the layout.
+*/
+
+static long long env_limit(const char *name, long long fallback) {
+    const char *value = getenv(name);
+    return value != NULL && atoll(value) > 0 ? atoll(value) : fallback;
+}
+
+static void segment_path(char *out, size_t size, int seq, const char *suffix) {
+    if (seq > 0) {
+        snprintf(out, size, "%s.%d%s", output_file_path, seq, suffix);
+    } else {
+        snprintf(out, size, "%s%s", output_file_path, suffix);
+    }
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Deflate one gzip member of 'data' onto 'out'; returns its compressed size
+static long long write_member(FILE *out, const char *data, size_t len) {
+    unsigned char buf[65536];
+    long long written = 0;
+    z_stream z = {0};
+
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    z.next_in = (unsigned char *)data;
+    z.avail_in = len;
+    int rc;
+    do {
+        z.next_out = buf;
+        z.avail_out = sizeof(buf);
+        rc = deflate(&z, Z_FINISH);
+        size_t n = sizeof(buf) - z.avail_out;
+        if (fwrite(buf, 1, n, out) != n) {
+            rc = Z_ERRNO;
+            break;
+        }
+        written += n;
+    } while (rc == Z_OK);
+    deflateEnd(&z);
+    return rc == Z_STREAM_END ? written : -1;
+}
+
+/*
+ Compress rotated segment 'seq' into independent gzip members cut where
+ records start, and write its index with the member each record starts in. The plain
+ files are removed only once the compressed pair is complete.
+*/
+static int compress_segment(int seq) {
+    char log_path[PATH_MAX], idx_path[PATH_MAX], gz_path[PATH_MAX], gz_idx_path[PATH_MAX], tmp_path[PATH_MAX + 8];
+    char *data = NULL;
+    struct dlog_record *records = NULL;
+    struct stat st, idx_st;
+    int ok = 0;
+
+    segment_path(log_path, sizeof(log_path), seq, "");
+    segment_path(idx_path, sizeof(idx_path), seq, ".idx");
+    segment_path(gz_path, sizeof(gz_path), seq, ".gz");
+    segment_path(gz_idx_path, sizeof(gz_idx_path), seq, ".gz.idx");
+
+    int log_fd = open(log_path, O_RDONLY);
+    int idx_fd = open(idx_path, O_RDONLY);
+    if (log_fd < 0 || idx_fd < 0 || fstat(log_fd, &st) != 0 || fstat(idx_fd, &idx_st) != 0) {
+        goto done;
+    }
+    size_t num_records = idx_st.st_size / sizeof(struct dlog_record);
+    data = malloc(st.st_size + 1);
+    records = malloc(num_records * sizeof(struct dlog_record) + 1);
+    if (data == NULL || records == NULL || pread(log_fd, data, st.st_size, 0) != st.st_size ||
+        pread(idx_fd, records, num_records * sizeof(struct dlog_record), 0) !=
+            (ssize_t)(num_records * sizeof(struct dlog_record))) {
+        goto done;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", gz_path);
+    int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (out == NULL) {
+        goto done;
+    }
+    uint64_t member_start = 0, compressed = 0;
+    size_t first = 0; // first record starting in the member being built
+    ok = 1;
+    for (size_t i = 0; i <= num_records && ok; i++) {
+        uint64_t end = i < num_records ? records[i].offset : (uint64_t)st.st_size;
+        if (i < num_records && end - member_start < DLOG_MEMBER_SIZE) {
+            continue; // keep adding to this member
+        }
+        if (i == num_records || end > member_start) {
+            long long n = write_member(out, data + member_start, end - member_start);
+            ok = n >= 0;
+            for (; first < i; first++) {
+                records[first].member_offset = compressed;
+                records[first].member_start = member_start;
+            }
+            compressed += n;
+            member_start = end;
+        }
+    }
+    ok = fclose(out) == 0 && ok;
+    if (ok) {
+        int fd = open(gz_idx_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = fd >= 0 && write_all(fd, records, num_records * sizeof(struct dlog_record)) == 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    // The .gz appears last, so a reader never sees it without its index
+    if (ok && rename(tmp_path, gz_path) == 0) {
+        unlink(log_path);
+        unlink(idx_path);
+    } else {
+        unlink(tmp_path);
+        unlink(gz_idx_path);
+        ok = 0;
+    }
+
+done:
+    if (log_fd >= 0) {
+        close(log_fd);
+    }
+    if (idx_fd >= 0) {
+        close(idx_fd);
+    }
+    free(data);
+    free(records);
+    return ok ? 0 : -1;
+}
+
+// Next free segment number: one past the highest dspawn.log.N[.gz]
+static int next_segment(void) {
+    char dir_path[PATH_MAX];
+    const char *base = strrchr(output_file_path, '/') + 1;
+    size_t base_len = strlen(base);
+    int highest = 0;
+
+    snprintf(dir_path, sizeof(dir_path), "%.*s", (int)(base - output_file_path), output_file_path);
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return 1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, base, base_len) == 0 && entry->d_name[base_len] == '.' &&
+            isdigit((unsigned char)entry->d_name[base_len + 1])) {
+            int seq = atoi(entry->d_name + base_len + 1);
+            highest = seq > highest ? seq : highest;
+        }
+    }
+    closedir(dir);
+    return highest + 1;
+}
+
+// Called with the lock held
+static void rotate_if_needed(int log_fd, int idx_fd, int64_t now_ms) {
+    struct stat st;
+    struct dlog_record first;
+
+    if (fstat(log_fd, &st) != 0) {
+        return;
+    }
+    int too_big = st.st_size >= env_limit("DSPAWN_LOG_MAX", 8 << 20);
+    int too_old = pread(idx_fd, &first, sizeof(first), 0) == sizeof(first) &&
+                  now_ms - first.first_ms >= env_limit("DSPAWN_LOG_AGE", 86400) * 1000;
+    if (!too_big && !too_old) {
+        return;
+    }
+
+    char path[PATH_MAX], idx_path[PATH_MAX], rotated[PATH_MAX], rotated_idx[PATH_MAX];
+    int seq = next_segment();
+    segment_path(path, sizeof(path), 0, "");
+    segment_path(idx_path, sizeof(idx_path), 0, ".idx");
+    segment_path(rotated, sizeof(rotated), seq, "");
+    segment_path(rotated_idx, sizeof(rotated_idx), seq, ".idx");
+    if (rename(path, rotated) != 0) {
+        return;
+    }
+    rename(idx_path, rotated_idx);
+
+    // SIGCHLD is ignored, so the compressor is reaped automatically
+    if (fork() == 0) {
+        _exit(compress_segment(seq) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+}
+
+// Append one stamped line to the log and index it
+static int log_line(const char *fmt, ...) {
+    char lock_path[PATH_MAX], idx_path[PATH_MAX], line[2048];
+    struct timespec ts;
+    struct tm tm;
+    va_list ap;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    localtime_r(&ts.tv_sec, &tm);
+    size_t len = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &tm);
+    len += snprintf(line + len, sizeof(line) - len, ".%03ld %d ", ts.tv_nsec / 1000000, getpid());
+    va_start(ap, fmt);
+    vsnprintf(line + len, sizeof(line) - len - 1, fmt, ap);
+    va_end(ap);
+    len = strlen(line);
+    line[len++] = '\n';
+    int64_t now_ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    segment_path(lock_path, sizeof(lock_path), 0, ".lock");
+    segment_path(idx_path, sizeof(idx_path), 0, ".idx");
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) {
+        perror("dspawn.log.lock");
+        if (lock_fd >= 0) {
+            close(lock_fd);
+        }
+        return -1;
+    }
+    int log_fd = open(output_file_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    int idx_fd = open(idx_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    int rc = -1;
+    struct stat st, idx_st;
+    if (log_fd >= 0 && idx_fd >= 0 && fstat(log_fd, &st) == 0 && fstat(idx_fd, &idx_st) == 0 &&
+        write_all(log_fd, line, len) == 0) {
+        // Our record from the last write, while it is in this index and the
+        // window it covers (other daemons' lines included) stays small
+        static struct dlog_record record;
+        static off_t record_at = -1;
+        static ino_t record_ino;
+        struct dlog_record stored;
+        uint64_t end = st.st_size + len;
+        if (record_at >= 0 && record_ino == idx_st.st_ino && end - record.offset <= DLOG_WINDOW &&
+            pread(idx_fd, &stored, sizeof(stored), record_at) == sizeof(stored) && stored.pid == record.pid &&
+            stored.offset == record.offset && stored.first_ms == record.first_ms) {
+            record.len = end - record.offset;
+            record.last_ms = now_ms;
+        } else {
+            record_at = idx_st.st_size - idx_st.st_size % sizeof(record);
+            record_ino = idx_st.st_ino;
+            record.pid = getpid();
+            record.len = len;
+            record.first_ms = record.last_ms = now_ms;
+            record.offset = st.st_size;
+            record.member_offset = DLOG_NOT_COMPRESSED;
+            record.member_start = 0;
+        }
+        if (pwrite(idx_fd, &record, sizeof(record), record_at) == sizeof(record)) {
+            rc = 0;
+        }
+        rotate_if_needed(log_fd, idx_fd, now_ms);
+    }
+    if (log_fd >= 0) {
+        close(log_fd);
+    }
+    if (idx_fd >= 0) {
+        close(idx_fd);
+    }
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    return rc;
+}
+
 // Daemon work function
 static int daemon_work() {
     int num = 0;
-    FILE *fptr;
     char *cwd;
     char buffer[1024];
 
     // write PID of daemon in the beginning
-    fptr = fopen(output_file_path, "a");
-    if (fptr == NULL) {
-        perror("fopen() error");
+    if (log_line("Daemon process running with PID: %d, PPID: %d", getpid(), getppid()) != 0) {
         return EXIT_FAILURE;
     }
 
-    fprintf(fptr, "Daemon process running with PID: %d, PPID: %d, opening logfile with FD %d\n", getpid(), getppid(), fileno(fptr));
-
     // then write cwd
     cwd = getcwd(buffer, sizeof(buffer));
     if (cwd == NULL) {
         perror("getcwd() error");
-        fclose(fptr);
         return EXIT_FAILURE;
     }
 
-    fprintf(fptr, "Current working directory: %s\n", cwd);
-    fclose(fptr);
+    log_line("Current working directory: %s", cwd);
 
     while (num < 10) {
-        fptr = fopen(output_file_path, "a");
-        if (fptr == NULL) {
-            perror("fopen() error");
+        if (log_line("PID %d Daemon writing line %d to the file.", getpid(), num) != 0) {
             return EXIT_FAILURE;
         }
-
-        fprintf(fptr, "PID %d Daemon writing line %d to the file.\n", getpid(), num);
         num++;
 
-        fclose(fptr);
-
         sleep(10);
     }
 
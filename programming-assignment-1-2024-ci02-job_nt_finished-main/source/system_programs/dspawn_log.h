@@ -0,0 +1,39 @@
+#ifndef DSPAWN_LOG_H
+#define DSPAWN_LOG_H
+
+#include <stdint.h>
+
+/*
+ On-disk layout of dspawn.log, shared by dspawn (the writer) and dlog.
+
+ Every line starts with "YYYY-MM-DD HH:MM:SS.mmm PID ". The live segment
+ is dspawn.log; once it passes DSPAWN_LOG_MAX bytes (default 8 MiB) or
+ DSPAWN_LOG_AGE seconds (default a day) it is renamed to dspawn.log.N and
+ compressed in the background to dspawn.log.N.gz.
+
+ Each segment has a sidecar index (dspawn.log.idx, dspawn.log.N.idx,
+ dspawn.log.N.gz.idx) of fixed-size records. A record says that one pid
+ wrote lines between two times within a window of the segment; windows of
+ different pids overlap where daemons interleave, but each daemon needs a
+ record only every DLOG_WINDOW bytes, so the index stays small. A query
+ reads the index and then only the windows it needs. A compressed segment
+ is a series of independent gzip members of about DLOG_MEMBER_SIZE bytes,
+ and each record names the member its window starts in, so a window is
+ found by inflating one member (or the next few, if it runs past the end).
+*/
+
+#define DLOG_WINDOW (64 * 1024)        // bytes of log one record may span
+#define DLOG_MEMBER_SIZE (256 * 1024)  // uncompressed bytes per gzip member
+#define DLOG_NOT_COMPRESSED UINT64_MAX
+
+struct dlog_record {
+    uint32_t pid;
+    uint32_t len;           // bytes in the window, from the pid's first line to the end of its last
+    int64_t first_ms;       // time of the pid's first and last line in it
+    int64_t last_ms;
+    uint64_t offset;        // of the window in the uncompressed segment
+    uint64_t member_offset; // compressed offset of the gzip member it starts in, or DLOG_NOT_COMPRESSED
+    uint64_t member_start;  // uncompressed offset where that member begins
+};
+
+#endif
@@ -1,99 +1,97 @@
+#define _GNU_SOURCE
 #include "system_program.h"
+#include "walk.h"
 /*
- List all files matching the name in args[1] under current directory and subdirectories
+ List all files matching the name in the keyword under current directory and subdirectories
+
+ Options:
+  -L    follow symbolic links to directories (loops are reported, not entered)
+  -x    stay on the filesystem of the current directory
+  -j N  read directories with N threads (0 for one per CPU); matches are printed in no particular order
+  --pin with -j, pin the threads to NUMA nodes in turn
+
+ find --contains [options] text [dir] searches file contents instead, by
+ running search with the same arguments.
 */
-int execute(char **args)
-{
 
-    if (args[1] == NULL)
+// Print the path of the file or directory if its name matches the keyword
+int print_match(const struct walk_entry *entry, void *to_match)
+{
+    if (strstr(entry->name, to_match) != NULL)
     {
-        printf("Usage: find [keyword], to find any matching filename in this directory or its children\n");
-        return 1;
+        printf("%s\n", entry->path);
     }
+    return WALK_CONTINUE;
+}
 
-    char *dir_name = args[0];
-    char *to_match = args[1];
-    char local_dir_name[SHELL_BUFFERSIZE];
+// Run search, which sits beside this program, for find --contains
+int exec_search(char **args)
+{
+    char search_path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", search_path, sizeof(search_path) - sizeof("search"));
+    char *slash = len > 0 ? memrchr(search_path, '/', len) : NULL;
 
-    DIR *d;
-    /* Open the directory specified by "dir_name". */
-    if (strcmp(dir_name, "find") == 0)
+    args[0] = "search";
+    if (slash != NULL)
     {
-        d = opendir(".");
-        // getcwd(local_dir_name, SHELL_BUFFERSIZE);
-        sprintf(local_dir_name, ".");
-        dir_name = local_dir_name;
-    }
-    else
-    {
-        d = opendir(dir_name);
+        strcpy(slash + 1, "search");
+        execv(search_path, args);
     }
+    // otherwise ./bin, as when called from the shell's directory
+    execv("./bin/search", args);
+    perror("find: cannot run search");
+    return 2;
+}
 
-    /* Check it was opened. */
-    if (!d)
+int execute(char **args)
+{
+    struct walk_options options = {0};
+    int i = 1;
+
+    if (args[1] != NULL && strcmp(args[1], "--contains") == 0)
     {
-        fprintf(stderr, "Cannot open directory '%s': %s\n",
-                dir_name, strerror(errno));
-        return 1;
+        return exec_search(args + 1);
     }
 
-    while (1)
+    for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
     {
-        struct dirent *entry;
-        const char *d_name;
-
-        /* "Readdir" gets subsequent entries from "d". */
-        entry = readdir(d);
-        if (!entry)
+        if (strcmp(args[i], "-L") == 0)
         {
-            /* There are no more entries in this directory, so break
-               out of the while loop. */
-            break;
+            options.symlinks = WALK_SYMLINKS_FOLLOW;
         }
-        d_name = entry->d_name;
-
-        /* Print the name of the file and directory if it matches the keyword */
-        if (strstr(d_name, to_match) != NULL)
+        else if (strcmp(args[i], "-x") == 0)
         {
-            printf("%s/%s\n", dir_name, d_name);
+            options.one_filesystem = 1;
         }
-
-        if (entry->d_type & DT_DIR)
+        else if (strcmp(args[i], "-j") == 0 && args[i + 1] != NULL && atoi(args[i + 1]) >= 0)
         {
-
-            /* Check that the directory is not "d" or d's parent. */
-            if (strcmp(d_name, "..") != 0 &&
-                strcmp(d_name, ".") != 0)
+            options.threads = atoi(args[++i]);
+            if (options.threads == 0)
             {
-                int path_length;
-                char path[PATH_MAX];
-
-                path_length = snprintf(path, 1024,
-                                       "%s/%s", dir_name, d_name);
-
-                if (path_length >= PATH_MAX)
-                {
-                    fprintf(stderr, "Path length has got too long.\n");
-                    exit(EXIT_FAILURE);
-                }
-                /* Recursively call "list_dir" with the new path. */
-                args[0] = path;
-                execute(args);
+                options.threads = WALK_THREADS_AUTO;
             }
         }
+        else if (strcmp(args[i], "--pin") == 0)
+        {
+            options.pin_workers = 1;
+        }
+        else
+        {
+            break;
+        }
     }
 
-    /* After going through all the entries, close the directory. */
-    if (closedir(d))
+    if (args[i] == NULL)
     {
-        fprintf(stderr, "Could not close '%s': %s\n",
-                dir_name, strerror(errno));
+        printf("Usage: find [-L] [-x] [-j N] [--pin] [keyword], to find any matching filename in this directory or its children, or find --contains [text] to search file contents\n");
+        return 1;
     }
 
-    return EXIT_SUCCESS;
+    int result = walk(".", &options, print_match, args[i]);
+    return result < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main(int argc, char **args)
 {
     return execute(args);
-}
\ No newline at end of file
+}
@@ -1,4 +1,73 @@
+#define _GNU_SOURCE // statx
 #include "system_program.h"
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/*
+    ld [-1 | -l] [-S | -t | -U]
+    ld -r
+
+    Lists the current directory, sorted by name. -1 prints names only,
+    -l adds owner, size and modification time. -S sorts by size and -t by
+    modification time (largest/newest first), and -U keeps directory order,
+    streaming entries out as they are read in constant memory. -r lists
+    subdirectories recursively (see ldr).
+
+    The directory is read with getdents64 in large batches, and metadata
+    comes from statx() on the directory fd asking only for the fields that
+    are shown or sorted on, so -1 never stats at all. Sorting is bounded by
+    LD_SORT_MEM bytes (default 64 MiB): larger listings are sorted in runs
+    that spill to temporary files and are merged on output. At most 64 runs
+    (fewer under a low RLIMIT_NOFILE) are kept; more are merged into one
+    first.
+*/
+
+#define MAX_MERGE_RUNS 64 // spill files open at once, fewer under a low RLIMIT_NOFILE
+
+#define SORT_NAME 0
+#define SORT_SIZE 1
+#define SORT_TIME 2
+#define SORT_NONE 3
+
+#define FORMAT_DEFAULT 0 // permissions and name
+#define FORMAT_NAMES 1   // -1
+#define FORMAT_LONG 2    // -l
+
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One listed entry; the name follows the fixed part
+struct entry
+{
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t name_len; // including the terminating NUL
+    char name[];
+};
+
+struct run_reader
+{
+    FILE *file;             // spill file, or NULL for the run still in memory
+    struct entry **entries; // the in-memory run
+    size_t next, count;
+    struct entry *current;  // NULL once the run is exhausted
+    struct entry *buffer;   // holds the current entry of a spill file
+    size_t capacity;
+};
+
+static int sort_key = SORT_NAME;
+static int format = FORMAT_DEFAULT;
+static int use_color = 0;
 
 // Function to convert permissions to a string
 void perms_to_string(mode_t mode, char str[11])
@@ -32,72 +101,416 @@ void perms_to_string(mode_t mode, char str[11])
         str[9] = 'x'; // Others have execute permission
 }
 
+static size_t entry_size(const struct entry *e)
+{
+    // Keep entries 8-byte aligned when packed back to back
+    return (sizeof(struct entry) + e->name_len + 7) & ~(size_t)7;
+}
+
+static int compare_entries(const struct entry *a, const struct entry *b)
+{
+    if (sort_key == SORT_SIZE && a->size != b->size)
+        return a->size > b->size ? -1 : 1;
+    if (sort_key == SORT_TIME && (a->mtime_sec != b->mtime_sec || a->mtime_nsec != b->mtime_nsec))
+        return a->mtime_sec > b->mtime_sec || (a->mtime_sec == b->mtime_sec && a->mtime_nsec > b->mtime_nsec) ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+static int compare_entry_ptrs(const void *a, const void *b)
+{
+    return compare_entries(*(struct entry *const *)a, *(struct entry *const *)b);
+}
+
+// Owner name for a uid, remembering the few a directory usually has
+static const char *owner_name(uid_t uid)
+{
+    static struct
+    {
+        uid_t uid;
+        char name[32];
+    } cache[16];
+    static int cached = 0, next_slot = 0;
+
+    for (int i = 0; i < cached; i++)
+    {
+        if (cache[i].uid == uid)
+            return cache[i].name;
+    }
+    int slot = cached < 16 ? cached++ : next_slot++ % 16;
+    struct passwd *pw = getpwuid(uid);
+    cache[slot].uid = uid;
+    if (pw != NULL)
+        snprintf(cache[slot].name, sizeof(cache[slot].name), "%s", pw->pw_name);
+    else
+        snprintf(cache[slot].name, sizeof(cache[slot].name), "%u", (unsigned)uid);
+    return cache[slot].name;
+}
+
+// "Oct 19 07:20" for the last six months, "Oct 19  2025" otherwise, as ls does
+static const char *format_time(int64_t sec)
+{
+    static char text[32];
+    static int64_t cached_minute = INT64_MIN;
+    static time_t now = 0;
+
+    if (now == 0)
+        now = time(NULL);
+    if (sec / 60 != cached_minute)
+    {
+        time_t t = sec;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        int recent = sec <= now && now - sec < 183L * 24 * 3600;
+        strftime(text, sizeof(text), recent ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+        cached_minute = sec / 60;
+    }
+    return text;
+}
+
+static void print_entry(const struct entry *e)
+{
+    char permissions[11];
+
+    if (format == FORMAT_NAMES)
+    {
+        fputs(e->name, stdout);
+        putchar('\n');
+        return;
+    }
+    perms_to_string(e->mode, permissions);
+    if (format == FORMAT_LONG)
+    {
+        printf("%s%s %-8s %10llu %s %s%s%s\n", use_color ? COLOR_RED : "", permissions, owner_name(e->uid),
+               (unsigned long long)e->size, format_time(e->mtime_sec), use_color ? COLOR_GREEN : "", e->name,
+               use_color ? COLOR_RESET : "");
+    }
+    else if (use_color)
+    {
+        printf(COLOR_RED "%s " COLOR_GREEN "%s\n" COLOR_RESET, permissions, e->name);
+    }
+    else
+    {
+        printf("%s %s\n", permissions, e->name);
+    }
+}
+
+static FILE *new_run_file(void)
+{
+    FILE *file = tmpfile();
+    if (file == NULL)
+    {
+        perror("ld: tmpfile");
+        exit(EXIT_FAILURE);
+    }
+    return file;
+}
+
+static void write_entry(const struct entry *e, FILE *file)
+{
+    if (fwrite(e, entry_size(e), 1, file) != 1)
+    {
+        perror("ld: writing sort run");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Write a sorted run to a temporary file
+static FILE *spill_run(struct entry **entries, size_t count)
+{
+    FILE *file = new_run_file();
+    for (size_t i = 0; i < count; i++)
+        write_entry(entries[i], file);
+    rewind(file);
+    return file;
+}
+
+// Advance a run to its next entry; returns 0 once it is exhausted
+static int run_advance(struct run_reader *run)
+{
+    if (run->file == NULL)
+    {
+        run->current = run->next < run->count ? run->entries[run->next++] : NULL;
+        return run->current != NULL;
+    }
+
+    struct entry head;
+    if (fread(&head, sizeof(head), 1, run->file) != 1)
+    {
+        run->current = NULL;
+        return 0;
+    }
+    size_t size = entry_size(&head);
+    if (size > run->capacity)
+    {
+        run->capacity = size * 2;
+        run->buffer = realloc(run->buffer, run->capacity);
+    }
+    memcpy(run->buffer, &head, sizeof(head));
+    if (fread((char *)run->buffer + sizeof(head), size - sizeof(head), 1, run->file) != 1)
+    {
+        run->current = NULL;
+        return 0;
+    }
+    run->current = run->buffer;
+    return 1;
+}
+
+// Restore the min-heap of runs (ordered by their current entry) below 'i'
+static void sift_down(const struct run_reader *runs, int *heap, int heap_size, int i)
+{
+    for (;;)
+    {
+        int least = i, left = 2 * i + 1, right = left + 1;
+        if (left < heap_size && compare_entries(runs[heap[left]].current, runs[heap[least]].current) < 0)
+            least = left;
+        if (right < heap_size && compare_entries(runs[heap[right]].current, runs[heap[least]].current) < 0)
+            least = right;
+        if (least == i)
+            return;
+        int tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+/*
+    Merge the spilled runs and the run still in memory (count may be 0),
+    printing the entries, or writing them to 'out' as one run when it is
+    not NULL. The spills are closed.
+*/
+static void merge_runs(FILE **spills, int num_spills, struct entry **entries, size_t count, FILE *out)
+{
+    int num_runs = num_spills + 1;
+    struct run_reader *runs = calloc(num_runs, sizeof(struct run_reader));
+    int *heap = malloc(num_runs * sizeof(int));
+    int heap_size = 0;
+
+    for (int i = 0; i < num_runs; i++)
+    {
+        if (i < num_spills)
+            runs[i].file = spills[i];
+        else
+        {
+            runs[i].entries = entries;
+            runs[i].count = count;
+        }
+        if (run_advance(&runs[i]))
+            heap[heap_size++] = i;
+    }
+
+    for (int start = heap_size / 2 - 1; start >= 0; start--)
+        sift_down(runs, heap, heap_size, start);
+    while (heap_size > 0)
+    {
+        struct run_reader *top = &runs[heap[0]];
+        if (out != NULL)
+            write_entry(top->current, out);
+        else
+            print_entry(top->current);
+        if (!run_advance(top))
+            heap[0] = heap[--heap_size];
+        sift_down(runs, heap, heap_size, 0);
+    }
+
+    for (int i = 0; i < num_spills; i++)
+    {
+        free(runs[i].buffer);
+        fclose(spills[i]);
+    }
+    free(runs);
+    free(heap);
+}
+
 /*
     List the items in the directory
 */
-int execute(char **args)
+static int list_directory(void)
 {
-    if (args[1] != NULL)
+    unsigned int mask = 0;
+    if (format != FORMAT_NAMES)
+        mask |= STATX_TYPE | STATX_MODE;
+    if (format == FORMAT_LONG)
+        mask |= STATX_SIZE | STATX_MTIME | STATX_UID;
+    if (sort_key == SORT_SIZE)
+        mask |= STATX_SIZE;
+    if (sort_key == SORT_TIME)
+        mask |= STATX_MTIME;
+
+    const char *budget_env = getenv("LD_SORT_MEM");
+    size_t budget = budget_env != NULL && atoll(budget_env) > 0 ? (size_t)atoll(budget_env) : 64 << 20;
+    if (budget < 64 * 1024)
+        budget = 64 * 1024;
+
+    int dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0)
     {
-        char *token = strtok(args[1], SHELL_OPT_DELIM);
-        // printf("Token is %s\n", token);
+        printf("Directory doesn't exist. \n");
+        return EXIT_SUCCESS;
+    }
+
+    // Entries are packed into an arena; the pointer array is counted against
+    // the same budget
+    size_t arena_size = budget / 2, arena_used = 0;
+    char *arena = sort_key != SORT_NONE ? malloc(arena_size) : NULL;
+    size_t ptr_capacity = budget / 2 / sizeof(struct entry *), count = 0;
 
-        if (token != NULL)
+    // Runs merged at once, so the spill files stay well under RLIMIT_NOFILE
+    int max_spills = MAX_MERGE_RUNS;
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY &&
+        (rlim_t)max_spills > nofile.rlim_cur / 2)
+        max_spills = nofile.rlim_cur / 2 > 2 ? nofile.rlim_cur / 2 : 2;
+    struct entry **entries = sort_key != SORT_NONE ? malloc(ptr_capacity * sizeof(struct entry *)) : NULL;
+    FILE **spills = NULL;
+    int num_spills = 0;
+    char *scratch = malloc(sizeof(struct entry) + 256 + 8);
+
+    static char buf[1 << 16];
+    long n;
+    while ((n = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf))) > 0)
+    {
+        for (long off = 0; off < n;)
         {
-            if (strcmp(token, "r") == 0)
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+
+            // Skip dotfiles
+            if (d->d_name[0] == '.')
+                continue;
+
+            struct statx stx = {0};
+            if (mask != 0 && statx(dir_fd, d->d_name, AT_STATX_DONT_SYNC, mask, &stx) != 0)
             {
-                // call listdirall,
-                // execvp still need the ./bin because this was called
-                // by a process that was at the .. directory
-                if (execvp("./bin/ldr", args) == -1)
-                {
-                    perror("Failed to execute, command is invalid.");
-                }
-                return 1;
+                perror("stat failed");
+                continue;
             }
-            else
+
+            size_t name_len = strlen(d->d_name) + 1;
+            struct entry *e = (struct entry *)scratch;
+            if (sort_key != SORT_NONE)
             {
-                printf("Invalid option. Use -r to display all files within the current directory and its subdirectories.\n");
-                return EXIT_SUCCESS;
+                size_t size = (sizeof(struct entry) + name_len + 7) & ~(size_t)7;
+                if (arena_used + size > arena_size || count == ptr_capacity)
+                {
+                    // Budget reached: sort this run and spill it
+                    qsort(entries, count, sizeof(struct entry *), compare_entry_ptrs);
+                    if (num_spills == max_spills)
+                    {
+                        // Too many runs to keep open: merge them into one first
+                        FILE *merged = new_run_file();
+                        merge_runs(spills, num_spills, NULL, 0, merged);
+                        rewind(merged);
+                        spills[0] = merged;
+                        num_spills = 1;
+                    }
+                    spills = realloc(spills, (num_spills + 1) * sizeof(FILE *));
+                    spills[num_spills++] = spill_run(entries, count);
+                    arena_used = 0;
+                    count = 0;
+                }
+                e = (struct entry *)(arena + arena_used);
+                arena_used += size;
+                entries[count++] = e;
             }
+            e->size = stx.stx_size;
+            e->mtime_sec = stx.stx_mtime.tv_sec;
+            e->mtime_nsec = stx.stx_mtime.tv_nsec;
+            e->mode = stx.stx_mode;
+            e->uid = stx.stx_uid;
+            e->name_len = name_len;
+            memcpy(e->name, d->d_name, name_len);
+
+            if (sort_key == SORT_NONE)
+                print_entry(e);
         }
     }
+    if (n < 0)
+        perror("ld: getdents64");
+    close(dir_fd);
 
-    // print out all the contents of the directory using opendir() function
-    DIR *d;
-    struct dirent *dir;
-    struct stat st;
-    char permissions[11];
-    d = opendir(".");
-    if (d)
+    if (sort_key != SORT_NONE)
     {
-        while ((dir = readdir(d)) != NULL)
+        qsort(entries, count, sizeof(struct entry *), compare_entry_ptrs);
+        if (num_spills == 0)
         {
-            // Skip dotfiles
-            if (dir->d_name[0] != '.')
+            for (size_t i = 0; i < count; i++)
+                print_entry(entries[i]);
+        }
+        else
+        {
+            merge_runs(spills, num_spills, entries, count, NULL);
+        }
+    }
+
+    free(arena);
+    free(entries);
+    free(spills);
+    free(scratch);
+    return EXIT_SUCCESS;
+}
+
+int execute(char **args)
+{
+    int argc = 0;
+    while (args[argc] != NULL)
+        argc++;
+
+    for (int i = 1; i < argc && args[i][0] == '-'; i++)
+    {
+        for (const char *opt = args[i] + 1; *opt != '\0'; opt++)
+        {
+            switch (*opt)
             {
-                if (stat(dir->d_name, &st) == 0)
+            case 'r':
+            {
+                // call listdirall, which sits beside this program
+                char ldr_path[PATH_MAX];
+                ssize_t len = readlink("/proc/self/exe", ldr_path, sizeof(ldr_path) - sizeof("ldr"));
+                char *slash = len > 0 ? memrchr(ldr_path, '/', len) : NULL;
+                if (slash != NULL)
                 {
-                    perms_to_string(st.st_mode, permissions);
-                    printf(COLOR_RED "%s " COLOR_GREEN "%s\n" COLOR_RESET, permissions, dir->d_name);
+                    strcpy(slash + 1, "ldr");
+                    execv(ldr_path, args);
                 }
-                else
+                // otherwise ./bin, as when called from the shell's directory
+                if (execvp("./bin/ldr", args) == -1)
                 {
-                    perror("stat failed");
+                    perror("Failed to execute, command is invalid.");
                 }
+                return 1;
+            }
+            case '1':
+                format = FORMAT_NAMES;
+                break;
+            case 'l':
+                format = FORMAT_LONG;
+                break;
+            case 'S':
+                sort_key = SORT_SIZE;
+                break;
+            case 't':
+                sort_key = SORT_TIME;
+                break;
+            case 'U':
+                sort_key = SORT_NONE;
+                break;
+            default:
+                printf("Invalid option. Use -1 for names only, -l for the long format, -S or -t to sort by size or time, -U for directory order, or -r to display all files within the current directory and its subdirectories.\n");
+                return EXIT_FAILURE;
             }
         }
-        closedir(d);
-    }
-    else
-    {
-        printf("Directory doesn't exist. \n");
     }
 
-    return EXIT_SUCCESS;
+    use_color = isatty(STDOUT_FILENO);
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    int status = list_directory();
+    fflush(stdout);
+    return status;
 }
 
 int main(int argc, char **args)
 {
     return execute(args);
-}
\ No newline at end of file
+}
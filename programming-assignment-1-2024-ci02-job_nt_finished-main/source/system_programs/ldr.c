@@ -1,4 +1,5 @@
 #include "system_program.h"
+#include "walk.h"
 
 void perms_to_string(mode_t mode, char str[11])
 {
@@ -47,49 +48,33 @@ void print_path_with_colored_slash(const char *path)
     }
 }
 
-void list_directory(const char *basePath)
+// Print one visible entry with its permissions; links are followed, as with stat
+int list_entry(const struct walk_entry *entry, void *arg)
 {
-    char path[1000];
-    struct dirent *dp;
-    DIR *dir = opendir(basePath);
-    if (!dir)
-        return; // Unable to open directory
+    char permissions[11] = {0};
 
-    while ((dp = readdir(dir)) != NULL)
-    {
-        if (strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0)
-        {
-            // Construct new path
-            snprintf(path, sizeof(path), "%s/%s", basePath, dp->d_name);
+    if (S_ISLNK(entry->st->st_mode))
+        return WALK_CONTINUE; // dangling link
 
-            // Skip dotfiles
-            if (dp->d_name[0] != '.')
-            {
-                struct stat st;
-                char permissions[11] = {0};
-                if (stat(path, &st) == 0)
-                {
-                    perms_to_string(st.st_mode, permissions);
-                    printf(COLOR_RED "%s " COLOR_RESET, permissions);
-                    print_path_with_colored_slash(path);
-                    printf("\n");
-                }
-
-                // Recursively list directories
-                if (S_ISDIR(st.st_mode))
-                {
-                    list_directory(path);
-                }
-            }
-        }
-    }
-    closedir(dir);
+    perms_to_string(entry->st->st_mode, permissions);
+    printf(COLOR_RED "%s " COLOR_RESET, permissions);
+    print_path_with_colored_slash(entry->path);
+    printf("\n");
+    return WALK_CONTINUE;
 }
 
 int main()
 {
+    struct walk_options options = {0};
+
+    // Skip dotfiles; symlinked directories are entered, and loops reported
+    options.skip_hidden = 1;
+    options.symlinks = WALK_SYMLINKS_FOLLOW;
+    options.want_stat = 1;
+
     // printf("Recursively listing all visible files under the current directory with permissions:\n");
-    list_directory(".");
+    if (walk(".", &options, list_entry, NULL) < 0)
+        return EXIT_FAILURE;
 
     return EXIT_SUCCESS;
 }
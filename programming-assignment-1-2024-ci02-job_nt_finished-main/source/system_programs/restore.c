@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include "system_program.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <zlib.h>
+#include "backup_index.h"
+#include "topology.h"
+
+/*
+ restore - get files back from a backup archive
+
+   restore [-c] [-f] archive path...
+   restore --verify [-j N] archive
+
+ Each path is looked up in the archive's index (see backup_index.h) and
+ only that member is read and inflated. A path naming a directory
+ restores everything under it. Files are written under the current
+ directory at their archived path, which must not exist unless -f is
+ given; -c writes their contents to stdout instead. The CRC-32 of what was
+ written is checked against the archive's.
+
+ --verify inflates every member and checks its size and CRC-32, with N
+ threads (one per CPU by default), and prints the members that fail.
+ The exit status is 0 when everything restored or verified.
+*/
+
+#define CHUNK_SIZE (64 * 1024)
+
+static const char *archive_path;
+static int archive_fd;
+static struct backup_index index_;
+
+// Write all of buf to fd (unless fd is -1, as when verifying)
+static int write_out(int fd, const unsigned char *buf, size_t size) {
+    while (fd >= 0 && size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/*
+ Inflate record i to out_fd (-1 to discard) and check its size and CRC-32.
+ Returns NULL on success or a description of the failure.
+*/
+static const char *extract(size_t i, int out_fd) {
+    const struct backup_index_record *record = &index_.records[i];
+    unsigned char *in = malloc(CHUNK_SIZE), *out = malloc(CHUNK_SIZE);
+    uint64_t offset, left = record->compressed_size, size = 0;
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const char *error = NULL;
+    z_stream stream = {0};
+    int z = Z_OK;
+
+    if (in == NULL || out == NULL) {
+        error = "out of memory";
+    } else if (record->method != BACKUP_STORED && record->method != BACKUP_DEFLATED) {
+        error = "unsupported compression method";
+    } else if (backup_index_data_offset(archive_fd, &index_, i, &offset) != 0) {
+        error = "local header does not match the index";
+    } else if (record->method == BACKUP_DEFLATED && inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        error = "cannot start inflating";
+    }
+
+    while (error == NULL && left > 0 && z != Z_STREAM_END) {
+        ssize_t n = pread(archive_fd, in, left < CHUNK_SIZE ? left : CHUNK_SIZE, offset);
+        if (n <= 0) {
+            error = n < 0 ? "cannot read the archive" : "archive is truncated";
+            break;
+        }
+        offset += n;
+        left -= n;
+        if (record->method == BACKUP_STORED) {
+            crc = crc32(crc, in, n);
+            size += n;
+            error = write_out(out_fd, in, n) == 0 ? NULL : strerror(errno);
+            continue;
+        }
+        stream.next_in = in;
+        stream.avail_in = n;
+        do {
+            stream.next_out = out;
+            stream.avail_out = CHUNK_SIZE;
+            z = inflate(&stream, Z_NO_FLUSH);
+            if (z != Z_OK && z != Z_STREAM_END && z != Z_BUF_ERROR) {
+                error = "corrupt compressed data";
+                break;
+            }
+            size_t produced = CHUNK_SIZE - stream.avail_out;
+            crc = crc32(crc, out, produced);
+            size += produced;
+            if (write_out(out_fd, out, produced) != 0) {
+                error = strerror(errno);
+            }
+        } while (error == NULL && stream.avail_out == 0 && z != Z_STREAM_END);
+    }
+    if (record->method == BACKUP_DEFLATED) {
+        inflateEnd(&stream);
+    }
+    if (error == NULL && (size != record->size || (record->method == BACKUP_DEFLATED && z != Z_STREAM_END))) {
+        error = "wrong size";
+    } else if (error == NULL && crc != record->crc32) {
+        error = "CRC-32 mismatch";
+    }
+    free(in);
+    free(out);
+    return error;
+}
+
+// Create the parent directories of a relative path
+static void make_parents(const char *path) {
+    char buf[PATH_MAX];
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (char *slash = strchr(buf, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(buf, 0777);
+        *slash = '/';
+    }
+}
+
+// Restore record i as a file (or directory) under the current directory, or to stdout
+static int restore_member(size_t i, int to_stdout, int force) {
+    const struct backup_index_record *record = &index_.records[i];
+    char path[PATH_MAX];
+    const char *error;
+
+    snprintf(path, sizeof(path), "%.*s", (int)record->name_length, index_.names + record->name_offset);
+    if (path[0] == '/' || strcmp(path, "..") == 0 || strncmp(path, "../", 3) == 0 || strstr(path, "/../") != NULL) {
+        fprintf(stderr, "restore: %s: refusing a path outside the current directory\n", path);
+        return 1;
+    }
+    int is_dir = path[strlen(path) - 1] == '/';
+    if (to_stdout) {
+        if (is_dir) {
+            return 0;
+        }
+        fflush(stdout);
+        error = extract(i, STDOUT_FILENO);
+    } else {
+        make_parents(path);
+        if (is_dir) {
+            if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+                fprintf(stderr, "restore: %s: %s\n", path, strerror(errno));
+                return 1;
+            }
+            return 0;
+        }
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (force ? O_TRUNC : O_EXCL), 0666);
+        if (fd < 0) {
+            fprintf(stderr, "restore: %s: %s%s\n", path, strerror(errno), errno == EEXIST ? " (use -f to overwrite)" : "");
+            return 1;
+        }
+        error = extract(i, fd);
+        if (close(fd) != 0 && error == NULL) {
+            error = strerror(errno);
+        }
+    }
+    if (error != NULL) {
+        fprintf(stderr, "restore: %s: %s\n", path, error);
+        return 1;
+    }
+    return 0;
+}
+
+// Restore 'path', or everything under it if it names a directory
+static int restore_path(const char *path, int to_stdout, int force) {
+    char prefix[PATH_MAX];
+    int failed = 0;
+
+    while (path[0] == '/' || (path[0] == '.' && path[1] == '/')) {
+        path += path[0] == '/' ? 1 : 2; // archived paths are relative
+    }
+    size_t length = strlen(path);
+    size_t i = backup_index_lower_bound(&index_, path, length);
+    if (length > 0 && path[length - 1] != '/' && backup_index_name_is(&index_, i, path, length)) {
+        return restore_member(i, to_stdout, force);
+    }
+
+    // A directory: its members sort together after "dir/"
+    size_t prefix_length = snprintf(prefix, sizeof(prefix), "%s%s", path, length == 0 || path[length - 1] == '/' ? "" : "/");
+    i = backup_index_lower_bound(&index_, prefix, prefix_length);
+    size_t first = i;
+    for (; i < index_.header->count; i++) {
+        const struct backup_index_record *record = &index_.records[i];
+        if (record->name_length < prefix_length ||
+            memcmp(index_.names + record->name_offset, prefix, prefix_length) != 0) {
+            break;
+        }
+        failed |= restore_member(i, to_stdout, force);
+    }
+    if (i == first) {
+        fprintf(stderr, "restore: %s: not in %s\n", path, archive_path);
+        return 1;
+    }
+    return failed;
+}
+
+struct verify_state {
+    size_t next; // next record to check, claimed atomically
+    const char **errors;
+};
+
+static void *verify_worker(void *arg) {
+    struct verify_state *state = arg;
+    size_t i;
+    while ((i = __atomic_fetch_add(&state->next, 1, __ATOMIC_RELAXED)) < index_.header->count) {
+        state->errors[i] = extract(i, -1);
+    }
+    return NULL;
+}
+
+static int verify(int threads) {
+    size_t count = index_.header->count;
+    struct verify_state state = {0, calloc(count + 1, sizeof(const char *))};
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    int started = 0, failed = 0;
+
+    if (state.errors == NULL || workers == NULL) {
+        perror("restore");
+        return 1;
+    }
+    for (; started < threads && (size_t)started < count; started++) {
+        if (pthread_create(&workers[started], NULL, verify_worker, &state) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        verify_worker(&state);
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (state.errors[i] != NULL) {
+            const struct backup_index_record *record = &index_.records[i];
+            printf("%.*s: %s\n", (int)record->name_length, index_.names + record->name_offset, state.errors[i]);
+            failed++;
+        }
+    }
+    printf("%s: %zu members, %d bad\n", archive_path, count, failed);
+    free(state.errors);
+    free(workers);
+    return failed != 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: restore [-c] [-f] archive path...\n"
+                    "       restore --verify [-j N] archive\n");
+}
+
+int main(int argc, char **argv) {
+    int to_stdout = 0, force = 0, verifying = 0, threads = 0, i = 1;
+
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            to_stdout = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            force = 1;
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verifying = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            threads = atoi(argv[++i]);
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (i == argc || (verifying ? i + 1 != argc : i + 1 == argc)) {
+        usage();
+        return 2;
+    }
+
+    archive_path = argv[i++];
+    archive_fd = open(archive_path, O_RDONLY | O_CLOEXEC);
+    if (archive_fd < 0 || backup_index_load(archive_path, archive_fd, &index_) != 0) {
+        fprintf(stderr, "restore: %s: %s\n", archive_path, errno == EINVAL ? "not a zip archive" : strerror(errno));
+        return 2;
+    }
+
+    int failed = 0;
+    if (verifying) {
+        failed = verify(threads > 0 ? threads : topology_threads());
+    }
+    for (; i < argc; i++) {
+        failed |= restore_path(argv[i], to_stdout, force);
+    }
+    backup_index_free(&index_);
+    close(archive_fd);
+    return failed;
+}
@@ -0,0 +1,452 @@
+#define _GNU_SOURCE
+#include "system_program.h"
+#include <pthread.h>
+#include <regex.h>
+#include <sys/mman.h>
+#include "topology.h"
+#include "walk.h"
+
+/*
+ search - print the lines of files under a directory that contain a pattern
+
+   search [-i] [-E] [-l] [-u] [-j N] [--hidden] pattern [dir]
+
+ Lines are printed as "path:line:text". The pattern is a literal string,
+ or a POSIX extended regex with -E; -i ignores case and -l prints only
+ the names of matching files. Files whose first 8 KB hold a NUL byte are
+ taken as binary and skipped, as are names starting with '.' unless
+ --hidden is given. The exit status is 0 if anything matched, 1 if not.
+
+ The walk (walk.c) queues files for N searching threads (default: one per
+ CPU). Small files are read with pread, large ones mapped. A literal is
+ found by memchr for its rarest byte followed by memcmp, so the scan runs
+ at memchr's vectorised speed; a regex is run over the whole file at once
+ (REG_STARTEND), one compiled copy per thread since glibc serialises
+ regexec on a shared one. Each file's output is collected and printed as
+ one batch in walk order, so the result does not depend on N. With -u
+ the directories are read in parallel too and files print as they finish.
+ With a single thread the files are searched as they are walked, opened
+ relative to their directory, without the queue.
+*/
+
+#define MAP_THRESHOLD (1024 * 1024) // files at least this big are mapped
+#define BINARY_PROBE 8192
+#define QUEUE_LIMIT 4096            // files waiting to be searched
+
+struct out_buf {
+    char *data;
+    size_t len, capacity;
+};
+
+struct file_job {
+    char *path;
+    long seq;
+};
+
+struct search {
+    // pattern
+    const char *literal;
+    size_t literal_len;
+    size_t rare; // offset in the literal of the byte scanned for
+    const char *regex;
+    int regex_flags;
+    int list_only;
+    int ordered;
+    int inline_search; // one thread: search in the walk's visitor, no queue
+    regex_t inline_re;
+    char *inline_scratch;
+    size_t inline_scratch_size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    struct file_job *queue; // ring of QUEUE_LIMIT
+    int head, count, done_walking;
+
+    // finished batches, by seq, until their turn to print
+    struct out_buf **results;
+    long results_capacity, next_seq, next_print;
+    int matched;
+};
+
+static void buf_append(struct out_buf *buf, const char *data, size_t len) {
+    if (buf->len + len > buf->capacity) {
+        buf->capacity = (buf->len + len) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+        if (buf->data == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+/*
+ Pick the byte of the literal least likely to occur in text, so memchr
+ stops on few false candidates. Lower rank = rarer; spaces, vowels and
+ common consonants rank high.
+*/
+static size_t rarest_byte(const char *literal, size_t len) {
+    static const char common[] = " etaoinsrhldcumfpgwybvkxjqz_ETAOINSRHLDCUMFPGWYBVKXJQZ0123456789(),;.=-/*\"'\n\t";
+    size_t best = 0;
+    int best_rank = 1 << 30;
+    for (size_t i = 0; i < len; i++) {
+        const char *p = memchr(common, literal[i], sizeof(common) - 1);
+        int rank = p != NULL ? (int)(sizeof(common) - (p - common)) : 0;
+        if (rank < best_rank) {
+            best_rank = rank;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// First occurrence of the literal in [p, end)
+static const char *find_literal(const struct search *s, const char *p, const char *end) {
+    size_t len = s->literal_len;
+    if ((size_t)(end - p) < len) {
+        return NULL;
+    }
+    const char *scan = p + s->rare;
+    const char *scan_end = end - len + s->rare + 1; // the rare byte of the last possible start
+    unsigned char rare_byte = (unsigned char)s->literal[s->rare];
+    while (scan < scan_end) {
+        const char *hit = memchr(scan, rare_byte, scan_end - scan);
+        if (hit == NULL) {
+            return NULL;
+        }
+        if (memcmp(hit - s->rare, s->literal, len) == 0) {
+            return hit - s->rare;
+        }
+        scan = hit + 1;
+    }
+    return NULL;
+}
+
+// First regex match in [p, end), which starts a line
+static const char *find_regex(regex_t *re, const char *buf, const char *p, const char *end) {
+    regmatch_t match[1];
+    match[0].rm_so = p - buf;
+    match[0].rm_eo = end - buf;
+    if (regexec(re, buf, 1, match, REG_STARTEND) != 0) {
+        return NULL;
+    }
+    return buf + match[0].rm_so;
+}
+
+static long count_newlines(const char *p, const char *end) {
+    long n = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        n++;
+        p++;
+    }
+    return n;
+}
+
+// Append the file's matching lines to 'out'; returns whether any matched
+static int search_buffer(const struct search *s, regex_t *re, const char *path, const char *buf, size_t len,
+                         struct out_buf *out) {
+    const char *end = buf + len, *pos = buf, *counted = buf;
+    long line_no = 1;
+    int matched = 0;
+    char prefix[32];
+
+    if (memchr(buf, '\0', len < BINARY_PROBE ? len : BINARY_PROBE) != NULL) {
+        return 0;
+    }
+    while (pos < end) {
+        const char *hit = re != NULL ? find_regex(re, buf, pos, end) : find_literal(s, pos, end);
+        if (hit == NULL) {
+            break;
+        }
+        matched = 1;
+        if (s->list_only) {
+            buf_append(out, path, strlen(path));
+            buf_append(out, "\n", 1);
+            break;
+        }
+        const char *line = hit > pos ? memrchr(pos, '\n', hit - pos) : NULL;
+        line = line != NULL ? line + 1 : pos;
+        const char *line_end = memchr(hit, '\n', end - hit);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        line_no += count_newlines(counted, line);
+        counted = line;
+
+        buf_append(out, path, strlen(path));
+        buf_append(out, prefix, snprintf(prefix, sizeof(prefix), ":%ld:", line_no));
+        buf_append(out, line, line_end - line);
+        buf_append(out, "\n", 1);
+        pos = line_end + 1;
+    }
+    return matched;
+}
+
+// Read or map one file ('name' relative to 'dir_fd') and search it
+static int search_file(const struct search *s, regex_t *re, int dir_fd, const char *name, const char *path,
+                       char **scratch, size_t *scratch_size, struct out_buf *out) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    int matched = 0;
+
+    if (fd < 0) {
+        fprintf(stderr, "search: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    if (size >= MAP_THRESHOLD) {
+        char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, size, MADV_SEQUENTIAL);
+            matched = search_buffer(s, re, path, map, size, out);
+            munmap(map, size);
+        }
+    } else {
+        if (size + 1 > *scratch_size) {
+            *scratch_size = size * 2 < MAP_THRESHOLD ? size * 2 : MAP_THRESHOLD + 1;
+            *scratch = realloc(*scratch, *scratch_size);
+            if (*scratch == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        size_t got = 0;
+        ssize_t n;
+        while (got < size && (n = pread(fd, *scratch + got, size - got, got)) > 0) {
+            got += n;
+        }
+        (*scratch)[got] = '\0'; // the scan stops at got, but sanitizer regexec wrappers read to a NUL
+        matched = search_buffer(s, re, path, *scratch, got, out);
+    }
+    close(fd);
+    return matched;
+}
+
+// Hand a finished batch over and print every batch whose turn has come
+static void finish_batch(struct search *s, long seq, struct out_buf *out, int matched) {
+    pthread_mutex_lock(&s->lock);
+    s->matched |= matched;
+    if (!s->ordered) {
+        fwrite(out->data, 1, out->len, stdout);
+        free(out->data);
+        free(out);
+        pthread_mutex_unlock(&s->lock);
+        return;
+    }
+    s->results[seq] = out;
+    while (s->next_print < s->next_seq && s->results[s->next_print] != NULL) {
+        struct out_buf *ready = s->results[s->next_print];
+        fwrite(ready->data, 1, ready->len, stdout);
+        free(ready->data);
+        free(ready);
+        s->results[s->next_print++] = NULL;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *search_worker(void *data) {
+    struct search *s = data;
+    regex_t re;
+    char *scratch = NULL;
+    size_t scratch_size = 0;
+
+    if (s->regex != NULL) {
+        regcomp(&re, s->regex, s->regex_flags); // checked in main
+    }
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (s->count == 0 && !s->done_walking) {
+            pthread_cond_wait(&s->not_empty, &s->lock);
+        }
+        if (s->count == 0) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        struct file_job job = s->queue[s->head];
+        s->head = (s->head + 1) % QUEUE_LIMIT;
+        s->count--;
+        pthread_cond_signal(&s->not_full);
+        pthread_mutex_unlock(&s->lock);
+
+        struct out_buf *out = calloc(1, sizeof(struct out_buf));
+        int matched =
+            search_file(s, s->regex != NULL ? &re : NULL, AT_FDCWD, job.path, job.path, &scratch, &scratch_size, out);
+        finish_batch(s, job.seq, out, matched);
+        free(job.path);
+    }
+    if (s->regex != NULL) {
+        regfree(&re);
+    }
+    free(scratch);
+    return NULL;
+}
+
+// Walk visitor: queue regular files, waiting while the queue is full
+static int queue_file(const struct walk_entry *entry, void *data) {
+    struct search *s = data;
+
+    if (entry->type != DT_REG) {
+        return WALK_CONTINUE;
+    }
+    if (s->inline_search) {
+        struct out_buf out = {0};
+        s->matched |= search_file(s, s->regex != NULL ? &s->inline_re : NULL, entry->dir_fd, entry->name, entry->path,
+                                  &s->inline_scratch, &s->inline_scratch_size, &out);
+        fwrite(out.data, 1, out.len, stdout);
+        free(out.data);
+        return WALK_CONTINUE;
+    }
+    pthread_mutex_lock(&s->lock);
+    while (s->count == QUEUE_LIMIT) {
+        pthread_cond_wait(&s->not_full, &s->lock);
+    }
+    if (s->next_seq == s->results_capacity) {
+        s->results_capacity = s->results_capacity ? s->results_capacity * 2 : 1024;
+        s->results = realloc(s->results, s->results_capacity * sizeof(struct out_buf *));
+        if (s->results == NULL) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+        memset(s->results + s->next_seq, 0, (s->results_capacity - s->next_seq) * sizeof(struct out_buf *));
+    }
+    struct file_job *job = &s->queue[(s->head + s->count) % QUEUE_LIMIT];
+    job->path = strdup(entry->path);
+    job->seq = s->next_seq++;
+    s->count++;
+    pthread_cond_signal(&s->not_empty);
+    pthread_mutex_unlock(&s->lock);
+    return WALK_CONTINUE;
+}
+
+// Escape a literal for use as a regex (for -i)
+static char *escape_literal(const char *literal) {
+    char *escaped = malloc(strlen(literal) * 2 + 1), *p = escaped;
+    for (; *literal != '\0'; literal++) {
+        if (strchr("\\^$.[]|()*+?{}", *literal) != NULL) {
+            *p++ = '\\';
+        }
+        *p++ = *literal;
+    }
+    *p = '\0';
+    return escaped;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: search [-i] [-E] [-l] [-u] [-j N] [--hidden] pattern [dir]\n");
+}
+
+int main(int argc, char **argv) {
+    struct search s = {0};
+    struct walk_options options = {0};
+    int threads = 0, ignore_case = 0, extended = 0, i = 1;
+    char *escaped = NULL;
+
+    s.ordered = 1;
+    options.skip_hidden = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        if (strcmp(argv[i], "-i") == 0) {
+            ignore_case = 1;
+        } else if (strcmp(argv[i], "-E") == 0) {
+            extended = 1;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            s.list_only = 1;
+        } else if (strcmp(argv[i], "-u") == 0) {
+            s.ordered = 0;
+        } else if (strcmp(argv[i], "--hidden") == 0) {
+            options.skip_hidden = 0;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (i >= argc || argv[i][0] == '\0' || argc - i > 2) {
+        usage();
+        return 2;
+    }
+    const char *pattern = argv[i];
+    const char *root = i + 1 < argc ? argv[i + 1] : ".";
+
+    if (extended || ignore_case) {
+        regex_t re;
+        s.regex = extended ? pattern : (escaped = escape_literal(pattern));
+        s.regex_flags = REG_EXTENDED | REG_NEWLINE | (ignore_case ? REG_ICASE : 0);
+        int rc = regcomp(&re, s.regex, s.regex_flags);
+        if (rc != 0) {
+            char message[256];
+            regerror(rc, &re, message, sizeof(message));
+            fprintf(stderr, "search: %s\n", message);
+            return 2;
+        }
+        regfree(&re);
+    } else {
+        s.literal = pattern;
+        s.literal_len = strlen(pattern);
+        s.rare = rarest_byte(pattern, s.literal_len);
+    }
+
+    if (threads <= 0) {
+        threads = topology_threads();
+    }
+    if (!s.ordered) {
+        options.threads = threads;
+    }
+    if (threads == 1 && s.ordered) {
+        s.inline_search = 1;
+        if (s.regex != NULL) {
+            regcomp(&s.inline_re, s.regex, s.regex_flags);
+        }
+        int walked = walk(root, &options, queue_file, &s);
+        fflush(stdout);
+        if (s.regex != NULL) {
+            regfree(&s.inline_re);
+        }
+        free(s.inline_scratch);
+        free(escaped);
+        return walked < 0 ? 2 : s.matched ? 0 : 1;
+    }
+
+    s.queue = malloc(QUEUE_LIMIT * sizeof(struct file_job));
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.not_empty, NULL);
+    pthread_cond_init(&s.not_full, NULL);
+
+    pthread_t *workers = malloc(threads * sizeof(pthread_t));
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        started += pthread_create(&workers[started], NULL, search_worker, &s) == 0;
+    }
+    if (started == 0) {
+        perror("search: pthread_create");
+        return 2;
+    }
+
+    int walked = walk(root, &options, queue_file, &s);
+
+    pthread_mutex_lock(&s.lock);
+    s.done_walking = 1;
+    pthread_cond_broadcast(&s.not_empty);
+    pthread_mutex_unlock(&s.lock);
+    for (int t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    fflush(stdout);
+
+    free(workers);
+    free(s.queue);
+    free(s.results);
+    free(escaped);
+    if (walked < 0) {
+        return 2;
+    }
+    return s.matched ? 0 : 1;
+}
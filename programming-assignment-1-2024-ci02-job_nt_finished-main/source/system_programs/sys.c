@@ -1,36 +1,113 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/utsname.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
+#ifdef __APPLE__
 #include <sys/sysctl.h>
+#include <sys/time.h>
+#else
+#include <sys/sysinfo.h>
+#endif
 #include <pwd.h>
+#include "topology.h"
 
-void print_system_info() {
+/*
+ Print system information.
+
+   sys              human-readable summary, including CPU topology
+   sys --topology   the topology alone as key=value lines, for scripts
+*/
+
+// Uptime in seconds and total memory in bytes
+static void get_uptime_and_memory(long *uptime, long long *memsize) {
+#ifdef __APPLE__
+    int mib[2];
+    size_t len;
+    struct timeval boottime;
+    int64_t bytes = 0;
+
+    mib[0] = CTL_KERN;
+    mib[1] = KERN_BOOTTIME;
+    len = sizeof(boottime);
+    sysctl(mib, 2, &boottime, &len, NULL, 0);
+    *uptime = (long)(time(NULL) - boottime.tv_sec);
+
+    mib[0] = CTL_HW;
+    mib[1] = HW_MEMSIZE;
+    len = sizeof(bytes);
+    sysctl(mib, 2, &bytes, &len, NULL, 0);
+    *memsize = bytes;
+#else
+    struct sysinfo info;
+
+    sysinfo(&info);
+    *uptime = info.uptime;
+    *memsize = (long long)info.totalram * info.mem_unit;
+#endif
+}
+
+// "48K", "2M", "300M"
+static void format_size(long kb, char *buf, size_t size) {
+    if (kb >= 1024 && kb % 1024 == 0) {
+        snprintf(buf, size, "%ldM", kb / 1024);
+    } else {
+        snprintf(buf, size, "%ldK", kb);
+    }
+}
+
+// Cache name such as L1d, L1i or L2
+static void cache_name(const struct topo_cache *cache, char *buf, size_t size) {
+    const char *suffix = strcmp(cache->type, "Data") == 0 ? "d" : strcmp(cache->type, "Instruction") == 0 ? "i" : "";
+    snprintf(buf, size, "L%d%s", cache->level, suffix);
+}
+
+void print_topology(const struct topology *topo) {
+    char list[4096], name[16];
+
+    printf("cpus=%d\n", topo->cpus);
+    printf("cores=%d\n", topo->cores);
+    printf("packages=%d\n", topo->packages);
+    printf("threads_per_core=%d\n", topo->threads_per_core);
+    cpu_mask_format(&topo->online, list, sizeof(list));
+    printf("online=%s\n", list);
+    cpu_mask_format(&topo->allowed, list, sizeof(list));
+    printf("affinity=%s\n", list);
+    printf("affinity_cpus=%d\n", topo->allowed_cpus);
+    printf("affinity_cores=%d\n", topo->allowed_cores);
+    printf("nodes=%d\n", topo->num_nodes);
+    for (int i = 0; i < topo->num_nodes; i++) {
+        cpu_mask_format(&topo->nodes[i].cpus, list, sizeof(list));
+        printf("node%d.cpus=%s\n", topo->nodes[i].id, list);
+        printf("node%d.memory_kb=%ld\n", topo->nodes[i].id, topo->nodes[i].memory_kb);
+    }
+    for (int i = 0; i < topo->num_caches; i++) {
+        const struct topo_cache *cache = &topo->caches[i];
+        cache_name(cache, name, sizeof(name));
+        printf("cache.%s.size_kb=%ld\n", name, cache->size_kb);
+        printf("cache.%s.line_size=%d\n", name, cache->line_size);
+        printf("cache.%s.ways=%d\n", name, cache->ways);
+        printf("cache.%s.instances=%d\n", name, cache->instances);
+    }
+}
+
+void print_system_info(const struct topology *topo) {
     struct utsname unameData;
     struct passwd *pw;
     uid_t uid;
     char hostname[1024];
-    int mib[2];
-    size_t len;
-    int64_t memsize;
+    long long memsize;
     long uptime;
+    char list[4096], name[16], size[32];
 
     // Get OS, kernel, and hostname information
     uname(&unameData);
     gethostname(hostname, sizeof(hostname));
 
-    // Get uptime information
-    mib[0] = CTL_KERN;
-    mib[1] = KERN_BOOTTIME;
-    len = sizeof(uptime);
-    sysctl(mib, 2, &uptime, &len, NULL, 0);
-
-    // Get total memory size
-    mib[0] = CTL_HW;
-    mib[1] = HW_MEMSIZE;
-    len = sizeof(memsize);
-    sysctl(mib, 2, &memsize, &len, NULL, 0);
+    // Get uptime and total memory size
+    get_uptime_and_memory(&uptime, &memsize);
 
     // Get current user information
     uid = geteuid();
@@ -41,12 +118,38 @@ void print_system_info() {
     printf("Hostname: %s\n", hostname);
     printf("Kernel: %s\n", unameData.release);
     printf("Uptime: %ld seconds\n", uptime);
-    printf("User: %s\n", pw->pw_name);
-    printf("CPU: %s\n", unameData.machine);
+    printf("User: %s\n", pw != NULL ? pw->pw_name : "?");
+    printf("CPU: %s, %d core%s, %d thread%s (%d per core), %d package%s\n", unameData.machine, topo->cores,
+           topo->cores == 1 ? "" : "s", topo->cpus, topo->cpus == 1 ? "" : "s", topo->threads_per_core,
+           topo->packages, topo->packages == 1 ? "" : "s");
+    if (topo->num_caches > 0) {
+        printf("Caches:");
+        for (int i = 0; i < topo->num_caches; i++) {
+            cache_name(&topo->caches[i], name, sizeof(name));
+            format_size(topo->caches[i].size_kb, size, sizeof(size));
+            printf("%s %s %s x%d", i ? "," : "", name, size, topo->caches[i].instances);
+        }
+        printf("\n");
+    }
+    printf("NUMA nodes: %d\n", topo->num_nodes);
+    cpu_mask_format(&topo->allowed, list, sizeof(list));
+    printf("Affinity: %s (%d CPU%s)\n", list, topo->allowed_cpus, topo->allowed_cpus == 1 ? "" : "s");
     printf("Memory: %lld MB\n", memsize / 1024 / 1024);
 }
 
-int main() {
-    print_system_info();
+int main(int argc, char **argv) {
+    struct topology topo;
+
+    if (argc > 1 && strcmp(argv[1], "--topology") != 0) {
+        fprintf(stderr, "Usage: sys [--topology]\n");
+        return 1;
+    }
+    topology_load(&topo);
+    if (argc > 1) {
+        print_topology(&topo);
+    } else {
+        print_system_info(&topo);
+    }
+    topology_free(&topo);
     return 0;
 }
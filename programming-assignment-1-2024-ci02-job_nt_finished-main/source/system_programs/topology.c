@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include "topology.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ Topology discovery.
+
+ Everything comes from sysfs: the online CPU list, each CPU's
+ topology/{physical_package_id,core_id}, each node's cpulist and meminfo,
+ and the cache/indexN directories of the first CPU this process may run
+ on. A cache's instance count is the number of distinct shared_cpu_list
+ groups across the online CPUs. Where sysfs is missing (another OS, or a
+ container hiding it) every count falls back to sysconf's CPU count and
+ one node.
+
+ topology_threads() is the default size for a worker pool: one per CPU in
+ the affinity mask, which is what the process can actually use.
+*/
+
+#define CPU_DIR "/sys/devices/system/cpu"
+#define NODE_DIR "/sys/devices/system/node"
+
+#define MASK_WORD_BITS (8 * sizeof(unsigned long))
+
+void cpu_mask_set(struct cpu_mask *mask, int cpu) {
+    if (cpu >= 0 && cpu < TOPO_MAX_CPUS) {
+        mask->bits[cpu / MASK_WORD_BITS] |= 1UL << (cpu % MASK_WORD_BITS);
+    }
+}
+
+int cpu_mask_isset(const struct cpu_mask *mask, int cpu) {
+    return cpu >= 0 && cpu < TOPO_MAX_CPUS && (mask->bits[cpu / MASK_WORD_BITS] >> (cpu % MASK_WORD_BITS)) & 1;
+}
+
+int cpu_mask_count(const struct cpu_mask *mask) {
+    int count = 0;
+    for (size_t i = 0; i < sizeof(mask->bits) / sizeof(mask->bits[0]); i++) {
+        count += __builtin_popcountl(mask->bits[i]);
+    }
+    return count;
+}
+
+// Format as a kernel-style list, e.g. "0-3,8-11"
+void cpu_mask_format(const struct cpu_mask *mask, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < TOPO_MAX_CPUS && len < size; cpu++) {
+        if (!cpu_mask_isset(mask, cpu)) {
+            continue;
+        }
+        int last = cpu;
+        while (cpu_mask_isset(mask, last + 1)) {
+            last++;
+        }
+        len += snprintf(buf + len, size - len, last > cpu ? "%s%d-%d" : "%s%d", len ? "," : "", cpu, last);
+        cpu = last;
+    }
+}
+
+// Parse a kernel CPU list such as "0-3,8-11"
+static void parse_cpu_list(const char *list, struct cpu_mask *mask) {
+    memset(mask, 0, sizeof(*mask));
+    while (*list != '\0' && *list != '\n') {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+        if (end == list) {
+            break;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpu_mask_set(mask, (int)cpu);
+        }
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+// Read the first line of a sysfs file; returns 0 on success
+static int read_line(const char *path, char *buf, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    int ok = fgets(buf, (int)size, file) != NULL;
+    fclose(file);
+    if (!ok) {
+        return -1;
+    }
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static long read_long(const char *path, long fallback) {
+    char buf[64];
+    return read_line(path, buf, sizeof(buf)) == 0 ? strtol(buf, NULL, 10) : fallback;
+}
+
+static void load_caches(struct topology *topo, int first_cpu) {
+    char path[256], buf[4096];
+
+    for (int index = 0; topo->num_caches < TOPO_MAX_CACHES; index++) {
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/level", first_cpu, index);
+        long level = read_long(path, -1);
+        if (level < 0) {
+            break;
+        }
+        struct topo_cache *cache = &topo->caches[topo->num_caches];
+        cache->level = (int)level;
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/type", first_cpu, index);
+        if (read_line(path, cache->type, sizeof(cache->type)) != 0) {
+            strcpy(cache->type, "Unified");
+        }
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/size", first_cpu, index);
+        cache->size_kb = read_long(path, 0); // "48K"
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/coherency_line_size", first_cpu, index);
+        cache->line_size = (int)read_long(path, 0);
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/ways_of_associativity", first_cpu, index);
+        cache->ways = (int)read_long(path, 0);
+
+        // One instance per group of CPUs sharing it: count the groups of uncovered CPUs
+        struct cpu_mask covered = {0}, shared;
+        cache->instances = 0;
+        for (int cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+            if (!cpu_mask_isset(&topo->online, cpu) || cpu_mask_isset(&covered, cpu)) {
+                continue;
+            }
+            snprintf(path, sizeof(path), CPU_DIR "/cpu%d/cache/index%d/shared_cpu_list", cpu, index);
+            if (read_line(path, buf, sizeof(buf)) != 0) {
+                continue;
+            }
+            parse_cpu_list(buf, &shared);
+            for (size_t i = 0; i < sizeof(covered.bits) / sizeof(covered.bits[0]); i++) {
+                covered.bits[i] |= shared.bits[i];
+            }
+            cache->instances++;
+        }
+        topo->num_caches++;
+    }
+}
+
+static void load_nodes(struct topology *topo) {
+    char path[256], buf[4096];
+    struct cpu_mask node_ids;
+
+    if (read_line(NODE_DIR "/online", buf, sizeof(buf)) != 0) {
+        topo->num_nodes = 1;
+        topo->nodes = calloc(1, sizeof(struct topo_node));
+        topo->nodes[0].cpus = topo->online;
+        return;
+    }
+    parse_cpu_list(buf, &node_ids); // node lists use the same syntax
+    topo->nodes = calloc(cpu_mask_count(&node_ids) + 1, sizeof(struct topo_node));
+    for (int id = 0; id < TOPO_MAX_CPUS; id++) {
+        if (!cpu_mask_isset(&node_ids, id)) {
+            continue;
+        }
+        struct topo_node *node = &topo->nodes[topo->num_nodes++];
+        node->id = id;
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", id);
+        if (read_line(path, buf, sizeof(buf)) == 0) {
+            parse_cpu_list(buf, &node->cpus);
+        }
+        // "Node 0 MemTotal:       16318480 kB"
+        snprintf(path, sizeof(path), NODE_DIR "/node%d/meminfo", id);
+        FILE *meminfo = fopen(path, "r");
+        while (meminfo != NULL && fgets(buf, sizeof(buf), meminfo) != NULL) {
+            char *field = strstr(buf, "MemTotal:");
+            if (field != NULL) {
+                node->memory_kb = strtol(field + strlen("MemTotal:"), NULL, 10);
+                break;
+            }
+        }
+        if (meminfo != NULL) {
+            fclose(meminfo);
+        }
+    }
+}
+
+/*
+ Fill 'topo'. Returns 0 when sysfs described the CPUs, or -1 when only
+ the fallback counts are available (the structure is usable either way).
+*/
+int topology_load(struct topology *topo) {
+    char buf[4096], path[256];
+    int from_sysfs = read_line(CPU_DIR "/online", buf, sizeof(buf)) == 0;
+
+    memset(topo, 0, sizeof(*topo));
+    if (from_sysfs) {
+        parse_cpu_list(buf, &topo->online);
+    } else {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < (n > 0 ? n : 1); cpu++) {
+            cpu_mask_set(&topo->online, cpu);
+        }
+    }
+    topo->cpus = cpu_mask_count(&topo->online);
+
+    topo->allowed = topo->online;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        memset(&topo->allowed, 0, sizeof(topo->allowed));
+        for (int cpu = 0; cpu < TOPO_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpu_mask_set(&topo->allowed, cpu);
+            }
+        }
+    }
+#endif
+    topo->allowed_cpus = cpu_mask_count(&topo->allowed);
+
+    // Cores are distinct (package, core) pairs; SMT siblings share one
+    long core_key[TOPO_MAX_CPUS];
+    int first_allowed = -1, num_keys = 0;
+    long packages[TOPO_MAX_CPUS];
+    struct cpu_mask allowed_core = {0};
+    topo->threads_per_core = 1;
+    for (int cpu = 0; cpu < TOPO_MAX_CPUS; cpu++) {
+        if (!cpu_mask_isset(&topo->online, cpu)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/topology/physical_package_id", cpu);
+        long package = read_long(path, 0);
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/topology/core_id", cpu);
+        long key = package * 65536 + read_long(path, cpu);
+
+        int core = 0;
+        while (core < num_keys && core_key[core] != key) {
+            core++;
+        }
+        if (core == num_keys) {
+            core_key[num_keys++] = key;
+        }
+        if (cpu_mask_isset(&topo->allowed, cpu)) {
+            cpu_mask_set(&allowed_core, core);
+            if (first_allowed < 0) {
+                first_allowed = cpu;
+            }
+        }
+
+        int package_index = 0;
+        while (package_index < topo->packages && packages[package_index] != package) {
+            package_index++;
+        }
+        if (package_index == topo->packages) {
+            packages[topo->packages++] = package;
+        }
+
+        snprintf(path, sizeof(path), CPU_DIR "/cpu%d/topology/thread_siblings_list", cpu);
+        if (read_line(path, buf, sizeof(buf)) == 0) {
+            struct cpu_mask siblings;
+            parse_cpu_list(buf, &siblings);
+            if (cpu_mask_count(&siblings) > topo->threads_per_core) {
+                topo->threads_per_core = cpu_mask_count(&siblings);
+            }
+        }
+    }
+    topo->cores = num_keys;
+    topo->allowed_cores = cpu_mask_count(&allowed_core);
+
+    load_nodes(topo);
+    if (from_sysfs && first_allowed >= 0) {
+        load_caches(topo, first_allowed);
+    }
+    return from_sysfs ? 0 : -1;
+}
+
+void topology_free(struct topology *topo) {
+    free(topo->nodes);
+    topo->nodes = NULL;
+    topo->num_nodes = 0;
+}
+
+// Default worker-pool size: the CPUs this process may run on
+int topology_threads(void) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        return CPU_COUNT(&set);
+    }
+#endif
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/*
+ Restrict 'pid' (0 for the calling thread) to the allowed CPUs of the
+ node at index 'node' of topo->nodes, taken modulo the node count so
+ callers can pin worker i to node i. Returns 0 on success.
+*/
+int topology_pin_node(pid_t pid, const struct topology *topo, int node) {
+#ifdef __linux__
+    if (topo->num_nodes == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    const struct topo_node *target = &topo->nodes[node % topo->num_nodes];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu = 0; cpu < TOPO_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (cpu_mask_isset(&target->cpus, cpu) && cpu_mask_isset(&topo->allowed, cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (CPU_COUNT(&set) == 0) {
+        return 0; // none of this node's CPUs are ours; leave the mask alone
+    }
+    return sched_setaffinity(pid, sizeof(set), &set);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
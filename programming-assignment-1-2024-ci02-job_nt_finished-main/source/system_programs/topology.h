@@ -0,0 +1,60 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ CPU, cache and NUMA topology from /sys/devices/system/{cpu,node} (see
+ topology.c), for sys and for sizing and pinning worker pools.
+*/
+
+#define TOPO_MAX_CPUS 1024
+#define TOPO_MAX_CACHES 8
+
+struct cpu_mask {
+    unsigned long bits[TOPO_MAX_CPUS / (8 * sizeof(unsigned long))];
+};
+
+struct topo_cache {
+    int level;
+    char type[16]; // "Data", "Instruction" or "Unified"
+    long size_kb;
+    int line_size;
+    int ways;
+    int instances; // separate copies across the online CPUs
+};
+
+struct topo_node {
+    int id;
+    struct cpu_mask cpus;
+    long memory_kb;
+};
+
+struct topology {
+    int cpus;             // online logical CPUs
+    int cores;            // physical cores
+    int packages;         // sockets
+    int threads_per_core; // SMT siblings per core
+    struct cpu_mask online;
+    struct cpu_mask allowed; // this process's affinity mask
+    int allowed_cpus;
+    int allowed_cores;    // cores with at least one allowed CPU
+    int num_nodes;
+    struct topo_node *nodes;
+    int num_caches;
+    struct topo_cache caches[TOPO_MAX_CACHES]; // as seen from the first allowed CPU
+};
+
+int topology_load(struct topology *topo);
+void topology_free(struct topology *topo);
+
+int topology_threads(void);
+int topology_pin_node(pid_t pid, const struct topology *topo, int node);
+
+void cpu_mask_set(struct cpu_mask *mask, int cpu);
+int cpu_mask_isset(const struct cpu_mask *mask, int cpu);
+int cpu_mask_count(const struct cpu_mask *mask);
+void cpu_mask_format(const struct cpu_mask *mask, char *buf, size_t size);
+
+#endif
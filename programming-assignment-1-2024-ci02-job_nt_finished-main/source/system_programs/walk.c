@@ -0,0 +1,663 @@
+#define _GNU_SOURCE
+#include "walk.h"
+#include "topology.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ Iterative directory walker.
+
+ Each directory is read in full with getdents64 in large batches, and its
+ children are stat'ed and opened relative to its fd (fstatat, openat), so
+ paths are only built for display and never limit the depth. The walk
+ keeps an explicit stack instead of recursing. Because a directory's
+ listing is already in memory, the fds of ancestor directories may be
+ closed when more than max_open_fds are open, or when an open fails with
+ EMFILE. A closed ancestor is reopened through ".." of its child when the
+ walk climbs back to it (by path if it was moved meanwhile).
+
+ With symlinks followed, a directory whose device and inode match one of
+ its ancestors is a loop and is reported (ELOOP) instead of entered. In
+ one-filesystem mode, directories on a different device than the root are
+ visited but not entered.
+
+ With threads > 1, worker threads take directories from a shared queue
+ and read and stat them in parallel. Visits are serialised, so visitors
+ need not be thread-safe, but they arrive in no particular order. A queued
+ directory is opened relative to its parent's fd, which stays open until
+ the last of its queued subdirectories is opened. Past max_open_fds
+ (default 256 here, and at most half of RLIMIT_NOFILE) parents are closed
+ and their subdirectories queued by path instead. Each queued directory
+ carries the device and inode of its ancestors, in a chain shared with its
+ siblings, so loops are reported as in the serial walk while a directory
+ reached through two different links is still entered twice.
+ WALK_THREADS_AUTO sizes the pool from the affinity mask (topology.c),
+ and pin_workers spreads the workers over the NUMA nodes.
+*/
+
+#define DEFAULT_MAX_FDS 32
+#define DEFAULT_MAX_QUEUED_FDS 256
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// A directory's entries, each stored as its d_type byte then the NUL-terminated name
+struct listing {
+    char *data;
+    size_t len, capacity, pos;
+};
+
+struct frame {
+    int fd; // -1 while closed to stay under the fd cap
+    size_t path_len;
+    dev_t dev;
+    ino_t ino;
+    struct listing listing;
+};
+
+struct path_buf {
+    char *buf;
+    size_t len, capacity;
+};
+
+static void default_error(const char *path, int err, void *arg) {
+    fprintf(stderr, "%s: %s\n", path, strerror(err));
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr, size);
+    if (ptr == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+static void path_set_len(struct path_buf *path, size_t len) {
+    path->len = len;
+    path->buf[len] = '\0';
+}
+
+static void path_append(struct path_buf *path, const char *name) {
+    size_t name_len = strlen(name);
+    if (path->len + name_len + 2 > path->capacity) {
+        path->capacity = (path->len + name_len + 2) * 2;
+        path->buf = xrealloc(path->buf, path->capacity);
+    }
+    if (path->len > 0 && path->buf[path->len - 1] != '/') {
+        path->buf[path->len++] = '/';
+    }
+    memcpy(path->buf + path->len, name, name_len + 1);
+    path->len += name_len;
+}
+
+// Read all of the directory open on 'fd'
+static int read_listing(int fd, struct listing *listing, int skip_hidden) {
+    char buf[32768];
+    long n;
+
+    memset(listing, 0, sizeof(*listing));
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (skip_hidden || name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            size_t len = strlen(name) + 2;
+            if (listing->len + len > listing->capacity) {
+                listing->capacity = listing->capacity ? listing->capacity * 2 : 4096;
+                while (listing->len + len > listing->capacity) {
+                    listing->capacity *= 2;
+                }
+                listing->data = xrealloc(listing->data, listing->capacity);
+            }
+            listing->data[listing->len] = (char)d->d_type;
+            memcpy(listing->data + listing->len + 1, name, len - 1);
+            listing->len += len;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ Work out an entry's type (resolving DT_UNKNOWN, and symlinks when they
+ are followed) and stat it if asked. Returns -1 if it vanished.
+*/
+static int examine(int dir_fd, const char *name, unsigned char *type, const struct walk_options *options,
+                   struct stat *st, int *have_stat) {
+    int follow = options->symlinks == WALK_SYMLINKS_FOLLOW;
+    *have_stat = 0;
+    if (options->want_stat || *type == DT_UNKNOWN || (*type == DT_LNK && follow)) {
+        if (fstatat(dir_fd, name, st, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+            // A dangling link can still be visited as a link
+            if (!(follow && *type == DT_LNK && fstatat(dir_fd, name, st, AT_SYMLINK_NOFOLLOW) == 0)) {
+                return -1;
+            }
+        }
+        *have_stat = 1;
+        if (S_ISDIR(st->st_mode)) {
+            *type = DT_DIR;
+        } else if (*type == DT_UNKNOWN) {
+            *type = S_ISREG(st->st_mode) ? DT_REG : S_ISLNK(st->st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+    }
+    return 0;
+}
+
+// Open a child directory for descending, following a link only when asked
+static int open_child(int dir_fd, const char *name, const struct walk_options *options) {
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    if (options->symlinks != WALK_SYMLINKS_FOLLOW) {
+        flags |= O_NOFOLLOW;
+    }
+    return openat(dir_fd, name, flags);
+}
+
+// Open a directory by a path that may be longer than PATH_MAX, a component at a time if need be
+static int open_dir_path(const char *path) {
+    int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+    int fd = open(path, flags);
+    if (fd >= 0 || errno != ENAMETOOLONG) {
+        return fd;
+    }
+
+    char *copy = strdup(path), *save = NULL;
+    fd = path[0] == '/' ? open("/", flags) : AT_FDCWD;
+    for (char *part = strtok_r(copy, "/", &save); part != NULL && fd != -1; part = strtok_r(NULL, "/", &save)) {
+        int next = openat(fd, part, flags);
+        int saved_errno = errno;
+        if (fd != AT_FDCWD) {
+            close(fd);
+        }
+        fd = next;
+        errno = saved_errno;
+    }
+    free(copy);
+    return fd;
+}
+
+/*
+ Close the fd of the outermost ancestor of the top frame that still has
+ one open. Frames below 'oldest_open' are all closed. Returns 0 if only
+ the top frame is open.
+*/
+static int close_ancestor(struct frame *stack, int depth, int *oldest_open, int *open_fds) {
+    while (*oldest_open < depth - 1) {
+        struct frame *frame = &stack[(*oldest_open)++];
+        if (frame->fd >= 0) {
+            close(frame->fd);
+            frame->fd = -1;
+            (*open_fds)--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int walk_serial(int root_fd, dev_t root_dev, const char *root, const struct walk_options *options,
+                       walk_visit_fn visit, void *arg) {
+    int max_fds = options->max_open_fds > 0 ? options->max_open_fds : DEFAULT_MAX_FDS;
+    walk_error_fn on_error = options->on_error != NULL ? options->on_error : default_error;
+    struct frame *stack = NULL;
+    int depth = 0, capacity = 0, open_fds = 1, oldest_open = 0, stopped = 0;
+    struct path_buf path = {0};
+    struct stat st;
+
+    path_append(&path, root);
+    capacity = 16;
+    stack = xrealloc(NULL, capacity * sizeof(struct frame));
+    fstat(root_fd, &st);
+    stack[0].fd = root_fd;
+    stack[0].path_len = path.len;
+    stack[0].dev = st.st_dev;
+    stack[0].ino = st.st_ino;
+    if (read_listing(root_fd, &stack[0].listing, options->skip_hidden) != 0) {
+        on_error(path.buf, errno, arg);
+    }
+    depth = 1;
+
+    while (depth > 0 && !stopped) {
+        struct frame *top = &stack[depth - 1];
+        struct listing *listing = &top->listing;
+
+        if (listing->pos >= listing->len) {
+            free(listing->data);
+            if (depth > 1 && stack[depth - 2].fd < 0 && top->fd >= 0) {
+                // Reopen the parent through "..", which works at any depth, if it is still the same directory
+                struct frame *parent = &stack[depth - 2];
+                int fd = openat(top->fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd >= 0 && fstat(fd, &st) == 0 && st.st_dev == parent->dev && st.st_ino == parent->ino) {
+                    parent->fd = fd;
+                    open_fds++;
+                    if (oldest_open > depth - 2) {
+                        oldest_open = depth - 2;
+                    }
+                } else if (fd >= 0) {
+                    close(fd);
+                }
+            }
+            if (top->fd >= 0) {
+                close(top->fd);
+                open_fds--;
+            }
+            depth--;
+            if (depth > 0) {
+                path_set_len(&path, stack[depth - 1].path_len);
+            }
+            continue;
+        }
+
+        unsigned char type = (unsigned char)listing->data[listing->pos];
+        const char *name = listing->data + listing->pos + 1;
+        listing->pos += strlen(name) + 2;
+
+        path_set_len(&path, top->path_len);
+        if (top->fd < 0) {
+            // Closed to respect the cap and not reachable through ".."; reopen by path
+            top->fd = open_dir_path(path.buf);
+            if (top->fd < 0) {
+                on_error(path.buf, errno, arg);
+                listing->pos = listing->len;
+                continue;
+            }
+            open_fds++;
+            if (oldest_open > depth - 1) {
+                oldest_open = depth - 1;
+            }
+        }
+
+        path_append(&path, name);
+
+        int have_stat;
+        if (examine(top->fd, name, &type, options, &st, &have_stat) != 0) {
+            continue; // removed since it was listed
+        }
+        struct walk_entry entry = {path.buf, name, top->fd, type, depth, options->want_stat ? &st : NULL};
+        int rc = visit(&entry, arg);
+        if (rc == WALK_STOP) {
+            stopped = 1;
+            break;
+        }
+        if (type != DT_DIR || rc == WALK_PRUNE || (options->max_depth > 0 && depth >= options->max_depth)) {
+            continue;
+        }
+
+        int fd;
+        while ((fd = open_child(top->fd, name, options)) < 0 && (errno == EMFILE || errno == ENFILE) &&
+               close_ancestor(stack, depth, &oldest_open, &open_fds)) {
+        }
+        if (fd < 0) {
+            if (errno != ELOOP && errno != ENOTDIR) { // a link when not following
+                on_error(path.buf, errno, arg);
+            }
+            continue;
+        }
+        struct stat dir_st;
+        fstat(fd, &dir_st);
+        if (options->one_filesystem && dir_st.st_dev != root_dev) {
+            close(fd);
+            continue;
+        }
+        int loop = 0;
+        for (int i = 0; i < depth && options->symlinks == WALK_SYMLINKS_FOLLOW; i++) {
+            loop |= stack[i].dev == dir_st.st_dev && stack[i].ino == dir_st.st_ino;
+        }
+        if (loop) {
+            on_error(path.buf, ELOOP, arg);
+            close(fd);
+            continue;
+        }
+
+        if (depth == capacity) {
+            capacity *= 2;
+            stack = xrealloc(stack, capacity * sizeof(struct frame));
+        }
+        struct frame *child = &stack[depth];
+        child->fd = fd;
+        child->path_len = path.len;
+        child->dev = dir_st.st_dev;
+        child->ino = dir_st.st_ino;
+        if (read_listing(fd, &child->listing, options->skip_hidden) != 0) {
+            on_error(path.buf, errno, arg);
+        }
+        depth++;
+        open_fds++;
+
+        while (open_fds > max_fds && close_ancestor(stack, depth, &oldest_open, &open_fds)) {
+        }
+    }
+
+    while (depth > 0) {
+        depth--;
+        if (stack[depth].fd >= 0) {
+            close(stack[depth].fd);
+        }
+        free(stack[depth].listing.data);
+    }
+    free(stack);
+    free(path.buf);
+    return stopped ? 1 : 0;
+}
+
+// Parallel walk: a queue of directories shared by worker threads
+
+// A directory whose subdirectories are queued, closed by the last of them to be opened
+struct dir_ref {
+    int fd;
+    int refs;
+};
+
+// A directory entered with symlinks followed, linked to its parent's; freed with its last child
+struct dir_id {
+    dev_t dev;
+    ino_t ino;
+    struct dir_id *parent;
+    int refs;
+};
+
+struct dir_job {
+    char *path;
+    size_t name_offset;     // of the last component in path
+    struct dir_ref *parent; // NULL to open by path (the root, or past the fd cap)
+    struct dir_id *ancestors; // NULL for the root, or when not following symlinks
+    int depth; // of the directory's entries
+    struct dir_job *next;
+};
+
+struct parallel_walk {
+    const struct walk_options *options;
+    struct topology topo; // loaded when pinning workers
+    walk_visit_fn visit;
+    void *arg;
+    walk_error_fn on_error;
+    dev_t root_dev;
+    int max_fds;
+    int open_fds;         // held by dir_refs, updated atomically
+    pthread_mutex_t lock; // queue and stop flag
+    pthread_cond_t more;
+    pthread_mutex_t visit_lock;
+    struct dir_job *head, *tail;
+    int busy; // workers holding a directory
+    int stopped;
+};
+
+static void enqueue(struct parallel_walk *pw, char *path, size_t name_offset, struct dir_ref *parent,
+                    struct dir_id *ancestors, int depth) {
+    struct dir_job *job = xrealloc(NULL, sizeof(struct dir_job));
+    job->path = path;
+    job->name_offset = name_offset;
+    job->parent = parent;
+    job->ancestors = ancestors;
+    job->depth = depth;
+    job->next = NULL;
+    if (parent != NULL) {
+        __atomic_add_fetch(&parent->refs, 1, __ATOMIC_RELAXED);
+    }
+    if (ancestors != NULL) {
+        __atomic_add_fetch(&ancestors->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_lock(&pw->lock);
+    if (pw->tail != NULL) {
+        pw->tail->next = job;
+    } else {
+        pw->head = job;
+    }
+    pw->tail = job;
+    pthread_cond_signal(&pw->more);
+    pthread_mutex_unlock(&pw->lock);
+}
+
+static void release(struct parallel_walk *pw, struct dir_ref *ref) {
+    if (ref != NULL && __atomic_sub_fetch(&ref->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(ref->fd);
+        __atomic_sub_fetch(&pw->open_fds, 1, __ATOMIC_RELAXED);
+        free(ref);
+    }
+}
+
+static void release_ids(struct dir_id *id) {
+    while (id != NULL && __atomic_sub_fetch(&id->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        struct dir_id *parent = id->parent;
+        free(id);
+        id = parent;
+    }
+}
+
+static void process_dir(struct parallel_walk *pw, struct dir_job *job) {
+    const struct walk_options *options = pw->options;
+    struct dir_ref *self = NULL;
+    struct dir_id *self_id = NULL;
+    struct listing listing;
+    struct path_buf path = {0};
+    struct stat st;
+
+    int fd = job->parent != NULL ? open_child(job->parent->fd, job->path + job->name_offset, options)
+                                 : open_dir_path(job->path);
+    int err = errno;
+    release(pw, job->parent);
+    job->parent = NULL;
+    if (fd < 0) {
+        pthread_mutex_lock(&pw->visit_lock);
+        pw->on_error(job->path, err, pw->arg);
+        pthread_mutex_unlock(&pw->visit_lock);
+        return;
+    }
+    fstat(fd, &st);
+    if (options->one_filesystem && st.st_dev != pw->root_dev) {
+        close(fd);
+        return;
+    }
+    int loop = 0;
+    for (struct dir_id *id = job->ancestors; id != NULL; id = id->parent) {
+        loop |= id->dev == st.st_dev && id->ino == st.st_ino;
+    }
+    if (loop) {
+        pthread_mutex_lock(&pw->visit_lock);
+        pw->on_error(job->path, ELOOP, pw->arg);
+        pthread_mutex_unlock(&pw->visit_lock);
+        close(fd);
+        return;
+    }
+    if (options->symlinks == WALK_SYMLINKS_FOLLOW) {
+        self_id = xrealloc(NULL, sizeof(struct dir_id));
+        *self_id = (struct dir_id){st.st_dev, st.st_ino, job->ancestors, 1};
+        job->ancestors = NULL; // now held by self_id
+    }
+    if (read_listing(fd, &listing, options->skip_hidden) != 0) {
+        err = errno;
+        pthread_mutex_lock(&pw->visit_lock);
+        pw->on_error(job->path, err, pw->arg);
+        pthread_mutex_unlock(&pw->visit_lock);
+    }
+    path_append(&path, job->path);
+    size_t base_len = path.len;
+
+    while (listing.pos < listing.len && !pw->stopped) {
+        unsigned char type = (unsigned char)listing.data[listing.pos];
+        const char *name = listing.data + listing.pos + 1;
+        listing.pos += strlen(name) + 2;
+
+        int have_stat;
+        if (examine(fd, name, &type, options, &st, &have_stat) != 0) {
+            continue;
+        }
+        path_set_len(&path, base_len);
+        path_append(&path, name);
+
+        struct walk_entry entry = {path.buf, name, fd, type, job->depth, options->want_stat ? &st : NULL};
+        pthread_mutex_lock(&pw->visit_lock);
+        int rc = pw->stopped ? WALK_STOP : pw->visit(&entry, pw->arg);
+        pthread_mutex_unlock(&pw->visit_lock);
+        if (rc == WALK_STOP) {
+            pthread_mutex_lock(&pw->lock);
+            pw->stopped = 1;
+            pthread_cond_broadcast(&pw->more);
+            pthread_mutex_unlock(&pw->lock);
+            break;
+        }
+        if (type == DT_DIR && rc != WALK_PRUNE && (options->max_depth == 0 || job->depth < options->max_depth)) {
+            // Keep this fd for opening the subdirectories, unless too many are kept already
+            if (self == NULL && __atomic_add_fetch(&pw->open_fds, 1, __ATOMIC_RELAXED) <= pw->max_fds) {
+                self = xrealloc(NULL, sizeof(struct dir_ref));
+                self->fd = fd;
+                self->refs = 1; // this call's own, released below
+            } else if (self == NULL) {
+                __atomic_sub_fetch(&pw->open_fds, 1, __ATOMIC_RELAXED);
+            }
+            enqueue(pw, strdup(path.buf), path.len - strlen(name), self, self_id, job->depth + 1);
+        }
+    }
+    if (self != NULL) {
+        release(pw, self);
+    } else {
+        close(fd);
+    }
+    release_ids(self_id);
+    free(listing.data);
+    free(path.buf);
+}
+
+struct worker {
+    struct parallel_walk *pw;
+    int index;
+};
+
+static void *walk_worker(void *data) {
+    struct worker *worker = data;
+    struct parallel_walk *pw = worker->pw;
+
+    if (pw->options->pin_workers && worker->index >= 0) {
+        topology_pin_node(0, &pw->topo, worker->index);
+    }
+
+    pthread_mutex_lock(&pw->lock);
+    for (;;) {
+        while (pw->head == NULL && pw->busy > 0 && !pw->stopped) {
+            pthread_cond_wait(&pw->more, &pw->lock);
+        }
+        if (pw->head == NULL || pw->stopped) {
+            break; // nothing queued and nobody left to queue more
+        }
+        struct dir_job *job = pw->head;
+        pw->head = job->next;
+        if (pw->head == NULL) {
+            pw->tail = NULL;
+        }
+        pw->busy++;
+        pthread_mutex_unlock(&pw->lock);
+
+        process_dir(pw, job);
+        release_ids(job->ancestors);
+        free(job->path);
+        free(job);
+
+        pthread_mutex_lock(&pw->lock);
+        pw->busy--;
+        if (pw->busy == 0 && pw->head == NULL) {
+            pthread_cond_broadcast(&pw->more); // the walk is over
+        }
+    }
+    pthread_mutex_unlock(&pw->lock);
+    return NULL;
+}
+
+static int walk_parallel(const char *root, dev_t root_dev, const struct walk_options *options, int num_threads,
+                         walk_visit_fn visit, void *arg) {
+    struct parallel_walk pw = {0};
+    pthread_t *threads = xrealloc(NULL, num_threads * sizeof(pthread_t));
+    struct worker *workers = xrealloc(NULL, num_threads * sizeof(struct worker));
+
+    pw.options = options;
+    pw.visit = visit;
+    pw.arg = arg;
+    pw.on_error = options->on_error != NULL ? options->on_error : default_error;
+    pw.root_dev = root_dev;
+    pw.max_fds = options->max_open_fds > 0 ? options->max_open_fds : DEFAULT_MAX_QUEUED_FDS;
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY &&
+        (rlim_t)pw.max_fds > nofile.rlim_cur / 2) {
+        pw.max_fds = nofile.rlim_cur / 2; // leave the rest to the workers and the visitor
+    }
+    if (options->pin_workers) {
+        topology_load(&pw.topo);
+    }
+    pthread_mutex_init(&pw.lock, NULL);
+    pthread_mutex_init(&pw.visit_lock, NULL);
+    pthread_cond_init(&pw.more, NULL);
+    enqueue(&pw, strdup(root), 0, NULL, NULL, 1);
+
+    int started = 0;
+    for (int i = 0; i < num_threads; i++) {
+        workers[started].pw = &pw;
+        workers[started].index = started;
+        started += pthread_create(&threads[started], NULL, walk_worker, &workers[started]) == 0;
+    }
+    if (started == 0) {
+        workers[0].pw = &pw;
+        workers[0].index = -1; // the caller's thread; leave its affinity alone
+        walk_worker(&workers[0]);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    while (pw.head != NULL) { // left over after a stop
+        struct dir_job *job = pw.head;
+        pw.head = job->next;
+        release(&pw, job->parent);
+        release_ids(job->ancestors);
+        free(job->path);
+        free(job);
+    }
+    pthread_mutex_destroy(&pw.lock);
+    pthread_mutex_destroy(&pw.visit_lock);
+    pthread_cond_destroy(&pw.more);
+    topology_free(&pw.topo);
+    free(workers);
+    free(threads);
+    return pw.stopped ? 1 : 0;
+}
+
+/*
+ Walk the tree under 'root', calling 'visit' for each entry. Returns 0
+ when the walk completes, 1 if a visitor stopped it, or -1 if 'root'
+ cannot be opened.
+*/
+int walk(const char *root, const struct walk_options *options, walk_visit_fn visit, void *arg) {
+    struct walk_options defaults = {0};
+    struct stat st;
+
+    if (options == NULL) {
+        options = &defaults;
+    }
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        (options->on_error != NULL ? options->on_error : default_error)(root, errno, arg);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    int threads = options->threads == WALK_THREADS_AUTO ? topology_threads() : options->threads;
+    if (threads > 1) {
+        close(fd);
+        return walk_parallel(root, st.st_dev, options, threads, visit, arg);
+    }
+    return walk_serial(fd, st.st_dev, root, options, visit, arg);
+}
@@ -0,0 +1,50 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ Directory tree walker shared by ldr, find and backup (see walk.c).
+
+ walk() calls 'visit' for everything below 'root' (not for the root
+ itself). Whether a directory is entered is decided after its visit, so a
+ visitor can prune it.
+*/
+
+#define WALK_CONTINUE 0
+#define WALK_PRUNE 1 // do not descend into this directory
+#define WALK_STOP 2  // end the walk
+
+#define WALK_THREADS_AUTO -1 // one thread per CPU this process may use
+
+#define WALK_SYMLINKS_NONE 0 // symlinks are visited but never followed
+#define WALK_SYMLINKS_FOLLOW 1
+
+struct walk_entry {
+    const char *path;  // root-relative, e.g. "./src/main.c"
+    const char *name;  // last component of path
+    int dir_fd;        // open fd of the containing directory
+    unsigned char type; // DT_* constant; DT_DIR for followed links to directories
+    int depth;         // 1 for entries directly under the root
+    const struct stat *st; // NULL unless walk_options.want_stat is set
+};
+
+typedef int (*walk_visit_fn)(const struct walk_entry *entry, void *arg);
+typedef void (*walk_error_fn)(const char *path, int err, void *arg);
+
+struct walk_options {
+    int symlinks;       // WALK_SYMLINKS_*
+    int one_filesystem; // do not enter directories on other devices
+    int skip_hidden;    // leave out names starting with '.'
+    int want_stat;      // fill walk_entry.st (following symlinks if symlinks are followed)
+    int max_depth;      // 0 for no limit
+    int max_open_fds;   // directory fds held at once; 0 for the default (32, or 256 with threads)
+    int threads;        // >1 reads directories in parallel; visits are still one at a time
+    int pin_workers;    // with threads, pin worker i to NUMA node i (round robin)
+    walk_error_fn on_error; // NULL prints "path: error" on stderr
+};
+
+int walk(const char *root, const struct walk_options *options, walk_visit_fn visit, void *arg);
+
+#endif
@@ -0,0 +1,454 @@
+#include "shell.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+/*
+ Zygote mode: a small pool of pre-forked helper processes.
+
+ Each helper is a child of the shell blocked on its end of a Unix socket.
+ To launch a system program the shell sends it the cwd, argv and
+ environment, with the three standard descriptors attached as SCM_RIGHTS;
+ the helper installs them and execs straight away. The fork that produced
+ the helper happened earlier, while the previous command was running, so
+ copying the shell's address space is no longer on the launch path. The
+ helper is still the shell's child, so the shell waits for it as usual.
+*/
+
+#define ZYGOTE_MAX_HELPERS 64
+#define ZYGOTE_MAX_TRACKED 256
+
+struct zygote_helper {
+    pid_t pid;
+    int sock; // shell's end of the socketpair
+};
+
+// Launch timings for one path: plain fork or zygote dispatch
+struct launch_stats {
+    long launches;
+    double spawn_us; // time the shell spent starting the child
+    long waited;
+    double wall_ms;  // start to exit, as seen by the shell
+};
+
+static struct zygote_helper pool[ZYGOTE_MAX_HELPERS];
+static int pool_count = 0;
+static int pool_target = 0;
+static int bypass = 0; // 'zygote bench' forces the fork path
+static struct launch_stats stats[2];
+
+// Launches not reaped yet, so each exit is counted under its own path
+static struct {
+    pid_t pid;
+    int via_zygote;
+    double start_us;
+} tracked[ZYGOTE_MAX_TRACKED];
+
+extern char **environ;
+
+double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int read_full(int fd, void *buf, size_t size) {
+    char *p = buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Helper side: wait for one request, then become the command
+static void helper_main(int sock) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    uint32_t header[3]; // payload length, argc, envc
+    struct iovec iov = {header, sizeof(header)};
+    struct msghdr msg;
+    int fds[3] = {-1, -1, -1};
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(header)) {
+        _exit(0); // the shell went away or stopped the pool
+    }
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS && c->cmsg_len == CMSG_LEN(sizeof(fds))) {
+            memcpy(fds, CMSG_DATA(c), sizeof(fds));
+        }
+    }
+
+    char *payload = malloc(header[0] + 1);
+    char **argv = malloc((header[1] + 1) * sizeof(char *));
+    char **envp = malloc((header[2] + 1) * sizeof(char *));
+    if (payload == NULL || argv == NULL || envp == NULL || read_full(sock, payload, header[0]) != 0) {
+        _exit(126);
+    }
+    payload[header[0]] = '\0';
+    close(sock);
+
+    // Payload: cwd, argv and envp as consecutive NUL-terminated strings
+    char *p = payload;
+    char *cwd = p;
+    p += strlen(p) + 1;
+    for (uint32_t i = 0; i < header[1]; i++, p += strlen(p) + 1) {
+        argv[i] = p;
+    }
+    argv[header[1]] = NULL;
+    for (uint32_t i = 0; i < header[2]; i++, p += strlen(p) + 1) {
+        envp[i] = p;
+    }
+    envp[header[2]] = NULL;
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (fds[fd] < 0 || dup2(fds[fd], fd) < 0) {
+            _exit(126);
+        }
+    }
+    for (int fd = 0; fd < 3; fd++) {
+        if (fds[fd] > 2) {
+            close(fds[fd]);
+        }
+    }
+    if (chdir(cwd) != 0) {
+        fprintf(stderr, "cseshell: %s: %s\n", cwd, strerror(errno));
+        _exit(126);
+    }
+    environ = envp;
+    exec_system_program(argv);
+    _exit(127);
+}
+
+// Fork one helper into the pool
+static int add_helper(void) {
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        return -1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        // Keep only the standard fds and this helper's socket, so that idle
+        // helpers never hold pipes or other helpers' sockets open
+        if (dup2(sv[1], 3) < 0) {
+            _exit(1);
+        }
+        if (syscall(SYS_close_range, 4, ~0U, 0) != 0) {
+            for (int fd = 4; fd < 1024; fd++) {
+                close(fd);
+            }
+        }
+        helper_main(3);
+    }
+    close(sv[1]);
+    pool[pool_count].pid = pid;
+    pool[pool_count].sock = sv[0];
+    pool_count++;
+    return 0;
+}
+
+// Fork helpers until the pool is back at its target size. Called while a
+// command is running, so the cost overlaps with useful work.
+void zygote_refill(void) {
+    while (pool_count < pool_target) {
+        if (add_helper() != 0) {
+            break;
+        }
+    }
+}
+
+int zygote_start(int helpers) {
+    if (helpers < 1 || helpers > ZYGOTE_MAX_HELPERS) {
+        fprintf(stderr, "zygote: pool size must be between 1 and %d\n", ZYGOTE_MAX_HELPERS);
+        return 1;
+    }
+    pool_target = helpers;
+    while (pool_count > pool_target) {
+        pool_count--;
+        close(pool[pool_count].sock);
+        waitpid(pool[pool_count].pid, NULL, 0);
+    }
+    zygote_refill();
+    return pool_count == pool_target ? 0 : 1;
+}
+
+// Closing the sockets makes idle helpers exit
+void zygote_stop(void) {
+    pool_target = 0;
+    for (int i = 0; i < pool_count; i++) {
+        close(pool[i].sock);
+    }
+    for (int i = 0; i < pool_count; i++) {
+        waitpid(pool[i].pid, NULL, 0);
+    }
+    pool_count = 0;
+}
+
+// Work out the child's standard descriptors in the parent, opening
+// redirection targets here. Returns -1 if a target cannot be opened; the
+// caller then falls back to fork so the error is reported as usual.
+static int resolve_fds(const struct command *cmd, const int *std_fds, int fds[3], int opened[], int *num_opened) {
+    *num_opened = 0;
+    for (int fd = 0; fd < 3; fd++) {
+        fds[fd] = std_fds != NULL && std_fds[fd] >= 0 ? std_fds[fd] : fd;
+    }
+    for (int i = 0; cmd != NULL && i < cmd->num_redirs; i++) {
+        const struct redirection *redir = &cmd->redirs[i];
+        if (redir->type == TOK_REDIR_DUP) {
+            fds[redir->fd] = fds[redir->dup_fd];
+            continue;
+        }
+        int flags = O_CLOEXEC;
+        if (redir->type == TOK_REDIR_IN) {
+            flags |= O_RDONLY;
+        } else if (redir->type == TOK_REDIR_APPEND) {
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+        } else {
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+        }
+        int fd = open(redir->path, flags, 0666);
+        if (fd < 0) {
+            return -1;
+        }
+        opened[(*num_opened)++] = fd;
+        fds[redir->fd] = fd;
+    }
+    return 0;
+}
+
+/*
+ Launch argv on an idle helper. Returns the helper's pid, now running the
+ command, or -1 if the pool is empty or the request could not be handed
+ over (the caller then forks).
+*/
+pid_t zygote_spawn(char **argv, const struct command *cmd, const int *std_fds) {
+    int fds[3], opened[64], num_opened = 0;
+    char cwd[PATH_MAX];
+
+    if (pool_count == 0 || bypass || (cmd != NULL && cmd->num_redirs > 64) || getcwd(cwd, sizeof(cwd)) == NULL) {
+        return -1;
+    }
+    if (resolve_fds(cmd, std_fds, fds, opened, &num_opened) != 0) {
+        for (int i = 0; i < num_opened; i++) {
+            close(opened[i]);
+        }
+        return -1;
+    }
+
+    struct strbuf payload = {0};
+    uint32_t header[3] = {0, 0, 0};
+    strbuf_append(&payload, cwd, strlen(cwd) + 1);
+    for (; argv[header[1]] != NULL; header[1]++) {
+        strbuf_append(&payload, argv[header[1]], strlen(argv[header[1]]) + 1);
+    }
+    for (; environ[header[2]] != NULL; header[2]++) {
+        strbuf_append(&payload, environ[header[2]], strlen(environ[header[2]]) + 1);
+    }
+    header[0] = (uint32_t)payload.len;
+
+    struct zygote_helper helper = pool[--pool_count];
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov[2] = {{header, sizeof(header)}, {payload.buf, payload.len}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+    // The helper is blocked in recvmsg, so the limits are in place before it execs
+    job_apply(helper.pid);
+
+    fflush(stdout);
+    fflush(stderr);
+    size_t total = sizeof(header) + payload.len;
+    ssize_t sent = sendmsg(helper.sock, &msg, MSG_NOSIGNAL);
+    size_t done = sent > 0 ? (size_t)sent : 0;
+    int ok = done >= sizeof(header);
+    // Anything the first sendmsg did not take goes after it, without fds
+    while (ok && done < total) {
+        sent = send(helper.sock, payload.buf + (done - sizeof(header)), total - done, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            ok = 0;
+            break;
+        }
+        done += sent;
+    }
+
+    close(helper.sock);
+    for (int i = 0; i < num_opened; i++) {
+        close(opened[i]);
+    }
+    strbuf_free(&payload);
+
+    if (!ok) {
+        // The helper died: reap it and let the caller fork instead
+        kill(helper.pid, SIGKILL);
+        waitpid(helper.pid, NULL, 0);
+        return -1;
+    }
+    return helper.pid;
+}
+
+int zygote_active(void) {
+    return pool_target > 0 && !bypass;
+}
+
+// Record a launch for 'zygote stats' that started at 'start_us'
+void zygote_record_launch(pid_t pid, int via_zygote, double start_us) {
+    double now = now_us();
+    stats[via_zygote].launches++;
+    stats[via_zygote].spawn_us += now - start_us;
+    for (int i = 0; i < ZYGOTE_MAX_TRACKED; i++) {
+        if (tracked[i].pid == 0) {
+            tracked[i].pid = pid;
+            tracked[i].via_zygote = via_zygote;
+            tracked[i].start_us = start_us;
+            break;
+        }
+    }
+}
+
+// Record that a launched pid was reaped, under the path that launched it
+void zygote_record_exit(pid_t pid) {
+    for (int i = 0; i < ZYGOTE_MAX_TRACKED; i++) {
+        if (tracked[i].pid == pid) {
+            stats[tracked[i].via_zygote].waited++;
+            stats[tracked[i].via_zygote].wall_ms += (now_us() - tracked[i].start_us) / 1e3;
+            tracked[i].pid = 0;
+            break;
+        }
+    }
+}
+
+static void print_stats(void) {
+    static const char *names[] = {"fork", "zygote"};
+    printf("zygote pool: %d/%d helpers ready\n", pool_count, pool_target);
+    for (int i = 0; i < 2; i++) {
+        if (stats[i].launches == 0) {
+            printf("  %-6s  no launches\n", names[i]);
+            continue;
+        }
+        printf("  %-6s  %6ld launches, %8.1f us to launch", names[i], stats[i].launches,
+               stats[i].spawn_us / stats[i].launches);
+        if (stats[i].waited > 0) {
+            printf(", %8.3f ms until exit", stats[i].wall_ms / stats[i].waited);
+        }
+        printf(" (averages)\n");
+    }
+}
+
+// Run argv 'runs' times on one path with output discarded
+static void bench_path(char **argv, int runs, int use_zygote, struct launch_stats *out) {
+    int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    int std_fds[3] = {null_fd, null_fd, null_fd};
+    int status;
+
+    memset(out, 0, sizeof(*out));
+    bypass = !use_zygote;
+    for (int i = 0; i < runs; i++) {
+        double start = now_us();
+        pid_t pid = -1;
+        if (use_zygote) {
+            pid = zygote_spawn(argv, NULL, std_fds);
+        }
+        if (pid < 0) {
+            pid = fork();
+            if (pid == 0) {
+                for (int fd = 0; fd < 3; fd++) {
+                    dup2(null_fd, fd);
+                }
+                exec_system_program(argv);
+                _exit(127);
+            }
+        }
+        double launched = now_us();
+        if (use_zygote) {
+            zygote_refill();
+        }
+        waitpid(pid, &status, 0);
+        out->launches++;
+        out->spawn_us += launched - start;
+        out->wall_ms += (now_us() - start) / 1e3;
+    }
+    bypass = 0;
+    close(null_fd);
+}
+
+// Handler for 'zygote' command
+int shell_zygote(char **args) {
+    if (args[1] == NULL || strcmp(args[1], "stats") == 0) {
+        print_stats();
+        return 0;
+    }
+    if (strcmp(args[1], "start") == 0) {
+        return zygote_start(args[2] != NULL ? atoi(args[2]) : 4);
+    }
+    if (strcmp(args[1], "stop") == 0) {
+        zygote_stop();
+        return 0;
+    }
+    if (strcmp(args[1], "bench") == 0 && args[2] != NULL && args[3] != NULL) {
+        int runs = atoi(args[2]);
+        struct launch_stats with_fork, with_zygote;
+        int started = 0;
+
+        if (runs <= 0) {
+            fprintf(stderr, "zygote: bench needs a positive run count\n");
+            return 1;
+        }
+        if (pool_target == 0) {
+            zygote_start(4);
+            started = 1;
+        }
+        bench_path(&args[3], runs, 0, &with_fork);
+        bench_path(&args[3], runs, 1, &with_zygote);
+        if (started) {
+            zygote_stop();
+        }
+
+        printf("%d runs of %s (output discarded):\n", runs, args[3]);
+        printf("  fork    %8.1f us to launch, %8.3f ms until exit (averages)\n",
+               with_fork.spawn_us / runs, with_fork.wall_ms / runs);
+        printf("  zygote  %8.1f us to launch, %8.3f ms until exit (averages)\n",
+               with_zygote.spawn_us / runs, with_zygote.wall_ms / runs);
+        return 0;
+    }
+    fprintf(stderr, "Usage: zygote [stats | start [N] | stop | bench RUNS command [args...]]\n");
+    return 1;
+}